@@ -124,8 +124,8 @@ static void ios_handle_die(const char *msg) {
     generic_mknod("/dev/random", S_IFCHR|0666, dev_make(1, 8));
     generic_mknod("/dev/urandom", S_IFCHR|0666, dev_make(1, 9));
 
-    do_mount(&procfs, "proc", "/proc");
-    do_mount(&devptsfs, "devpts", "/dev/pts");
+    do_mount(&procfs, "proc", "/proc", NULL);
+    do_mount(&devptsfs, "devpts", "/dev/pts", NULL);
 
     task_start(current);
     return 0;
@@ -601,10 +601,9 @@ static bool modrm_compute(struct cpu_state *cpu, struct tlb *tlb, addr_t *addr_o
 
 flatten __no_instrument void cpu_run(struct cpu_state *cpu) {
     int i = 0;
-    struct tlb tlb = {.mem = cpu->mem};
-    tlb_flush(&tlb);
+    struct tlb tlb;
+    tlb_init(&tlb, cpu->mem);
     read_wrlock(&cpu->mem->lock);
-    int changes = cpu->mem->changes;
     while (true) {
         int interrupt = cpu_step32(cpu, &tlb);
         if (interrupt == INT_NONE && i++ >= 100000) {
@@ -616,12 +615,7 @@ flatten __no_instrument void cpu_run(struct cpu_state *cpu) {
             read_wrunlock(&cpu->mem->lock);
             handle_interrupt(interrupt);
             read_wrlock(&cpu->mem->lock);
-            if (tlb.mem != cpu->mem)
-                tlb.mem = cpu->mem;
-            if (cpu->mem->changes != changes) {
-                tlb_flush(&tlb);
-                changes = cpu->mem->changes;
-            }
+            tlb_refresh(&tlb, cpu->mem);
         }
     }
 }
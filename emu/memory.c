@@ -1,3 +1,6 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #include <unistd.h>
 #include <sys/mman.h>
 #include <string.h>
@@ -11,13 +14,14 @@
 #include "emu/memory.h"
 #include "jit/jit.h"
 
-// increment the change count
-static void mem_changed(struct mem *mem);
+// increment the change count and log the range
+static void mem_changed(struct mem *mem, page_t start, pages_t pages);
 
 void mem_init(struct mem *mem) {
     mem->pgdir = calloc(MEM_PGDIR_SIZE, sizeof(struct pt_entry *));
     mem->pgdir_used = 0;
     mem->changes = 0;
+    memset(mem->change_log, 0, sizeof(mem->change_log));
 #if JIT
     mem->jit = jit_new(mem);
 #endif
@@ -138,15 +142,79 @@ int pt_unmap(struct mem *mem, page_t start, pages_t pages, int force) {
 #endif
         struct data *data = pt->data;
         mem_pt_del(mem, page);
-        if (--data->refcount == 0) {
-            munmap(data->data, data->size);
-            free(data);
-        }
+        data_release(data);
+    }
+    mem_changed(mem, start, pages);
+    return 0;
+}
+
+void data_retain(struct data *data) {
+    data->refcount++;
+}
+
+void data_release(struct data *data) {
+    if (--data->refcount == 0) {
+        munmap(data->data, data->size);
+        free(data);
+    }
+}
+
+int pt_move(struct mem *mem, page_t src, pages_t pages, page_t dst) {
+    for (page_t page = src; page < src + pages; page++)
+        if (mem_pt(mem, page) == NULL)
+            return -1;
+
+    pt_unmap(mem, dst, pages, PT_FORCE);
+    for (pages_t i = 0; i < pages; i++) {
+#if JIT
+        // blocks are keyed on guest addresses, so they can't come along
+        jit_invalidate_page(mem->jit, src + i);
+#endif
+        struct pt_entry *entry = mem_pt(mem, src + i);
+        struct pt_entry *new_entry = mem_pt_new(mem, dst + i);
+        new_entry->data = entry->data;
+        new_entry->offset = entry->offset;
+        new_entry->flags = entry->flags & ~P_COMPILED;
+        mem_pt_del(mem, src + i);
     }
-    mem_changed(mem);
+    mem_changed(mem, src, pages);
+    mem_changed(mem, dst, pages);
     return 0;
 }
 
+int pt_grow(struct mem *mem, page_t start, pages_t pages, pages_t new_pages) {
+    unsigned flags = mem_pt(mem, start + pages - 1)->flags & ~P_COW;
+#ifdef __linux__
+    // If this range is the only user of its backing memory, have the host
+    // extend it, so the whole mapping stays in one contiguous host region.
+    struct data *data = mem_pt(mem, start)->data;
+    bool exclusive = data->size == pages * PAGE_SIZE && data->refcount == pages;
+    for (pages_t i = 0; exclusive && i < pages; i++) {
+        struct pt_entry *entry = mem_pt(mem, start + i);
+        if (entry->data != data || entry->offset != i * PAGE_SIZE)
+            exclusive = false;
+    }
+    if (exclusive && !(flags & P_SHARED)) {
+        void *memory = mremap(data->data, data->size, new_pages * PAGE_SIZE, MREMAP_MAYMOVE);
+        if (memory != MAP_FAILED) {
+            data->data = memory;
+            data->size = new_pages * PAGE_SIZE;
+            for (pages_t i = pages; i < new_pages; i++) {
+                data->refcount++;
+                struct pt_entry *entry = mem_pt_new(mem, start + i);
+                entry->data = data;
+                entry->offset = i * PAGE_SIZE;
+                entry->flags = flags;
+            }
+            // the old host address might be cached in a tlb
+            mem_changed(mem, start, new_pages);
+            return 0;
+        }
+    }
+#endif
+    return pt_map_nothing(mem, start + pages, new_pages - pages, flags);
+}
+
 int pt_map_nothing(struct mem *mem, page_t start, pages_t pages, unsigned flags) {
     if (pages == 0) return 0;
     void *memory = mmap(NULL, pages * PAGE_SIZE,
@@ -161,7 +229,7 @@ int pt_set_flags(struct mem *mem, page_t start, pages_t pages, int flags) {
     for (page_t page = start; page < start + pages; page++) {
         struct pt_entry *entry = mem_pt(mem, page);
         int old_flags = entry->flags;
-        entry->flags = flags;
+        entry->flags = flags | (old_flags & P_SHARED);
         // check if protection is increasing
         if ((flags & ~old_flags) & (P_READ|P_WRITE)) {
             void *data = (char *) entry->data->data + entry->offset;
@@ -173,7 +241,7 @@ int pt_set_flags(struct mem *mem, page_t start, pages_t pages, int flags) {
                 return errno_map();
         }
     }
-    mem_changed(mem);
+    mem_changed(mem, start, pages);
     return 0;
 }
 
@@ -184,8 +252,8 @@ int pt_copy_on_write(struct mem *src, struct mem *dst, page_t start, page_t page
             continue;
         if (pt_unmap(dst, page, 1, PT_FORCE) < 0)
             return -1;
-        // TODO skip shared mappings
-        entry->flags |= P_COW;
+        if (!(entry->flags & P_SHARED))
+            entry->flags |= P_COW;
         entry->flags &= ~P_COMPILED;
         entry->data->refcount++;
         struct pt_entry *dst_entry = mem_pt_new(dst, page);
@@ -193,13 +261,18 @@ int pt_copy_on_write(struct mem *src, struct mem *dst, page_t start, page_t page
         dst_entry->offset = entry->offset;
         dst_entry->flags = entry->flags;
     }
-    mem_changed(src);
-    mem_changed(dst);
+    mem_changed(src, start, pages);
+    mem_changed(dst, start, pages);
     return 0;
 }
 
-static void mem_changed(struct mem *mem) {
-    mem->changes++;
+static void mem_changed(struct mem *mem, page_t start, pages_t pages) {
+    unsigned gen = mem->changes++;
+    struct mem_change *change = &mem->change_log[gen % MEM_CHANGE_LOG_SIZE];
+    change->gen = 0;
+    change->start = start;
+    change->pages = pages;
+    change->gen = gen + 1;
 }
 
 void *mem_ptr(struct mem *mem, addr_t addr, int type) {
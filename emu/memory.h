@@ -12,10 +12,21 @@ struct jit;
 
 // top 20 bits of an address, i.e. address >> 12
 typedef dword_t page_t;
+typedef dword_t pages_t;
 #define BAD_PAGE 0x10000
 
+// A range of pages whose mappings changed. Each tlb replays the records it
+// hasn't seen yet, and flushes everything if it fell too far behind.
+struct mem_change {
+    atomic_uint gen; // changes + 1 at the time of the change, 0 while being written
+    page_t start;
+    pages_t pages;
+};
+#define MEM_CHANGE_LOG_SIZE 64
+
 struct mem {
     atomic_uint changes; // increment whenever a tlb flush is needed
+    struct mem_change change_log[MEM_CHANGE_LOG_SIZE];
     struct pt_entry **pgdir;
     int pgdir_used;
 
@@ -41,17 +52,22 @@ struct pt_entry *mem_pt(struct mem *mem, page_t page);
 #define PAGE_SIZE (1 << PAGE_BITS)
 #define PAGE(addr) ((addr) >> PAGE_BITS)
 #define PGOFFSET(addr) ((addr) & (PAGE_SIZE - 1))
-typedef dword_t pages_t;
 #define PAGE_ROUND_UP(bytes) (((bytes - 1) / PAGE_SIZE) + 1)
 
 #define BYTES_ROUND_DOWN(bytes) (PAGE(bytes) << PAGE_BITS)
 #define BYTES_ROUND_UP(bytes) (PAGE_ROUND_UP(bytes) << PAGE_BITS)
 
 struct data {
-    void *data; // immutable
-    size_t size; // also immutable
+    // immutable, except pt_grow can extend memory nothing else is using
+    void *data;
+    size_t size;
     atomic_uint refcount;
 };
+// Keep the memory alive even if it gets unmapped, e.g. while doing IO on it
+// without the mem lock. Each page mapping it also holds a reference.
+void data_retain(struct data *data);
+void data_release(struct data *data);
+
 struct pt_entry {
     struct data *data;
     size_t offset;
@@ -71,6 +87,7 @@ struct pt_entry {
 #define P_WRITABLE(flags) (flags & P_WRITE && !(flags & P_COW))
 #define P_COMPILED (1 << 5)
 #define P_ANON (1 << 6)
+#define P_SHARED (1 << 7)
 
 bool pt_is_hole(struct mem *mem, page_t start, pages_t pages);
 page_t pt_find_hole(struct mem *mem, pages_t size);
@@ -86,6 +103,13 @@ int pt_map_file(struct mem *mem, page_t start, pages_t pages, int fd, off_t off,
 int pt_map_nothing(struct mem *mem, page_t page, pages_t pages, unsigned flags);
 // Unmap fake memory, return -1 if any part of the range isn't mapped and 0 otherwise
 int pt_unmap(struct mem *mem, page_t start, pages_t pages, int force);
+// Move mappings to another place in the same address space, without touching
+// the memory behind them. The destination is unmapped first. Return -1 if any
+// part of the source isn't mapped.
+int pt_move(struct mem *mem, page_t src, pages_t pages, page_t dst);
+// Extend an anonymous mapping of pages at start to new_pages. The pages after
+// it must be a hole.
+int pt_grow(struct mem *mem, page_t start, pages_t pages, pages_t new_pages);
 // Set the flags on memory
 int pt_set_flags(struct mem *mem, page_t start, pages_t pages, int flags);
 // Copy pages from src memory to dst memory using copy-on-write
@@ -1,15 +1,79 @@
 #include "emu/cpu.h"
 #include "emu/tlb.h"
 
+struct tlb_stats tlb_stats;
+
 void tlb_init(struct tlb *tlb, struct mem *mem) {
     tlb->mem = mem;
     tlb->dirty_page = TLB_PAGE_EMPTY;
+    tlb->changes = mem->changes;
     tlb_flush(tlb);
+    memset(&tlb->stats, 0, sizeof(tlb->stats));
 }
 
+static const struct tlb_entry empty_entry = {.page = TLB_PAGE_EMPTY, .page_if_writable = TLB_PAGE_EMPTY};
+
 void tlb_flush(struct tlb *tlb) {
     for (unsigned i = 0; i < TLB_SIZE; i++)
-        tlb->entries[i] = (struct tlb_entry) {.page = 1, .page_if_writable = 1};
+        tlb->entries[i] = tlb->entries_old[i] = empty_entry;
+    for (unsigned i = 0; i < TLB_VICTIMS; i++)
+        tlb->victims[i] = empty_entry;
+    tlb->next_victim = 0;
+    tlb->stats.flushes++;
+}
+
+static void tlb_invalidate(struct tlb *tlb, page_t start, pages_t pages) {
+    for (page_t page = start; page < start + pages; page++) {
+        addr_t addr = page << PAGE_BITS;
+        unsigned index = TLB_INDEX(addr);
+        if (tlb->entries[index].page == addr)
+            tlb->entries[index] = empty_entry;
+        if (tlb->entries_old[index].page == addr)
+            tlb->entries_old[index] = empty_entry;
+        for (unsigned i = 0; i < TLB_VICTIMS; i++)
+            if (tlb->victims[i].page == addr)
+                tlb->victims[i] = empty_entry;
+    }
+    tlb->stats.invalidations++;
+}
+
+static void tlb_stats_publish(struct tlb *tlb) {
+    tlb_stats.hits += tlb->stats.hits;
+    tlb_stats.misses += tlb->stats.misses;
+    tlb_stats.flushes += tlb->stats.flushes;
+    tlb_stats.invalidations += tlb->stats.invalidations;
+    memset(&tlb->stats, 0, sizeof(tlb->stats));
+}
+
+void tlb_refresh(struct tlb *tlb, struct mem *mem) {
+    tlb_stats_publish(tlb);
+    unsigned changes = mem->changes;
+    if (tlb->mem != mem) {
+        tlb->mem = mem;
+        goto flush;
+    }
+    if (changes - tlb->changes > MEM_CHANGE_LOG_SIZE)
+        goto flush;
+    for (unsigned gen = tlb->changes; gen != changes; gen++) {
+        struct mem_change *change = &mem->change_log[gen % MEM_CHANGE_LOG_SIZE];
+        if (change->gen != gen + 1)
+            goto flush;
+        page_t start = change->start;
+        pages_t pages = change->pages;
+        // make sure it wasn't overwritten while we were reading it
+        if (change->gen != gen + 1)
+            goto flush;
+        // past this point it's cheaper to start over
+        if (pages > TLB_SIZE)
+            goto flush;
+        tlb_invalidate(tlb, start, pages);
+    }
+    tlb->changes = changes;
+    return;
+
+flush:
+    tlb_flush(tlb);
+    tlb->changes = changes;
 }
 
 void tlb_free(struct tlb *tlb) {
@@ -41,18 +105,53 @@ bool __tlb_write_cross_page(struct tlb *tlb, addr_t addr, const char *value, uns
 }
 
 __no_instrument void *tlb_handle_miss(struct tlb *tlb, addr_t addr, int type) {
-    char *ptr = mem_ptr(tlb->mem, TLB_PAGE(addr), type);
+    page_t page = TLB_PAGE(addr);
+    struct tlb_entry *first = &tlb->entries[TLB_INDEX(addr)];
+    struct tlb_entry *second = &tlb->entries_old[TLB_INDEX(addr)];
+
+    // see if it's in the second way or the victim buffer
+    struct tlb_entry *found = NULL;
+    if (second->page == page) {
+        found = second;
+    } else {
+        for (unsigned i = 0; i < TLB_VICTIMS; i++) {
+            if (tlb->victims[i].page == page) {
+                found = &tlb->victims[i];
+                break;
+            }
+        }
+    }
+    if (found != NULL && (type == MEM_READ || found->page_if_writable == page)) {
+        struct tlb_entry entry = *found;
+        *found = *first;
+        *first = entry;
+        tlb->dirty_page = page;
+        tlb->stats.hits++;
+        return (void *) (first->data_minus_addr + addr);
+    }
+
+    tlb->stats.misses++;
+    char *ptr = mem_ptr(tlb->mem, page, type);
     if (ptr == NULL)
         return NULL;
-    tlb->dirty_page = TLB_PAGE(addr);
+    tlb->dirty_page = page;
 
-    struct tlb_entry *tlb_ent = &tlb->entries[TLB_INDEX(addr)];
-    tlb_ent->page = TLB_PAGE(addr);
+    if (first->page != page) {
+        // a read only entry for this page is about to be replaced
+        if (found != NULL)
+            *found = empty_entry;
+        if (second->page != TLB_PAGE_EMPTY) {
+            tlb->victims[tlb->next_victim] = *second;
+            tlb->next_victim = (tlb->next_victim + 1) % TLB_VICTIMS;
+        }
+        *second = *first;
+    }
+    first->page = page;
     if (type == MEM_WRITE)
-        tlb_ent->page_if_writable = tlb_ent->page;
+        first->page_if_writable = first->page;
     else
         // 1 is not a valid page so this won't look like a hit
-        tlb_ent->page_if_writable = TLB_PAGE_EMPTY;
-    tlb_ent->data_minus_addr = (uintptr_t) ptr - TLB_PAGE(addr);
-    return (void *) (tlb_ent->data_minus_addr + addr);
+        first->page_if_writable = TLB_PAGE_EMPTY;
+    first->data_minus_addr = (uintptr_t) ptr - page;
+    return (void *) (first->data_minus_addr + addr);
 }
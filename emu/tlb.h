@@ -12,10 +12,33 @@ struct tlb_entry {
 };
 #define TLB_BITS 10
 #define TLB_SIZE (1 << TLB_BITS)
+#define TLB_VICTIMS 8
+
+struct tlb_stats {
+    uint64_t hits; // misses in the first way found without a page walk
+    uint64_t misses;
+    uint64_t flushes;
+    uint64_t invalidations;
+};
+// Totals for every tlb, shown in /proc/sys/vm/tlb_stats. Each tlb counts
+// locally and adds to these in tlb_refresh, so they're a little behind, and
+// only approximate since they're updated without synchronization.
+extern struct tlb_stats tlb_stats;
+
 struct tlb {
     struct mem *mem;
     page_t dirty_page;
+    unsigned changes; // position in mem's change log
+    // The tlb is two way set associative. The gadgets only look at the first
+    // way, so the miss handler keeps the most recently used entry of each set
+    // there and swaps the second way in on a hit.
     struct tlb_entry entries[TLB_SIZE];
+    struct tlb_entry entries_old[TLB_SIZE];
+    // entries evicted from the second way, replaced round robin
+    struct tlb_entry victims[TLB_VICTIMS];
+    unsigned next_victim;
+
+    struct tlb_stats stats;
 };
 
 #define TLB_INDEX(addr) (((addr >> PAGE_BITS) & (TLB_SIZE - 1)) ^ (addr >> (PAGE_BITS + TLB_BITS)))
@@ -24,6 +47,9 @@ struct tlb {
 void tlb_init(struct tlb *tlb, struct mem *mem);
 void tlb_free(struct tlb *tlb);
 void tlb_flush(struct tlb *tlb);
+// Catch up with changes to the page table, or switch to a different mem.
+// Needs mem's read lock.
+void tlb_refresh(struct tlb *tlb, struct mem *mem);
 void *tlb_handle_miss(struct tlb *tlb, addr_t addr, int type);
 
 forceinline __no_instrument void *__tlb_read_ptr(struct tlb *tlb, addr_t addr) {
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kernel/errno.h"
+#include "util/hash.h"
+#include "util/lru.h"
+#include "util/sync.h"
+#include "fs/dcache.h"
+
+#define DCACHE_HASH_SIZE (1 << 12)
+#define DCACHE_MAX_ENTRIES (1 << 13)
+
+struct dentry {
+    // what readlink returned, the length of the target or an error
+    ssize_t res;
+    struct lru_entry lru;
+    char *target; // points into path, after the terminator
+    char path[];
+};
+
+static lock_t dcache_lock = LOCK_INITIALIZER;
+static struct lru dcache;
+static struct list dcache_hash[DCACHE_HASH_SIZE];
+static bool dcache_initialized;
+static unsigned dcache_gen;
+static struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+} dcache_stats;
+
+static void dcache_init(void) {
+    if (dcache_initialized)
+        return;
+    lru_init(&dcache, dcache_hash, DCACHE_HASH_SIZE, DCACHE_MAX_ENTRIES);
+    dcache_initialized = true;
+}
+
+static struct dentry *dentry_find(const char *path, unsigned hash) {
+    struct dentry *dentry;
+    lru_for_each_hashed(&dcache, hash, dentry, lru) {
+        if (dentry->lru.hash == hash && strcmp(dentry->path, path) == 0)
+            return dentry;
+    }
+    return NULL;
+}
+
+static void dentry_evict(struct dentry *dentry) {
+    lru_remove(&dcache, &dentry->lru);
+    free(dentry);
+}
+
+unsigned dcache_generation() {
+    lock(&dcache_lock);
+    unsigned generation = dcache_gen;
+    unlock(&dcache_lock);
+    return generation;
+}
+
+bool dcache_get(const char *path, char *buf, size_t bufsize, ssize_t *res) {
+    lock(&dcache_lock);
+    dcache_init();
+    struct dentry *dentry = dentry_find(path, hash_str(HASH_INIT, path));
+    if (dentry == NULL) {
+        dcache_stats.misses++;
+        unlock(&dcache_lock);
+        return false;
+    }
+    dcache_stats.hits++;
+    lru_touch(&dcache, &dentry->lru);
+    *res = dentry->res;
+    if (*res >= 0) {
+        if ((size_t) *res > bufsize)
+            *res = bufsize;
+        memcpy(buf, dentry->target, *res);
+    }
+    unlock(&dcache_lock);
+    return true;
+}
+
+void dcache_put(const char *path, const char *target, ssize_t res, unsigned generation) {
+    // anything else might not happen next time
+    if (res < 0 && res != _EINVAL && res != _ENOENT && res != _ENOTDIR)
+        return;
+    size_t path_size = strlen(path) + 1;
+    size_t target_size = res >= 0 ? (size_t) res : 0;
+
+    lock(&dcache_lock);
+    dcache_init();
+    unsigned hash = hash_str(HASH_INIT, path);
+    if (generation != dcache_gen || dentry_find(path, hash) != NULL)
+        goto out;
+    struct lru_entry *victim = lru_victim(&dcache);
+    if (victim != NULL) {
+        dentry_evict(list_entry(victim, struct dentry, lru));
+        dcache_stats.evictions++;
+    }
+    struct dentry *dentry = malloc(sizeof(struct dentry) + path_size + target_size);
+    if (dentry == NULL)
+        goto out;
+    dentry->res = res;
+    memcpy(dentry->path, path, path_size);
+    dentry->target = dentry->path + path_size;
+    memcpy(dentry->target, target, target_size);
+    lru_insert(&dcache, &dentry->lru, hash);
+out:
+    unlock(&dcache_lock);
+}
+
+void dcache_invalidate(const char *path, bool subtree) {
+    lock(&dcache_lock);
+    dcache_init();
+    dcache_gen++;
+    dcache_stats.invalidations++;
+    struct dentry *dentry = dentry_find(path, hash_str(HASH_INIT, path));
+    if (dentry != NULL)
+        dentry_evict(dentry);
+    if (subtree) {
+        // after a rename every path under the old name means something
+        // else, and dentries are only reachable by their full path
+        size_t len = strlen(path);
+        struct dentry *tmp;
+        lru_for_each_safe(&dcache, dentry, tmp, lru) {
+            if (strncmp(dentry->path, path, len) == 0 && dentry->path[len] == '/')
+                dentry_evict(dentry);
+        }
+    }
+    unlock(&dcache_lock);
+}
+
+void dcache_invalidate_all() {
+    lock(&dcache_lock);
+    dcache_init();
+    dcache_gen++;
+    dcache_stats.invalidations++;
+    struct dentry *dentry, *tmp;
+    lru_for_each_safe(&dcache, dentry, tmp, lru)
+        dentry_evict(dentry);
+    unlock(&dcache_lock);
+}
+
+size_t dcache_show_stats(char *buf, size_t size) {
+    lock(&dcache_lock);
+    int len = snprintf(buf, size, "hits %llu misses %llu evictions %llu invalidations %llu entries %u\n",
+            (unsigned long long) dcache_stats.hits, (unsigned long long) dcache_stats.misses,
+            (unsigned long long) dcache_stats.evictions, (unsigned long long) dcache_stats.invalidations,
+            dcache.count);
+    unlock(&dcache_lock);
+    if (len < 0)
+        return 0;
+    if ((size_t) len >= size)
+        return size - 1;
+    return len;
+}
@@ -0,0 +1,28 @@
+#ifndef FS_DCACHE_H
+#define FS_DCACHE_H
+#include <sys/types.h>
+#include "misc.h"
+
+// Remembers what path resolution learned from readlink about each path,
+// whether it's a symlink (and to what), not a symlink, or not there at all,
+// so resolving the same directories over and over doesn't have to ask the
+// filesystem each time. Keyed by the full normalized path, so it covers every
+// mount. Anything that changes a path has to invalidate it afterwards, so
+// filesystems that can change behind our back (procfs, and realfs since the
+// host can change it) are marked dynamic and never cached.
+
+// Takes a snapshot to pass to dcache_put, so an answer that was looked up
+// while something was being changed doesn't get cached
+unsigned dcache_generation(void);
+// If the path is cached, copies the target into buf, sets *res to what
+// readlink returned, and returns true
+bool dcache_get(const char *path, char *buf, size_t bufsize, ssize_t *res);
+void dcache_put(const char *path, const char *target, ssize_t res, unsigned generation);
+// Drops the path, and if subtree is set everything under it
+void dcache_invalidate(const char *path, bool subtree);
+void dcache_invalidate_all(void);
+
+// For /proc/fs/dcache
+size_t dcache_show_stats(char *buf, size_t size);
+
+#endif
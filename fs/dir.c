@@ -56,7 +56,8 @@ int_t sys_getdents64(fd_t f, addr_t dirents, dword_t count) {
         dirent->inode = entry.inode;
         dirent->offset = fd_telldir(fd);
         dirent->reclen = reclen;
-        dirent->type = 0;
+        // same as IFTODT
+        dirent->type = (entry.type & S_IFMT) >> 12;
         strcpy(dirent->name, entry.name);
         if (printed < 20) {
             STRACE(" {inode=%d, offset=%d, name=%s, type=%d, reclen=%d}",
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "util/hash.h"
+#include "util/lru.h"
+#include "kernel/fs.h"
+#define ISH_INTERNAL
+#include "fs/fake.h"
+
+// Cache of the metadata database, so stat and friends don't have to run a
+// transaction every time. There are two tables, path -> inode and
+// inode -> stat, each with its own LRU list so they stay bounded. Everything
+// here is locked by the mount lock.
+
+#define CACHE_HASH_SIZE (1 << 12)
+#define CACHE_MAX_ENTRIES (1 << 14)
+
+struct cached_path {
+    ino_t inode;
+    struct lru_entry lru;
+    char path[];
+};
+
+struct cached_stat {
+    ino_t inode;
+    struct ish_stat stat;
+    struct lru_entry lru;
+};
+
+struct fakefs_cache {
+    struct lru paths;
+    struct list paths_hash[CACHE_HASH_SIZE];
+    struct lru stats;
+    struct list stats_hash[CACHE_HASH_SIZE];
+    struct fakefs_cache_stats counters;
+};
+
+struct fakefs_cache *fake_cache_new() {
+    struct fakefs_cache *cache = malloc(sizeof(struct fakefs_cache));
+    if (cache == NULL)
+        return NULL;
+    lru_init(&cache->paths, cache->paths_hash, CACHE_HASH_SIZE, CACHE_MAX_ENTRIES);
+    lru_init(&cache->stats, cache->stats_hash, CACHE_HASH_SIZE, CACHE_MAX_ENTRIES);
+    cache->counters = (struct fakefs_cache_stats) {};
+    return cache;
+}
+
+void fake_cache_free(struct fakefs_cache *cache) {
+    fake_cache_clear(cache);
+    free(cache);
+}
+
+static void path_evict(struct fakefs_cache *cache, struct cached_path *entry) {
+    lru_remove(&cache->paths, &entry->lru);
+    free(entry);
+}
+
+static void stat_evict(struct fakefs_cache *cache, struct cached_stat *entry) {
+    lru_remove(&cache->stats, &entry->lru);
+    free(entry);
+}
+
+static struct cached_path *path_find(struct fakefs_cache *cache, const char *path, unsigned hash) {
+    struct cached_path *entry;
+    lru_for_each_hashed(&cache->paths, hash, entry, lru) {
+        if (entry->lru.hash == hash && strcmp(entry->path, path) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+static struct cached_stat *stat_find(struct fakefs_cache *cache, ino_t inode) {
+    struct cached_stat *entry;
+    lru_for_each_hashed(&cache->stats, (unsigned) inode, entry, lru) {
+        if (entry->inode == inode)
+            return entry;
+    }
+    return NULL;
+}
+
+bool fake_cache_get_path(struct fakefs_cache *cache, const char *path, ino_t *inode) {
+    struct cached_path *entry = path_find(cache, path, hash_str(HASH_INIT, path));
+    if (entry == NULL) {
+        cache->counters.misses++;
+        return false;
+    }
+    cache->counters.hits++;
+    lru_touch(&cache->paths, &entry->lru);
+    *inode = entry->inode;
+    return true;
+}
+
+void fake_cache_put_path(struct fakefs_cache *cache, const char *path, ino_t inode) {
+    unsigned hash = hash_str(HASH_INIT, path);
+    struct cached_path *entry = path_find(cache, path, hash);
+    if (entry != NULL) {
+        entry->inode = inode;
+        lru_touch(&cache->paths, &entry->lru);
+        return;
+    }
+
+    struct lru_entry *victim = lru_victim(&cache->paths);
+    if (victim != NULL) {
+        path_evict(cache, list_entry(victim, struct cached_path, lru));
+        cache->counters.evictions++;
+    }
+    size_t path_size = strlen(path) + 1;
+    entry = malloc(sizeof(struct cached_path) + path_size);
+    if (entry == NULL)
+        return;
+    entry->inode = inode;
+    memcpy(entry->path, path, path_size);
+    lru_insert(&cache->paths, &entry->lru, hash);
+}
+
+void fake_cache_drop_path(struct fakefs_cache *cache, const char *path) {
+    struct cached_path *entry = path_find(cache, path, hash_str(HASH_INIT, path));
+    if (entry != NULL)
+        path_evict(cache, entry);
+}
+
+void fake_cache_drop_subtree(struct fakefs_cache *cache, const char *path) {
+    fake_cache_drop_path(cache, path);
+    // nothing is indexed by prefix, so this has to look at everything, but
+    // it's bounded by the size of the cache and only renames need it
+    size_t len = strlen(path);
+    struct cached_path *entry, *tmp;
+    lru_for_each_safe(&cache->paths, entry, tmp, lru) {
+        if (strncmp(entry->path, path, len) == 0 && entry->path[len] == '/')
+            path_evict(cache, entry);
+    }
+}
+
+bool fake_cache_get_stat(struct fakefs_cache *cache, ino_t inode, struct ish_stat *stat) {
+    struct cached_stat *entry = stat_find(cache, inode);
+    if (entry == NULL) {
+        cache->counters.misses++;
+        return false;
+    }
+    cache->counters.hits++;
+    lru_touch(&cache->stats, &entry->lru);
+    *stat = entry->stat;
+    return true;
+}
+
+void fake_cache_put_stat(struct fakefs_cache *cache, ino_t inode, struct ish_stat *stat) {
+    struct cached_stat *entry = stat_find(cache, inode);
+    if (entry == NULL) {
+        struct lru_entry *victim = lru_victim(&cache->stats);
+        if (victim != NULL) {
+            stat_evict(cache, list_entry(victim, struct cached_stat, lru));
+            cache->counters.evictions++;
+        }
+        entry = malloc(sizeof(struct cached_stat));
+        if (entry == NULL)
+            return;
+        entry->inode = inode;
+        lru_insert(&cache->stats, &entry->lru, (unsigned) inode);
+    } else {
+        lru_touch(&cache->stats, &entry->lru);
+    }
+    entry->stat = *stat;
+}
+
+void fake_cache_drop_stat(struct fakefs_cache *cache, ino_t inode) {
+    struct cached_stat *entry = stat_find(cache, inode);
+    if (entry != NULL)
+        stat_evict(cache, entry);
+}
+
+void fake_cache_clear(struct fakefs_cache *cache) {
+    struct cached_path *path, *tmp_path;
+    lru_for_each_safe(&cache->paths, path, tmp_path, lru)
+        path_evict(cache, path);
+    struct cached_stat *stat, *tmp_stat;
+    lru_for_each_safe(&cache->stats, stat, tmp_stat, lru)
+        stat_evict(cache, stat);
+}
+
+struct fakefs_cache_stats fake_cache_stats(struct fakefs_cache *cache) {
+    struct fakefs_cache_stats stats = cache->counters;
+    stats.entries = cache->paths.count + cache->stats.count;
+    return stats;
+}
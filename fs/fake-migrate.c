@@ -1,9 +1,118 @@
+#include <string.h>
+#include <sqlite3.h>
 #include "kernel/fs.h"
 #include "debug.h"
 #include "kernel/errno.h"
 
 // The value of the user_version pragma is used to decide what needs migrating.
 
+#define CHECK_ERR() \
+    if (err != SQLITE_OK && err != SQLITE_ROW && err != SQLITE_DONE) \
+        die("sqlite error while migrating: %s\n", sqlite3_errmsg(mount->db));
+#define EXEC(sql) \
+    err = sqlite3_exec(mount->db, sql, NULL, NULL, NULL); \
+    CHECK_ERR();
+#define PREPARE(sql) ({ \
+    sqlite3_stmt *stmt; \
+    err = sqlite3_prepare_v2(mount->db, sql, -1, &stmt, NULL); \
+    CHECK_ERR(); \
+    stmt; \
+})
+#define STEP(stmt) ({ \
+    err = sqlite3_step(stmt); \
+    CHECK_ERR(); \
+    err == SQLITE_ROW; \
+})
+#define RESET(stmt) \
+    err = sqlite3_reset(stmt); \
+    CHECK_ERR()
+#define FINALIZE(stmt) \
+    err = sqlite3_finalize(stmt); \
+    CHECK_ERR()
+
+// Version 4 replaces the paths table with a directory tree. The paths are
+// read in order, which puts each directory before everything in it, and the
+// directory each one goes in is found by looking it up in what's been
+// written so far. The last directory found is remembered, since it's usually
+// the next one needed too. Nothing else is kept in memory, so this works for
+// any number of paths.
+static void migrate_to_dentries(struct mount *mount) {
+    int err;
+    sqlite3_stmt *get_paths = PREPARE("select path, inode from paths order by path");
+    sqlite3_stmt *lookup = PREPARE("select inode from dentries where parent = ? and name = ?");
+    sqlite3_stmt *insert = PREPARE("insert or replace into dentries (parent, name, inode) values (?, ?, ?)");
+
+    char last_dir[MAX_PATH + 1] = {};
+    size_t last_dir_len = 0;
+    ino_t last_dir_inode = 0;
+    bool have_last_dir = false;
+
+    while (STEP(get_paths)) {
+        const char *path = sqlite3_column_blob(get_paths, 0);
+        size_t path_len = sqlite3_column_bytes(get_paths, 0);
+        ino_t inode = sqlite3_column_int64(get_paths, 1);
+        if (path == NULL)
+            path = "";
+        if (path_len > MAX_PATH)
+            continue;
+
+        // split into directory and name, the root is "" in directory 0
+        const char *slash = NULL;
+        for (size_t i = path_len; i > 0; i--) {
+            if (path[i - 1] == '/') {
+                slash = &path[i - 1];
+                break;
+            }
+        }
+        ino_t parent = 0;
+        const char *name = path;
+        size_t name_len = path_len;
+        if (slash != NULL) {
+            size_t dir_len = slash - path;
+            name = slash + 1;
+            name_len = path_len - dir_len - 1;
+            if (!(have_last_dir && dir_len == last_dir_len && memcmp(path, last_dir, dir_len) == 0)) {
+                // walk down from the root
+                const char *component = path;
+                const char *dir_end = path + dir_len;
+                parent = 0;
+                for (;;) {
+                    const char *end = memchr(component, '/', dir_end - component);
+                    if (end == NULL)
+                        end = dir_end;
+                    err = sqlite3_bind_int64(lookup, 1, parent); CHECK_ERR();
+                    err = sqlite3_bind_blob(lookup, 2, component, end - component, SQLITE_TRANSIENT); CHECK_ERR();
+                    parent = STEP(lookup) ? sqlite3_column_int64(lookup, 0) : 0;
+                    RESET(lookup);
+                    if (parent == 0 || end == dir_end)
+                        break;
+                    component = end + 1;
+                }
+                memcpy(last_dir, path, dir_len);
+                last_dir_len = dir_len;
+                last_dir_inode = parent;
+                have_last_dir = true;
+            }
+            parent = last_dir_inode;
+            // the directory is missing, so there's no way to get to this
+            if (parent == 0)
+                continue;
+        }
+
+        err = sqlite3_bind_int64(insert, 1, parent); CHECK_ERR();
+        err = sqlite3_bind_blob(insert, 2, name, name_len, SQLITE_TRANSIENT); CHECK_ERR();
+        err = sqlite3_bind_int64(insert, 3, inode); CHECK_ERR();
+        STEP(insert);
+        RESET(insert);
+    }
+
+    FINALIZE(get_paths);
+    FINALIZE(lookup);
+    FINALIZE(insert);
+    EXEC("drop table paths");
+    EXEC("delete from stats where not exists (select 1 from dentries where inode = stats.inode)");
+}
+
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 static struct migration {
     const char *sql;
@@ -30,41 +139,33 @@ static struct migration {
     {
         "drop trigger delete_path"
     },
+    // version 4: store the directory tree instead of full paths
+    {
+        "create table dentries (parent integer not null, name blob not null, "
+            "inode integer not null references stats(inode), primary key (parent, name)) without rowid;"
+        "create index dentries_inode on dentries (inode);",
+        migrate_to_dentries,
+    },
+    // version 5: count inodes that might be left without a path, so the sweep
+    // for them doesn't have to run on every mount. starts at 1 so there's one
+    // sweep after upgrading.
+    {
+        "alter table meta add column orphans integer not null default 1;"
+    },
 };
 
 int fakefs_migrate(struct mount *mount) {
     int err;
-#define CHECK_ERR() \
-    if (err != SQLITE_OK && err != SQLITE_ROW && err != SQLITE_DONE) \
-        die("sqlite error while migrating: %s\n", sqlite3_errmsg(mount->db));
-#define EXEC(sql) \
-    err = sqlite3_exec(mount->db, sql, NULL, NULL, NULL); \
-    CHECK_ERR();
-#define PREPARE(sql) ({ \
-    sqlite3_stmt *stmt; \
-    err = sqlite3_prepare_v2(mount->db, sql, -1, &stmt, NULL); \
-    CHECK_ERR(); \
-    stmt; \
-})
-#define STEP(stmt) ({ \
-    err = sqlite3_step(stmt); \
-    CHECK_ERR(); \
-    err == SQLITE_ROW; \
-})
-#define RESET(stmt) \
-    err = sqlite3_reset(stmt); \
-    CHECK_ERR()
-#define FINALIZE(stmt) \
-    err = sqlite3_finalize(stmt); \
-    CHECK_ERR()
-
     sqlite3_stmt *user_version = PREPARE("pragma user_version");
     STEP(user_version);
     int version = sqlite3_column_int(user_version, 0);
     FINALIZE(user_version);
 
-    EXEC("begin");
     int versions = sizeof(migrations)/sizeof(migrations[0]);
+    // the usual case, and not worth a write transaction
+    if (version >= versions)
+        return 0;
+    EXEC("begin");
     while (version < versions) {
         struct migration m = migrations[version];
         if (m.sql != NULL)
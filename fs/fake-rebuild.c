@@ -1,143 +1,424 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <pthread.h>
 #include <sqlite3.h>
 #include "kernel/fs.h"
 #include "kernel/errno.h"
-#include "util/list.h"
+#include "util/sync.h"
+#include "fs/dcache.h"
 #include "debug.h"
+#define ISH_INTERNAL
+#include "fs/fake.h"
 
+// After the filesystem is compressed, transmitted, and uncompressed, hard
+// links have usually become separate files, and some files may not have made
+// it. The inode numbers in the database are fakefs's own, so they can stay as
+// they are, but every path has to be checked against the real filesystem:
+// metadata for files that are gone is deleted, and paths that share an inode
+// are linked back together.
+//
 // rebuild process in pseudocode:
 //
-// table = {}
-// for each path, inode:
-//     real_inode = stat(path).st_ino
-//     if inode in table:
-//         unlink(path)
-//         link(table[inode], path)
-//     else:
-//         table[inode] = path
-//     stat = db['stat ' + inode]
-//     new_db['inode ' + path] = real_inode
-//     new_db['stat ' + real_inode] = stat
-
-// ad hoc hashtable
-struct entry {
+// queue = [root]
+// while queue:
+//     dirs = take some from queue
+//     for each name, inode in dirs, in parallel:
+//         real = stat(path)
+//     for each name, inode in dirs:
+//         if real is missing:
+//             delete the dentry and everything under it
+//         elif real is a directory:
+//             queue.append(inode)
+//         elif first_path(inode) != path and stat(first_path(inode)) != real:
+//             unlink(path)
+//             link(first_path(inode), path)
+//     commit
+//
+// The queue is the rebuild_queue table, so an interrupted rebuild picks up
+// where it left off on the next mount, and doing a directory twice is
+// harmless. The mount lock is only held while the database is being read or
+// written, so with fakefs_rebuild_policy.lazy the filesystem can be used while
+// this runs on the mount's background thread, it just might have a few broken
+// hard links until it's done.
+
+struct fakefs_rebuild_policy fakefs_rebuild_policy = {
+    .lazy = false,
+    .threads = 4,
+};
+
+#define REBUILD_DIRS_PER_ROUND 64
+#define REBUILD_THREADS_MAX 16
+
+struct rebuild_item {
+    ino_t parent;
     ino_t inode;
+    char *name;
     char *path;
-    struct list chain;
+    // filled in by the workers
+    int err;
+    bool is_dir;
+    ino_t real_inode;
 };
 
-int fakefs_rebuild(struct mount *mount) {
-    int err;
-#define CHECK_ERR() \
-    if (err != SQLITE_OK && err != SQLITE_ROW && err != SQLITE_DONE) \
-        die("sqlite error while rebuilding: %s\n", sqlite3_errmsg(mount->db))
-#define EXEC(sql) \
-    err = sqlite3_exec(mount->db, sql, NULL, NULL, NULL); \
-    CHECK_ERR();
-#define PREPARE(sql) ({ \
-    sqlite3_stmt *stmt; \
-    sqlite3_prepare_v2(mount->db, sql, -1, &stmt, NULL); \
-    CHECK_ERR(); \
-    stmt; \
-})
-#define STEP(stmt) ({ \
-    err = sqlite3_step(stmt); \
-    CHECK_ERR(); \
-    err == SQLITE_ROW; \
-})
-#define RESET(stmt) \
-    err = sqlite3_reset(stmt); \
-    CHECK_ERR()
-#define FINALIZE(stmt) \
-    err = sqlite3_finalize(stmt); \
-    CHECK_ERR()
-
-    EXEC("begin");
-    EXEC("create table paths_old (path blob primary key, inode integer)");
-    EXEC("create table stats_old (inode integer primary key, stat blob)");
-    EXEC("insert into paths_old select * from paths");
-    EXEC("insert into stats_old select * from stats");
-    EXEC("delete from paths");
-    EXEC("delete from stats");
-    sqlite3_stmt *get_paths = PREPARE("select path, inode from paths_old");
-    sqlite3_stmt *read_stat = PREPARE("select stat from stats_old where inode = ?");
-    sqlite3_stmt *write_path = PREPARE("insert into paths (path, inode) values (?, ?)");
-    sqlite3_stmt *write_stat = PREPARE("replace into stats (inode, stat) values (?, ?)");
-
-    struct list hashtable[2000];
-#define HASH_SIZE (sizeof(hashtable)/sizeof(hashtable[0]))
-    for (unsigned i = 0; i < HASH_SIZE; i++)
-        list_init(&hashtable[i]);
-
-    while (sqlite3_step(get_paths) == SQLITE_ROW) {
-        const char *path = (const char *) sqlite3_column_text(get_paths, 0);
-        ino_t inode = sqlite3_column_int64(get_paths, 1);
-
-        // grab real inode
-        struct stat stat;
-        int err = fstatat(mount->root_fd, fix_path(path), &stat, 0);
-        if (err < 0)
-            continue;
-        ino_t real_inode = stat.st_ino;
-
-        // restore hardlinks
-        struct list *bucket = &hashtable[inode % HASH_SIZE];
-        struct entry *entry;
-        bool found = false;
-        list_for_each_entry(bucket, entry, chain) {
-            if (entry->inode == inode) {
-                unlinkat(mount->root_fd, fix_path(path), 0);
-                linkat(mount->root_fd, fix_path(entry->path), mount->root_fd, fix_path(path), 0);
-                found = true;
-                break;
-            }
+struct rebuild {
+    struct mount *mount;
+    sqlite3_stmt *next_dirs;
+    sqlite3_stmt *list_dir;
+    sqlite3_stmt *inode_parent;
+    sqlite3_stmt *dentry_lookup;
+    sqlite3_stmt *dentry_delete;
+    sqlite3_stmt *tree_delete;
+    sqlite3_stmt *enqueue;
+    sqlite3_stmt *dequeue;
+
+    struct rebuild_item *items;
+    size_t items_count;
+    size_t items_capacity;
+    size_t next_item;
+    lock_t lock;
+};
+
+static void rebuild_check(struct rebuild *r) {
+    int err = sqlite3_errcode(r->mount->db);
+    if (err != SQLITE_OK && err != SQLITE_ROW && err != SQLITE_DONE)
+        die("sqlite error while rebuilding: %s\n", sqlite3_errmsg(r->mount->db));
+}
+static sqlite3_stmt *rebuild_prepare(struct rebuild *r, const char *sql) {
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(r->mount->db, sql, -1, &stmt, NULL);
+    rebuild_check(r);
+    return stmt;
+}
+static bool rebuild_step(struct rebuild *r, sqlite3_stmt *stmt) {
+    bool row = sqlite3_step(stmt) == SQLITE_ROW;
+    rebuild_check(r);
+    return row;
+}
+static void rebuild_reset(struct rebuild *r, sqlite3_stmt *stmt) {
+    sqlite3_reset(stmt);
+    rebuild_check(r);
+}
+
+// Builds the path of an inode by following the first dentry for it up to the
+// root. If the inode isn't a directory, name and parent are set to its first
+// dentry.
+static bool rebuild_get_path(struct rebuild *r, ino_t inode, char *buf, ino_t *first_parent, char *first_name) {
+    char *start = buf + MAX_PATH;
+    *start = '\0';
+    bool first = true;
+    while (true) {
+        // select parent, name from dentries where inode = ? limit 1
+        sqlite3_bind_int64(r->inode_parent, 1, inode);
+        if (!rebuild_step(r, r->inode_parent)) {
+            rebuild_reset(r, r->inode_parent);
+            return false;
+        }
+        ino_t parent = sqlite3_column_int64(r->inode_parent, 0);
+        size_t name_len = sqlite3_column_bytes(r->inode_parent, 1);
+        if ((size_t) (start - buf) < name_len + 1 || name_len > NAME_MAX) {
+            rebuild_reset(r, r->inode_parent);
+            return false;
+        }
+        if (name_len > 0) {
+            start -= name_len;
+            memcpy(start, sqlite3_column_blob(r->inode_parent, 1), name_len);
         }
-        if (!found) {
-            entry = malloc(sizeof(struct entry));
-            entry->inode = inode;
-            entry->path = strdup(path);
-            list_add(bucket, &entry->chain);
+        if (first && first_parent != NULL) {
+            *first_parent = parent;
+            memcpy(first_name, start, name_len);
+            first_name[name_len] = '\0';
+        }
+        first = false;
+        rebuild_reset(r, r->inode_parent);
+        // the root is named "" with parent 0
+        if (parent == 0)
+            break;
+        *--start = '/';
+        inode = parent;
+    }
+    memmove(buf, start, strlen(start) + 1);
+    return true;
+}
+
+static void rebuild_add_item(struct rebuild *r, ino_t parent, const char *dir_path, const void *name, size_t name_len, ino_t inode) {
+    if (strlen(dir_path) + 1 + name_len > MAX_PATH)
+        return;
+    if (r->items_count == r->items_capacity) {
+        size_t capacity = r->items_capacity == 0 ? 256 : r->items_capacity * 2;
+        struct rebuild_item *items = realloc(r->items, capacity * sizeof(struct rebuild_item));
+        if (items == NULL)
+            return;
+        r->items = items;
+        r->items_capacity = capacity;
+    }
+    struct rebuild_item *item = &r->items[r->items_count];
+    item->name = malloc(name_len + 1);
+    item->path = malloc(strlen(dir_path) + 1 + name_len + 1);
+    if (item->name == NULL || item->path == NULL) {
+        free(item->name);
+        free(item->path);
+        return;
+    }
+    memcpy(item->name, name, name_len);
+    item->name[name_len] = '\0';
+    sprintf(item->path, "%s/%s", dir_path, item->name);
+    item->parent = parent;
+    item->inode = inode;
+    r->items_count++;
+}
+
+static void rebuild_free_items(struct rebuild *r) {
+    for (size_t i = 0; i < r->items_count; i++) {
+        free(r->items[i].name);
+        free(r->items[i].path);
+    }
+    r->items_count = 0;
+}
+
+static void *rebuild_worker(void *data) {
+    struct rebuild *r = data;
+    while (true) {
+        lock(&r->lock);
+        size_t i = r->next_item++;
+        unlock(&r->lock);
+        if (i >= r->items_count)
+            break;
+        struct rebuild_item *item = &r->items[i];
+        struct stat statbuf;
+        item->err = 0;
+        if (fstatat(r->mount->root_fd, fix_path(item->path), &statbuf, 0) < 0) {
+            item->err = errno;
+            continue;
         }
+        item->is_dir = S_ISDIR(statbuf.st_mode);
+        item->real_inode = statbuf.st_ino;
+    }
+    return NULL;
+}
+
+static void rebuild_stat_items(struct rebuild *r) {
+    r->next_item = 0;
+    unsigned threads = fakefs_rebuild_policy.threads;
+    if (threads > REBUILD_THREADS_MAX)
+        threads = REBUILD_THREADS_MAX;
+    // not worth it for a few files
+    if (r->items_count < 32)
+        threads = 0;
+    pthread_t workers[REBUILD_THREADS_MAX];
+    unsigned started = 0;
+    for (unsigned i = 0; i < threads; i++) {
+        if (pthread_create(&workers[started], NULL, rebuild_worker, r) == 0)
+            started++;
+    }
+    rebuild_worker(r);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+}
+
+static void rebuild_fix_item(struct rebuild *r, struct rebuild_item *item, bool *changed) {
+    struct mount *mount = r->mount;
+
+    // skip anything that's been changed since it was looked up
+    // select inode from dentries where parent = ? and name = ?
+    sqlite3_bind_int64(r->dentry_lookup, 1, item->parent);
+    sqlite3_bind_blob(r->dentry_lookup, 2, item->name, strlen(item->name), SQLITE_TRANSIENT);
+    bool same = rebuild_step(r, r->dentry_lookup) &&
+        (ino_t) sqlite3_column_int64(r->dentry_lookup, 0) == item->inode;
+    rebuild_reset(r, r->dentry_lookup);
+    if (!same)
+        return;
+
+    if (item->err == ENOENT || item->err == ENOTDIR) {
+        // check again, now that nothing else can be creating it
+        struct stat statbuf;
+        if (fstatat(mount->root_fd, fix_path(item->path), &statbuf, 0) == 0)
+            return;
+        // with recursive tree(inode) as (select ? union select dentries.inode
+        //  from dentries join tree on dentries.parent = tree.inode)
+        //  delete from dentries where parent in tree
+        sqlite3_bind_int64(r->tree_delete, 1, item->inode);
+        rebuild_step(r, r->tree_delete);
+        rebuild_reset(r, r->tree_delete);
+        // delete from dentries where parent = ? and name = ?
+        sqlite3_bind_int64(r->dentry_delete, 1, item->parent);
+        sqlite3_bind_blob(r->dentry_delete, 2, item->name, strlen(item->name), SQLITE_TRANSIENT);
+        rebuild_step(r, r->dentry_delete);
+        rebuild_reset(r, r->dentry_delete);
+        *changed = true;
+        return;
+    }
+    if (item->err != 0)
+        return;
+
+    if (item->is_dir) {
+        // insert or ignore into rebuild_queue (dir) values (?)
+        sqlite3_bind_int64(r->enqueue, 1, item->inode);
+        rebuild_step(r, r->enqueue);
+        rebuild_reset(r, r->enqueue);
+        mount->rebuild_dirs_queued += sqlite3_changes(mount->db);
+        return;
+    }
+
+    // restore hardlinks
+    char first_path[MAX_PATH + 1];
+    ino_t first_parent;
+    char first_name[NAME_MAX + 1];
+    if (!rebuild_get_path(r, item->inode, first_path, &first_parent, first_name))
+        return;
+    if (first_parent == item->parent && strcmp(first_name, item->name) == 0)
+        return;
+    struct stat statbuf;
+    if (fstatat(mount->root_fd, fix_path(first_path), &statbuf, 0) < 0)
+        return;
+    if (statbuf.st_ino == item->real_inode)
+        return;
+    unlinkat(mount->root_fd, fix_path(item->path), 0);
+    linkat(mount->root_fd, fix_path(first_path), mount->root_fd, fix_path(item->path), 0);
+}
+
+// Does one batch of directories, returns false when there's nothing left
+static bool rebuild_round(struct rebuild *r) {
+    struct mount *mount = r->mount;
+    ino_t dirs[REBUILD_DIRS_PER_ROUND];
+    int dirs_count = 0;
 
-        // extract the stat so we can copy it
-        err = sqlite3_bind_int64(read_stat, 1, inode); CHECK_ERR();
-        if (STEP(read_stat) == false) {
-            RESET(read_stat);
+    db_begin(mount);
+    if (mount->background_exit) {
+        db_commit(mount);
+        return false;
+    }
+    db_begin_now(mount);
+    // select dir from rebuild_queue limit ?
+    sqlite3_bind_int(r->next_dirs, 1, REBUILD_DIRS_PER_ROUND);
+    while (dirs_count < REBUILD_DIRS_PER_ROUND && rebuild_step(r, r->next_dirs))
+        dirs[dirs_count++] = sqlite3_column_int64(r->next_dirs, 0);
+    rebuild_reset(r, r->next_dirs);
+    if (dirs_count == 0) {
+        db_commit(mount);
+        return false;
+    }
+    for (int i = 0; i < dirs_count; i++) {
+        char dir_path[MAX_PATH + 1];
+        // it might have been deleted by now
+        if (!rebuild_get_path(r, dirs[i], dir_path, NULL, NULL))
             continue;
+        // select name, inode from dentries where parent = ?
+        sqlite3_bind_int64(r->list_dir, 1, dirs[i]);
+        while (rebuild_step(r, r->list_dir)) {
+            rebuild_add_item(r, dirs[i], dir_path,
+                    sqlite3_column_blob(r->list_dir, 0), sqlite3_column_bytes(r->list_dir, 0),
+                    sqlite3_column_int64(r->list_dir, 1));
         }
-        const void *stat_data = sqlite3_column_blob(read_stat, 0);
-        size_t stat_data_size = sqlite3_column_bytes(read_stat, 0);
-
-        // store all the information in the new database
-        err = sqlite3_bind_int64(write_stat, 1, real_inode); CHECK_ERR();
-        err = sqlite3_bind_blob(write_stat, 2, stat_data, stat_data_size, SQLITE_TRANSIENT);
-        STEP(write_stat);
-        RESET(write_stat);
-        err = sqlite3_bind_blob(write_path, 1, path, strlen(path), SQLITE_TRANSIENT); CHECK_ERR();
-        err = sqlite3_bind_int64(write_path, 2, real_inode); CHECK_ERR();
-        STEP(write_path);
-        RESET(write_path);
-
-        RESET(read_stat);
+        rebuild_reset(r, r->list_dir);
+    }
+    db_commit(mount);
+
+    rebuild_stat_items(r);
+
+    db_begin(mount);
+    db_begin_now(mount);
+    bool changed = false;
+    for (size_t i = 0; i < r->items_count; i++)
+        rebuild_fix_item(r, &r->items[i], &changed);
+    for (int i = 0; i < dirs_count; i++) {
+        // delete from rebuild_queue where dir = ?
+        sqlite3_bind_int64(r->dequeue, 1, dirs[i]);
+        rebuild_step(r, r->dequeue);
+        rebuild_reset(r, r->dequeue);
     }
+    mount->rebuild_dirs_done += dirs_count;
+    if (changed)
+        fakefs_metadata_changed(mount);
+    db_commit(mount);
+    if (changed)
+        dcache_invalidate_all();
+
+    rebuild_free_items(r);
+    return true;
+}
+
+void fakefs_rebuild(struct mount *mount) {
+    struct rebuild r = {.mount = mount};
+    lock_init(&r.lock);
+    lock(&mount->lock);
+    mount->rebuild_running = true;
+    r.next_dirs = rebuild_prepare(&r, "select dir from rebuild_queue limit ?");
+    r.list_dir = rebuild_prepare(&r, "select name, inode from dentries where parent = ?");
+    r.inode_parent = rebuild_prepare(&r, "select parent, name from dentries where inode = ? limit 1");
+    r.dentry_lookup = rebuild_prepare(&r, "select inode from dentries where parent = ? and name = ?");
+    r.dentry_delete = rebuild_prepare(&r, "delete from dentries where parent = ? and name = ?");
+    r.tree_delete = rebuild_prepare(&r, "with recursive tree(inode) as (select ? union "
+            "select dentries.inode from dentries join tree on dentries.parent = tree.inode) "
+            "delete from dentries where parent in tree");
+    r.enqueue = rebuild_prepare(&r, "insert or ignore into rebuild_queue (dir) values (?)");
+    r.dequeue = rebuild_prepare(&r, "delete from rebuild_queue where dir = ?");
+    unlock(&mount->lock);
 
-    for (unsigned i = 0; i < HASH_SIZE; i++) {
-        struct entry *entry, *tmp;
-        list_for_each_entry_safe(&hashtable[i], entry, tmp, chain) {
-            list_remove(&entry->chain);
-            free(entry->path);
-            free(entry);
+    uint64_t last_report = 0;
+    while (rebuild_round(&r)) {
+        if (mount->rebuild_dirs_done - last_report >= 1000) {
+            last_report = mount->rebuild_dirs_done;
+            printk("fakefs rebuild: %llu of %llu directories\n",
+                    (unsigned long long) mount->rebuild_dirs_done,
+                    (unsigned long long) mount->rebuild_dirs_queued);
         }
     }
 
-    EXEC("drop table paths_old");
-    EXEC("drop table stats_old");
-    EXEC("commit");
-    FINALIZE(get_paths);
-    FINALIZE(read_stat);
-    FINALIZE(write_path);
-    FINALIZE(write_stat);
+    lock(&mount->lock);
+    bool finished = !mount->background_exit;
+    sqlite3_finalize(r.next_dirs);
+    sqlite3_finalize(r.list_dir);
+    sqlite3_finalize(r.inode_parent);
+    sqlite3_finalize(r.dentry_lookup);
+    sqlite3_finalize(r.dentry_delete);
+    sqlite3_finalize(r.tree_delete);
+    sqlite3_finalize(r.enqueue);
+    sqlite3_finalize(r.dequeue);
+    unlock(&mount->lock);
+    free(r.items);
+
+    if (finished) {
+        // deleted dentries leave stats behind, which the orphan sweep that
+        // runs after this picks up
+        db_begin(mount);
+        db_begin_now(mount);
+        sqlite3_exec(mount->db, "drop table rebuild_queue; "
+                "update meta set orphans = orphans + 1",
+                NULL, NULL, NULL);
+        rebuild_check(&r);
+        db_commit(mount);
+        printk("fakefs rebuild: done, %llu directories\n", (unsigned long long) mount->rebuild_dirs_done);
+    }
+    lock(&mount->lock);
+    mount->rebuild_running = false;
+    unlock(&mount->lock);
+}
+
+int fakefs_rebuild_start(struct mount *mount) {
+    int err = sqlite3_exec(mount->db,
+            "begin; "
+            "create table if not exists rebuild_queue (dir integer primary key); "
+            "delete from rebuild_queue; "
+            "insert into rebuild_queue select inode from dentries where parent = 0 and name = x''; "
+            "commit;", NULL, NULL, NULL);
+    if (err != SQLITE_OK)
+        die("sqlite error while rebuilding: %s\n", sqlite3_errmsg(mount->db));
     return 0;
 }
+
+bool fakefs_rebuild_pending(struct mount *mount) {
+    mount->rebuild_running = false;
+    mount->rebuild_dirs_done = 0;
+    mount->rebuild_dirs_queued = 0;
+
+    sqlite3_stmt *stmt;
+    sqlite3_prepare_v2(mount->db, "select count(*) from rebuild_queue", -1, &stmt, NULL);
+    // no table means there's nothing to do
+    if (stmt == NULL)
+        return false;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        mount->rebuild_dirs_queued = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return true;
+}
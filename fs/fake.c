@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <time.h>
 #include <sqlite3.h>
 
 #include "debug.h"
@@ -12,13 +13,13 @@
 #include "fs/fd.h"
 #include "fs/dev.h"
 #include "fs/inode.h"
+#include "fs/dcache.h"
+#include "util/timer.h"
 #define ISH_INTERNAL
 #include "fs/fake.h"
 
-// TODO document database
-
-static void db_check_error(struct mount *mount) {
-    int errcode = sqlite3_errcode(mount->db);
+static void sql_check_error(sqlite3 *db) {
+    int errcode = sqlite3_errcode(db);
     switch (errcode) {
         case SQLITE_OK:
         case SQLITE_ROW:
@@ -26,18 +27,25 @@ static void db_check_error(struct mount *mount) {
             break;
 
         default:
-            die("sqlite error: %s", sqlite3_errmsg(mount->db));
+            die("sqlite error: %s", sqlite3_errmsg(db));
     }
 }
+static void db_check_error(struct mount *mount) {
+    sql_check_error(mount->db);
+}
 
-static sqlite3_stmt *db_prepare(struct mount *mount, const char *stmt) {
+static sqlite3_stmt *sql_prepare(sqlite3 *db, const char *stmt) {
     sqlite3_stmt *statement;
-    sqlite3_prepare_v2(mount->db, stmt, strlen(stmt) + 1, &statement, NULL);
-    db_check_error(mount);
+    sqlite3_prepare_v2(db, stmt, strlen(stmt) + 1, &statement, NULL);
+    sql_check_error(db);
     return statement;
 }
+static sqlite3_stmt *db_prepare(struct mount *mount, const char *stmt) {
+    return sql_prepare(mount->db, stmt);
+}
 
 static bool db_exec(struct mount *mount, sqlite3_stmt *stmt) {
+    db_begin_now(mount);
     int err = sqlite3_step(stmt);
     db_check_error(mount);
     return err == SQLITE_ROW;
@@ -51,125 +59,749 @@ static void db_exec_reset(struct mount *mount, sqlite3_stmt *stmt) {
     db_reset(mount, stmt);
 }
 
+// The metadata cache is only right as long as nobody else is writing to the
+// database, but the file provider extension has its own connection. Once a
+// second, check whether anything's been committed from elsewhere, and if so
+// forget everything, including what path resolution remembers about symlinks.
+static void db_check_data_version(struct mount *mount) {
+    time_t now = time(NULL);
+    if (now == mount->data_version_checked)
+        return;
+    mount->data_version_checked = now;
+    // not db_exec, since that would start a transaction
+    sqlite3_step(mount->stmt.data_version);
+    db_check_error(mount);
+    int data_version = sqlite3_column_int(mount->stmt.data_version, 0);
+    db_reset(mount, mount->stmt.data_version);
+    if (data_version != mount->data_version) {
+        mount->data_version = data_version;
+        fake_cache_clear(mount->cache);
+        mount->cache_generation++;
+        dcache_invalidate_all();
+    }
+}
+
+// Runs a statement that doesn't return anything, without starting a
+// transaction
+static void db_run(struct mount *mount, sqlite3_stmt *stmt) {
+    sqlite3_step(stmt);
+    db_check_error(mount);
+    db_reset(mount, stmt);
+}
+
+// Committing metadata changes
+//
+// Normally each operation gets its own transaction, which commits before the
+// operation returns, so a metadata change that's been reported as done
+// survives a crash.
+//
+// With fakefs_commit_policy.batch set, operations instead run inside
+// savepoints in one long transaction, which is committed once it holds
+// max_ops operations or is max_delay_ms old, on fsync, sync and syncfs, and
+// on unmount. Reads on this mount see the uncommitted changes, since they go
+// through the same connection. After a crash everything since the last
+// commit is lost: the real files may exist without their metadata (and so
+// are invisible), or metadata may point at files that have been deleted
+// (which is ignored by readdir and fixed up by the next mount's orphan
+// cleanup). Nothing is ever half applied, since each batch is one sqlite
+// transaction.
+
+struct fakefs_commit_policy fakefs_commit_policy = {
+    .batch = false,
+    .max_ops = 1000,
+    .max_delay_ms = 1000,
+};
+
+// needs the mount lock, and no operation in progress
+static void db_batch_commit(struct mount *mount) {
+    if (!mount->batch_open)
+        return;
+    db_run(mount, mount->stmt.commit);
+    mount->batch_open = false;
+    mount->batch_ops = 0;
+}
+
+// The transaction isn't actually started until the first statement runs, so
+// an operation that's answered by the cache never touches sqlite.
+void db_begin_now(struct mount *mount) {
+    if (mount->db_begun)
+        return;
+    mount->db_begun = true;
+    if (!mount->batch) {
+        db_run(mount, mount->stmt.begin);
+        return;
+    }
+    if (!mount->batch_open) {
+        db_run(mount, mount->stmt.begin);
+        mount->batch_open = true;
+        mount->batch_start = timespec_now();
+        mount->batch_changes = sqlite3_total_changes(mount->db);
+        notify(&mount->batch_cond);
+    }
+    db_run(mount, mount->stmt.savepoint);
+}
+
 void db_begin(struct mount *mount) {
     lock(&mount->lock);
-    db_exec_reset(mount, mount->stmt.begin);
+    mount->db_begun = false;
+    db_check_data_version(mount);
 }
 void db_commit(struct mount *mount) {
-    db_exec_reset(mount, mount->stmt.commit);
+    // readers that started before this can't trust what they found
+    if (mount->db_begun)
+        mount->cache_generation++;
+    if (mount->db_begun && !mount->batch) {
+        db_run(mount, mount->stmt.commit);
+    } else if (mount->db_begun) {
+        db_run(mount, mount->stmt.release);
+        mount->batch_ops++;
+        struct timespec age = timespec_subtract(timespec_now(), mount->batch_start);
+        // if nothing's been written this is only holding a read lock, and
+        // may as well end now
+        if (sqlite3_total_changes(mount->db) == mount->batch_changes ||
+                mount->batch_ops >= fakefs_commit_policy.max_ops ||
+                age.tv_sec * 1000 + age.tv_nsec / 1000000 >= fakefs_commit_policy.max_delay_ms)
+            db_batch_commit(mount);
+    }
+    mount->db_begun = false;
     unlock(&mount->lock);
 }
 void db_rollback(struct mount *mount) {
-    db_exec_reset(mount, mount->stmt.rollback);
+    if (mount->db_begun && !mount->batch) {
+        db_run(mount, mount->stmt.rollback);
+    } else if (mount->db_begun) {
+        db_run(mount, mount->stmt.rollback_savepoint);
+        db_run(mount, mount->stmt.release);
+    }
+    mount->db_begun = false;
+    // the cache is updated as changes are made, so it's now ahead of the database
+    fakefs_metadata_changed(mount);
     unlock(&mount->lock);
 }
 
+void fakefs_metadata_changed(struct mount *mount) {
+    fake_cache_clear(mount->cache);
+    mount->cache_generation++;
+}
+
+// Commits a batch that's been sitting around for too long
+static void *fakefs_batch_thread(void *data) {
+    struct mount *mount = data;
+    lock(&mount->lock);
+    while (!mount->batch_exit) {
+        if (!mount->batch_open) {
+            wait_for_ignore_signals(&mount->batch_cond, &mount->lock, NULL);
+            continue;
+        }
+        struct timespec delay = {
+            fakefs_commit_policy.max_delay_ms / 1000,
+            (fakefs_commit_policy.max_delay_ms % 1000) * 1000000,
+        };
+        struct timespec remaining = timespec_subtract(
+                timespec_add(mount->batch_start, delay), timespec_now());
+        if (!timespec_positive(remaining)) {
+            db_batch_commit(mount);
+            continue;
+        }
+        wait_for_ignore_signals(&mount->batch_cond, &mount->lock, &remaining);
+    }
+    db_batch_commit(mount);
+    unlock(&mount->lock);
+    return NULL;
+}
+
+static int fakefs_sync(struct mount *mount) {
+    lock(&mount->lock);
+    db_batch_commit(mount);
+    unlock(&mount->lock);
+    return 0;
+}
+
 static void bind_path(sqlite3_stmt *stmt, int i, const char *path) {
     sqlite3_bind_blob(stmt, i, path, strlen(path), SQLITE_TRANSIENT);
 }
 
-static void try_cleanup_inode(struct mount *mount, ino_t inode) {
+// The database
+//
+// stats maps an inode number to its ish_stat. dentries is the directory
+// tree: each row is a name in a directory, identified by the directory's
+// inode, pointing at an inode. The root directory is named "" and has parent
+// 0, so splitting any path on / gives the components to look up in order,
+// starting from parent 0. Renaming or removing something only touches its
+// own row, and dentries is indexed on inode so inode_is_orphaned style checks
+// don't scan the table.
+
+#define SQL_DENTRY_LOOKUP "select inode from dentries where parent = ? and name = ?"
+#define SQL_INODE_READ_STAT "select stat from stats where inode = ?"
+#define SQL_INODE_PARENT "select parent, name from dentries where inode = ? limit 1"
+#define SQL_DIR_LIST "select name, dentries.inode, stat from dentries left join stats using (inode) where parent = ?"
+
+// The lookups themselves, shared by the writer connection and the readers
+static ino_t sql_dentry_lookup(sqlite3 *db, sqlite3_stmt *stmt, ino_t parent, const char *name, size_t name_len) {
+    // select inode from dentries where parent = ? and name = ?
+    sqlite3_bind_int64(stmt, 1, parent);
+    sqlite3_bind_blob(stmt, 2, name, name_len, SQLITE_TRANSIENT);
+    ino_t inode = 0;
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+        inode = sqlite3_column_int64(stmt, 0);
+    sql_check_error(db);
+    sqlite3_reset(stmt);
+    sql_check_error(db);
+    return inode;
+}
+static ino_t sql_path_get_inode(sqlite3 *db, sqlite3_stmt *stmt, const char *path) {
+    ino_t inode = 0;
+    const char *component = path;
+    for (;;) {
+        const char *end = strchr(component, '/');
+        size_t component_len = end != NULL ? (size_t) (end - component) : strlen(component);
+        inode = sql_dentry_lookup(db, stmt, inode, component, component_len);
+        if (inode == 0 || end == NULL)
+            return inode;
+        component = end + 1;
+    }
+}
+static bool sql_inode_read_stat(sqlite3 *db, sqlite3_stmt *stmt, ino_t inode, struct ish_stat *stat) {
+    // select stat from stats where inode = ?
+    sqlite3_bind_int64(stmt, 1, inode);
+    bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+    sql_check_error(db);
+    if (exists)
+        *stat = *(struct ish_stat *) sqlite3_column_blob(stmt, 0);
+    sqlite3_reset(stmt);
+    sql_check_error(db);
+    return exists;
+}
+static bool sql_path_read_stat(sqlite3 *db, sqlite3_stmt *lookup, sqlite3_stmt *read_stat, const char *path, struct ish_stat *stat, ino_t *inode) {
+    *inode = sql_path_get_inode(db, lookup, path);
+    if (*inode == 0)
+        return false;
+    return sql_inode_read_stat(db, read_stat, *inode, stat);
+}
+
+struct fakefs_dir_entry {
+    ino_t inode;
+    mode_t_ type;
+    char *name;
+};
+struct fakefs_dir {
+    ino_t parent;
+    size_t count;
+    struct fakefs_dir_entry *entries; // sorted by name
+};
+
+static void fakefs_dir_free(struct fakefs_dir *dir) {
+    for (size_t i = 0; i < dir->count; i++)
+        free(dir->entries[i].name);
+    free(dir->entries);
+    free(dir);
+}
+
+static int dir_entry_compare(const void *a, const void *b) {
+    return strcmp(((const struct fakefs_dir_entry *) a)->name, ((const struct fakefs_dir_entry *) b)->name);
+}
+
+static struct fakefs_dir_entry *fakefs_dir_find(struct fakefs_dir *dir, const char *name) {
+    struct fakefs_dir_entry key = {.name = (char *) name};
+    return bsearch(&key, dir->entries, dir->count, sizeof(key), dir_entry_compare);
+}
+
+static struct fakefs_dir *sql_dir_list(sqlite3 *db, sqlite3_stmt *list, sqlite3_stmt *parent, ino_t inode) {
+    struct fakefs_dir *dir = malloc(sizeof(struct fakefs_dir));
+    if (dir == NULL)
+        return NULL;
+    dir->count = 0;
+    dir->entries = NULL;
+    size_t capacity = 0;
+
+    // select name, dentries.inode, stat from dentries left join stats using (inode) where parent = ?
+    sqlite3_bind_int64(list, 1, inode);
+    while (sqlite3_step(list) == SQLITE_ROW) {
+        if (dir->count == capacity) {
+            capacity = capacity == 0 ? 16 : capacity * 2;
+            struct fakefs_dir_entry *entries = realloc(dir->entries, capacity * sizeof(struct fakefs_dir_entry));
+            if (entries == NULL)
+                goto nomem;
+            dir->entries = entries;
+        }
+        size_t name_len = sqlite3_column_bytes(list, 0);
+        char *name = malloc(name_len + 1);
+        if (name == NULL)
+            goto nomem;
+        if (name_len > 0)
+            memcpy(name, sqlite3_column_blob(list, 0), name_len);
+        name[name_len] = '\0';
+        dir->entries[dir->count].name = name;
+        dir->entries[dir->count].inode = sqlite3_column_int64(list, 1);
+        dir->entries[dir->count].type = 0;
+        if (sqlite3_column_bytes(list, 2) == sizeof(struct ish_stat))
+            dir->entries[dir->count].type = ((struct ish_stat *) sqlite3_column_blob(list, 2))->mode & S_IFMT;
+        dir->count++;
+    }
+    sql_check_error(db);
+    sqlite3_reset(list);
+    qsort(dir->entries, dir->count, sizeof(struct fakefs_dir_entry), dir_entry_compare);
+
+    // the root is its own parent
+    dir->parent = inode;
+    // select parent, name from dentries where inode = ? limit 1
+    sqlite3_bind_int64(parent, 1, inode);
+    if (sqlite3_step(parent) == SQLITE_ROW && sqlite3_column_int64(parent, 0) != 0)
+        dir->parent = sqlite3_column_int64(parent, 0);
+    sql_check_error(db);
+    sqlite3_reset(parent);
+    return dir;
+
+nomem:
+    sqlite3_reset(list);
+    fakefs_dir_free(dir);
+    return NULL;
+}
+
+// returns whether the stats were deleted
+static bool try_cleanup_inode(struct mount *mount, ino_t inode) {
     sqlite3_bind_int64(mount->stmt.try_cleanup_inode, 1, inode);
     db_exec_reset(mount, mount->stmt.try_cleanup_inode);
+    if (sqlite3_changes(mount->db) == 0)
+        return false;
+    fake_cache_drop_stat(mount->cache, inode);
+    return true;
+}
+
+// Orphans
+//
+// An inode that loses its last path while it's still open keeps its stats
+// until it's closed. If iSH is killed before then, the stats are left behind.
+// meta.orphans counts the inodes waiting for this, so when it's zero nothing
+// can have been left behind and there's no need to look. Otherwise the mount
+// sweeps for leftovers in the background (see fakefs_sweep_orphans).
+
+static void orphans_add(struct mount *mount, int delta) {
+    // update meta set orphans = max(orphans + ?, 0)
+    sqlite3_bind_int(mount->stmt.orphans_add, 1, delta);
+    db_exec_reset(mount, mount->stmt.orphans_add);
+}
+
+static void inode_unlinked(struct mount *mount, ino_t inode) {
+    if (inode_is_orphaned(mount, inode)) {
+        try_cleanup_inode(mount, inode);
+        return;
+    }
+    // select parent, name from dentries where inode = ?
+    sqlite3_bind_int64(mount->stmt.path_from_inode, 1, inode);
+    bool linked = db_exec(mount, mount->stmt.path_from_inode);
+    db_reset(mount, mount->stmt.path_from_inode);
+    if (!linked)
+        orphans_add(mount, 1);
 }
 
 ino_t path_get_inode(struct mount *mount, const char *path) {
-    // select inode from paths where path = ?
-    bind_path(mount->stmt.path_get_inode, 1, path);
     ino_t inode = 0;
-    if (db_exec(mount, mount->stmt.path_get_inode))
-        inode = sqlite3_column_int64(mount->stmt.path_get_inode, 0);
-    db_reset(mount, mount->stmt.path_get_inode);
+    if (fake_cache_get_path(mount->cache, path, &inode))
+        return inode;
+
+    // start from the closest directory that's cached, and cache each
+    // directory on the way down, since they're likely to be looked up again
+    size_t path_len = strlen(path);
+    char buf[path_len + 1];
+    memcpy(buf, path, path_len + 1);
+    char *component = buf;
+    char *slash = strrchr(buf, '/');
+    while (slash != NULL) {
+        *slash = '\0';
+        bool found = fake_cache_get_path(mount->cache, buf, &inode);
+        char *prev_slash = strrchr(buf, '/');
+        *slash = '/';
+        if (found) {
+            component = slash + 1;
+            break;
+        }
+        slash = prev_slash;
+    }
+
+    db_begin_now(mount);
+    for (;;) {
+        char *end = strchr(component, '/');
+        size_t component_len = end != NULL ? (size_t) (end - component) : strlen(component);
+        inode = sql_dentry_lookup(mount->db, mount->stmt.dentry_lookup, inode, component, component_len);
+        if (inode == 0)
+            return 0;
+        if (end == NULL)
+            break;
+        *end = '\0';
+        fake_cache_put_path(mount->cache, buf, inode);
+        *end = '/';
+        component = end + 1;
+    }
+    fake_cache_put_path(mount->cache, path, inode);
     return inode;
 }
 bool path_read_stat(struct mount *mount, const char *path, struct ish_stat *stat, ino_t *inode) {
-    // select inode, stat from stats natural join paths where path = ?
-    bind_path(mount->stmt.path_read_stat, 1, path);
-    bool exists = db_exec(mount, mount->stmt.path_read_stat);
-    if (exists) {
-        if (inode)
-            *inode = sqlite3_column_int64(mount->stmt.path_read_stat, 0);
-        if (stat)
-            *stat = *(struct ish_stat *) sqlite3_column_blob(mount->stmt.path_read_stat, 1);
-    }
-    db_reset(mount, mount->stmt.path_read_stat);
-    return exists;
+    ino_t found_inode = path_get_inode(mount, path);
+    if (found_inode == 0)
+        return false;
+    struct ish_stat found_stat;
+    if (!fake_cache_get_stat(mount->cache, found_inode, &found_stat)) {
+        db_begin_now(mount);
+        if (!sql_inode_read_stat(mount->db, mount->stmt.inode_read_stat, found_inode, &found_stat))
+            return false;
+        fake_cache_put_stat(mount->cache, found_inode, &found_stat);
+    }
+    if (inode)
+        *inode = found_inode;
+    if (stat)
+        *stat = found_stat;
+    return true;
+}
+
+// Returns the inode of the directory containing path, and points name at the
+// last component. Returns 0 for the root or if the directory doesn't exist.
+static ino_t path_get_parent(struct mount *mount, const char *path, const char **name) {
+    const char *slash = strrchr(path, '/');
+    if (slash == NULL)
+        return 0;
+    size_t dir_len = slash - path;
+    char dir[dir_len + 1];
+    memcpy(dir, path, dir_len);
+    dir[dir_len] = '\0';
+    *name = slash + 1;
+    return path_get_inode(mount, dir);
 }
+
+static void dentry_link(struct mount *mount, ino_t parent, const char *name, ino_t inode) {
+    // insert or replace into dentries (parent, name, inode) values (?, ?, ?)
+    sqlite3_bind_int64(mount->stmt.dentry_link, 1, parent);
+    bind_path(mount->stmt.dentry_link, 2, name);
+    sqlite3_bind_int64(mount->stmt.dentry_link, 3, inode);
+    db_exec_reset(mount, mount->stmt.dentry_link);
+}
+
 void path_create(struct mount *mount, const char *path, struct ish_stat *stat) {
+    const char *name;
+    ino_t parent = path_get_parent(mount, path, &name);
+    if (parent == 0)
+        return;
     // insert into stats (stat) values (?)
     sqlite3_bind_blob(mount->stmt.path_create_stat, 1, stat, sizeof(*stat), SQLITE_TRANSIENT);
     db_exec_reset(mount, mount->stmt.path_create_stat);
-    // insert or replace into paths values (?, last_insert_rowid())
-    bind_path(mount->stmt.path_create_path, 1, path);
-    db_exec_reset(mount, mount->stmt.path_create_path);
+    ino_t inode = sqlite3_last_insert_rowid(mount->db);
+    dentry_link(mount, parent, name, inode);
+    fake_cache_put_path(mount->cache, path, inode);
+    fake_cache_put_stat(mount->cache, inode, stat);
 }
 
 static void inode_read_stat(struct mount *mount, ino_t inode, struct ish_stat *stat) {
-    // select stat from stats where inode = ?
-    sqlite3_bind_int64(mount->stmt.inode_read_stat, 1, inode);
-    if (!db_exec(mount, mount->stmt.inode_read_stat))
+    if (fake_cache_get_stat(mount->cache, inode, stat))
+        return;
+    db_begin_now(mount);
+    if (!sql_inode_read_stat(mount->db, mount->stmt.inode_read_stat, inode, stat))
         die("inode_read_stat(%llu): missing inode", (unsigned long long) inode);
-    *stat = *(struct ish_stat *) sqlite3_column_blob(mount->stmt.inode_read_stat, 0);
-    db_reset(mount, mount->stmt.inode_read_stat);
+    fake_cache_put_stat(mount->cache, inode, stat);
 }
 static void inode_write_stat(struct mount *mount, ino_t inode, struct ish_stat *stat) {
     // update stats set stat = ? where inode = ?
     sqlite3_bind_blob(mount->stmt.inode_write_stat, 1, stat, sizeof(*stat), SQLITE_TRANSIENT);
     sqlite3_bind_int64(mount->stmt.inode_write_stat, 2, inode);
     db_exec_reset(mount, mount->stmt.inode_write_stat);
+    fake_cache_put_stat(mount->cache, inode, stat);
 }
 
 static void path_link(struct mount *mount, const char *src, const char *dst) {
     ino_t inode = path_get_inode(mount, src);
     if (inode == 0)
         die("fakefs link(%s, %s): nonexistent src path", src, dst);
-    // insert or replace into paths (path, inode) values (?, ?)
-    bind_path(mount->stmt.path_link, 1, dst);
-    sqlite3_bind_int64(mount->stmt.path_link, 2, inode);
-    db_exec_reset(mount, mount->stmt.path_link);
+    const char *name;
+    ino_t parent = path_get_parent(mount, dst, &name);
+    if (parent == 0)
+        return;
+    dentry_link(mount, parent, name, inode);
+    fake_cache_put_path(mount->cache, dst, inode);
 }
 static void path_unlink(struct mount *mount, const char *path) {
     ino_t inode = path_get_inode(mount, path);
     if (inode == 0)
         die("path_unlink(%s): nonexistent path", path);
-    // delete from paths where path = ?
-    bind_path(mount->stmt.path_unlink, 1, path);
-    db_exec_reset(mount, mount->stmt.path_unlink);
-    if (inode_is_orphaned(mount, inode))
-        try_cleanup_inode(mount, inode);
+    const char *name;
+    ino_t parent = path_get_parent(mount, path, &name);
+    // delete from dentries where parent = ? and name = ?
+    sqlite3_bind_int64(mount->stmt.dentry_unlink, 1, parent);
+    bind_path(mount->stmt.dentry_unlink, 2, name);
+    db_exec_reset(mount, mount->stmt.dentry_unlink);
+    fake_cache_drop_path(mount->cache, path);
+    // a removed directory should be empty, but there may be leftover
+    // metadata for files that went missing
+    // delete from dentries where parent = ?
+    sqlite3_bind_int64(mount->stmt.dentry_unlink_children, 1, inode);
+    db_exec_reset(mount, mount->stmt.dentry_unlink_children);
+    if (sqlite3_changes(mount->db) > 0)
+        fake_cache_drop_subtree(mount->cache, path);
+    inode_unlinked(mount, inode);
 }
 static void path_rename(struct mount *mount, const char *src, const char *dst) {
-    // update or replace paths set path = change_prefix(path, ? [len(src)], ? [dst])
-    //  where (path >= ? [src plus /] and path < [src plus 0]) or path = ? [src]
-    // arguments:
-    // 1. length of src
-    // 2. dst
-    // 3. src plus /
-    // 4. src plus 0
-    // 5. src
-    size_t src_len = strlen(src);
-    sqlite3_bind_int64(mount->stmt.path_rename, 1, src_len);
-    bind_path(mount->stmt.path_rename, 2, dst);
-    char src_extra[src_len + 1];
-    memcpy(src_extra, src, src_len);
-    src_extra[src_len] = '/';
-    sqlite3_bind_blob(mount->stmt.path_rename, 3, src_extra, src_len + 1, SQLITE_TRANSIENT);
-    src_extra[src_len] = '0';
-    sqlite3_bind_blob(mount->stmt.path_rename, 4, src_extra, src_len + 1, SQLITE_TRANSIENT);
-    sqlite3_bind_blob(mount->stmt.path_rename, 5, src_extra, src_len, SQLITE_TRANSIENT);
-    db_exec_reset(mount, mount->stmt.path_rename);
-}
-
-// this exists only to override readdir to fix the returned inode numbers
+    ino_t inode = path_get_inode(mount, src);
+    ino_t replaced = path_get_inode(mount, dst);
+    // renaming a file over another link to itself does nothing
+    if (inode == 0 || inode == replaced)
+        return;
+    const char *src_name, *dst_name;
+    ino_t src_parent = path_get_parent(mount, src, &src_name);
+    ino_t dst_parent = path_get_parent(mount, dst, &dst_name);
+    if (src_parent != 0 && dst_parent != 0) {
+        // update or replace dentries set parent = ?, name = ? where parent = ? and name = ?
+        sqlite3_bind_int64(mount->stmt.dentry_rename, 1, dst_parent);
+        bind_path(mount->stmt.dentry_rename, 2, dst_name);
+        sqlite3_bind_int64(mount->stmt.dentry_rename, 3, src_parent);
+        bind_path(mount->stmt.dentry_rename, 4, src_name);
+        db_exec_reset(mount, mount->stmt.dentry_rename);
+    }
+    fake_cache_drop_subtree(mount->cache, src);
+    fake_cache_drop_subtree(mount->cache, dst);
+    if (replaced != 0)
+        inode_unlinked(mount, replaced);
+}
+
+// Builds the path of a dentry into buf, which is MAX_PATH + 1 bytes. Returns
+// false if the tree is broken somewhere above it.
+static bool dentry_get_path(struct mount *mount, ino_t parent, const char *name, size_t name_len, char *buf) {
+    // built backwards from the end of the buffer, stopping at the root, whose
+    // name is ""
+    char *start = buf + MAX_PATH;
+    *start = '\0';
+    char name_buf[MAX_PATH];
+    sqlite3_stmt *stmt = mount->stmt.inode_parent;
+    while (parent != 0) {
+        if ((size_t) (start - buf) < name_len + 1)
+            return false;
+        start -= name_len;
+        memcpy(start, name, name_len);
+        *--start = '/';
+        // select parent, name from dentries where inode = ? limit 1
+        sqlite3_bind_int64(stmt, 1, parent);
+        if (!db_exec(mount, stmt)) {
+            db_reset(mount, stmt);
+            return false;
+        }
+        parent = sqlite3_column_int64(stmt, 0);
+        name_len = sqlite3_column_bytes(stmt, 1);
+        if (name_len > sizeof(name_buf)) {
+            db_reset(mount, stmt);
+            return false;
+        }
+        memcpy(name_buf, sqlite3_column_blob(stmt, 1), name_len);
+        name = name_buf;
+        db_reset(mount, stmt);
+    }
+    memmove(buf, start, strlen(start) + 1);
+    return true;
+}
+
+// Readers
+//
+// Operations that only read metadata don't need to wait for the mount lock
+// while sqlite runs. They go to the cache first, and on a miss borrow one of
+// a few read only connections, which in WAL mode can all read at once while
+// the writer connection is busy. Anything found is added to the cache, unless
+// something was committed while the reader was looking, since then it might
+// be out of date. While a batch is open (see above) its changes can only be
+// seen through the writer connection, so lookups go there instead.
+
+#define FAKEFS_READERS_MAX 4
+
+struct fakefs_reader {
+    sqlite3 *db;
+    sqlite3_stmt *begin;
+    sqlite3_stmt *commit;
+    sqlite3_stmt *dentry_lookup;
+    sqlite3_stmt *inode_read_stat;
+    sqlite3_stmt *inode_parent;
+    sqlite3_stmt *dir_list;
+    struct list idle;
+};
+
+static void fakefs_db_path(struct mount *mount, char *db_path) {
+    strcpy(db_path, mount->source);
+    char *basename = strrchr(db_path, '/') + 1;
+    assert(strcmp(basename, "data") == 0);
+    strcpy(basename, "meta.db");
+}
+
+static struct fakefs_reader *reader_open(struct mount *mount) {
+    struct fakefs_reader *reader = malloc(sizeof(struct fakefs_reader));
+    if (reader == NULL)
+        return NULL;
+    char db_path[PATH_MAX];
+    fakefs_db_path(mount, db_path);
+    if (sqlite3_open_v2(db_path, &reader->db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK) {
+        printk("error opening database reader: %s\n", sqlite3_errmsg(reader->db));
+        sqlite3_close(reader->db);
+        free(reader);
+        return NULL;
+    }
+    sqlite3_busy_timeout(reader->db, 1000);
+    reader->begin = sql_prepare(reader->db, "begin");
+    reader->commit = sql_prepare(reader->db, "commit");
+    reader->dentry_lookup = sql_prepare(reader->db, SQL_DENTRY_LOOKUP);
+    reader->inode_read_stat = sql_prepare(reader->db, SQL_INODE_READ_STAT);
+    reader->inode_parent = sql_prepare(reader->db, SQL_INODE_PARENT);
+    reader->dir_list = sql_prepare(reader->db, SQL_DIR_LIST);
+    return reader;
+}
+
+static void reader_close(struct fakefs_reader *reader) {
+    sqlite3_finalize(reader->begin);
+    sqlite3_finalize(reader->commit);
+    sqlite3_finalize(reader->dentry_lookup);
+    sqlite3_finalize(reader->inode_read_stat);
+    sqlite3_finalize(reader->inode_parent);
+    sqlite3_finalize(reader->dir_list);
+    sqlite3_close(reader->db);
+    free(reader);
+}
+
+// needs the mount lock, returns NULL if they're all busy
+static struct fakefs_reader *reader_get(struct mount *mount) {
+    if (!list_empty(&mount->readers)) {
+        struct fakefs_reader *reader = list_first_entry(&mount->readers, struct fakefs_reader, idle);
+        list_remove(&reader->idle);
+        return reader;
+    }
+    if (mount->readers_count >= FAKEFS_READERS_MAX)
+        return NULL;
+    struct fakefs_reader *reader = reader_open(mount);
+    if (reader != NULL)
+        mount->readers_count++;
+    return reader;
+}
+
+static void reader_put(struct mount *mount, struct fakefs_reader *reader) {
+    list_add(&mount->readers, &reader->idle);
+}
+
+struct meta_query {
+    const char *path; // if NULL, look up inode instead
+    ino_t inode;
+    bool want_stat;
+    struct ish_stat stat;
+};
+
+static bool meta_query_cached(struct mount *mount, struct meta_query *q) {
+    if (q->path != NULL && !fake_cache_get_path(mount->cache, q->path, &q->inode))
+        return false;
+    if (q->want_stat && !fake_cache_get_stat(mount->cache, q->inode, &q->stat))
+        return false;
+    return true;
+}
+
+static void reader_begin(struct fakefs_reader *reader) {
+    sqlite3_step(reader->begin);
+    sql_check_error(reader->db);
+    sqlite3_reset(reader->begin);
+}
+static void reader_end(struct fakefs_reader *reader) {
+    sqlite3_step(reader->commit);
+    sql_check_error(reader->db);
+    sqlite3_reset(reader->commit);
+}
+
+static bool meta_query_reader(struct fakefs_reader *reader, struct meta_query *q) {
+    reader_begin(reader);
+    bool found;
+    if (q->path != NULL && q->want_stat) {
+        found = sql_path_read_stat(reader->db, reader->dentry_lookup, reader->inode_read_stat, q->path, &q->stat, &q->inode);
+    } else if (q->path != NULL) {
+        q->inode = sql_path_get_inode(reader->db, reader->dentry_lookup, q->path);
+        found = q->inode != 0;
+    } else {
+        found = sql_inode_read_stat(reader->db, reader->inode_read_stat, q->inode, &q->stat);
+    }
+    reader_end(reader);
+    return found;
+}
+
+// Returns whether the path or inode exists
+static bool meta_query(struct mount *mount, struct meta_query *q) {
+    lock(&mount->lock);
+    db_check_data_version(mount);
+    if (meta_query_cached(mount, q)) {
+        unlock(&mount->lock);
+        return true;
+    }
+
+    struct fakefs_reader *reader = NULL;
+    if (!mount->batch_open)
+        reader = reader_get(mount);
+    if (reader == NULL) {
+        // do it the old fashioned way
+        mount->db_begun = false;
+        bool found;
+        if (q->path != NULL && q->want_stat) {
+            found = path_read_stat(mount, q->path, &q->stat, &q->inode);
+        } else if (q->path != NULL) {
+            q->inode = path_get_inode(mount, q->path);
+            found = q->inode != 0;
+        } else {
+            inode_read_stat(mount, q->inode, &q->stat);
+            found = true;
+        }
+        db_commit(mount);
+        return found;
+    }
+
+    unsigned generation = mount->cache_generation;
+    unlock(&mount->lock);
+    bool found = meta_query_reader(reader, q);
+    lock(&mount->lock);
+    reader_put(mount, reader);
+    if (found && generation == mount->cache_generation) {
+        if (q->path != NULL)
+            fake_cache_put_path(mount->cache, q->path, q->inode);
+        if (q->want_stat)
+            fake_cache_put_stat(mount->cache, q->inode, &q->stat);
+    }
+    unlock(&mount->lock);
+    return found;
+}
+
+// Directory listings
+//
+// The first readdir on a directory loads every name in it with one query, and
+// the rest of the listing is answered from that instead of looking up each
+// entry. Anything created after that is skipped until the directory is
+// rewound, which POSIX allows.
+
+static struct fakefs_dir *fakefs_dir_load(struct mount *mount, ino_t inode) {
+    lock(&mount->lock);
+    db_check_data_version(mount);
+    struct fakefs_reader *reader = NULL;
+    if (!mount->batch_open)
+        reader = reader_get(mount);
+    if (reader == NULL) {
+        mount->db_begun = false;
+        db_begin_now(mount);
+        struct fakefs_dir *dir = sql_dir_list(mount->db, mount->stmt.dir_list, mount->stmt.inode_parent, inode);
+        db_commit(mount);
+        return dir;
+    }
+    unlock(&mount->lock);
+    reader_begin(reader);
+    struct fakefs_dir *dir = sql_dir_list(reader->db, reader->dir_list, reader->inode_parent, inode);
+    reader_end(reader);
+    lock(&mount->lock);
+    reader_put(mount, reader);
+    unlock(&mount->lock);
+    return dir;
+}
+
+// this exists to override readdir to fix the returned inode numbers
 static struct fd_ops fakefs_fdops;
 
 static struct fd *fakefs_open(struct mount *mount, const char *path, int flags, int mode) {
     struct fd *fd = realfs.open(mount, path, flags, 0666);
     if (IS_ERR(fd))
         return fd;
-    db_begin(mount);
-    fd->fake_inode = path_get_inode(mount, path);
     if (flags & O_CREAT_) {
+        db_begin(mount);
+        fd->fake_inode = path_get_inode(mount, path);
         struct ish_stat ishstat;
         ishstat.mode = mode | S_IFREG;
         ishstat.uid = current->euid;
@@ -179,8 +811,12 @@ static struct fd *fakefs_open(struct mount *mount, const char *path, int flags,
             path_create(mount, path, &ishstat);
             fd->fake_inode = path_get_inode(mount, path);
         }
+        db_commit(mount);
+    } else {
+        struct meta_query q = {.path = path};
+        meta_query(mount, &q);
+        fd->fake_inode = q.inode;
     }
-    db_commit(mount);
     if (fd->fake_inode == 0) {
         // metadata for this file is missing
         // TODO unlink the real file
@@ -202,7 +838,11 @@ step:
         db_rollback(mount);
         return ERR_PTR(_ENOENT);
     }
-    const char *path = (const char *) sqlite3_column_text(stmt, 0);
+    // select parent, name from dentries where inode = ?
+    char path[MAX_PATH + 1];
+    if (!dentry_get_path(mount, sqlite3_column_int64(stmt, 0),
+                sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1), path))
+        goto step;
     struct fd *fd = realfs.open(mount, path, O_RDWR_, 0);
     if (PTR_ERR(fd) == _EISDIR)
         fd = realfs.open(mount, path, O_RDONLY_, 0);
@@ -317,22 +957,17 @@ static int fakefs_mknod(struct mount *mount, const char *path, mode_t_ mode, dev
 }
 
 static int fakefs_stat(struct mount *mount, const char *path, struct statbuf *fake_stat, bool follow_links) {
-    db_begin(mount);
-    struct ish_stat ishstat;
-    ino_t inode;
-    if (!path_read_stat(mount, path, &ishstat, &inode)) {
-        db_rollback(mount);
+    struct meta_query q = {.path = path, .want_stat = true};
+    if (!meta_query(mount, &q))
         return _ENOENT;
-    }
     int err = realfs.stat(mount, path, fake_stat, follow_links);
-    db_commit(mount);
     if (err < 0)
         return err;
-    fake_stat->inode = inode;
-    fake_stat->mode = ishstat.mode;
-    fake_stat->uid = ishstat.uid;
-    fake_stat->gid = ishstat.gid;
-    fake_stat->rdev = ishstat.rdev;
+    fake_stat->inode = q.inode;
+    fake_stat->mode = q.stat.mode;
+    fake_stat->uid = q.stat.uid;
+    fake_stat->gid = q.stat.gid;
+    fake_stat->rdev = q.stat.rdev;
     return 0;
 }
 
@@ -340,15 +975,14 @@ static int fakefs_fstat(struct fd *fd, struct statbuf *fake_stat) {
     int err = realfs.fstat(fd, fake_stat);
     if (err < 0)
         return err;
-    db_begin(fd->mount);
-    struct ish_stat ishstat;
-    inode_read_stat(fd->mount, fd->fake_inode, &ishstat);
-    db_commit(fd->mount);
+    struct meta_query q = {.inode = fd->fake_inode, .want_stat = true};
+    if (!meta_query(fd->mount, &q))
+        die("fakefs_fstat(%llu): missing inode", (unsigned long long) fd->fake_inode);
     fake_stat->inode = fd->fake_inode;
-    fake_stat->mode = ishstat.mode;
-    fake_stat->uid = ishstat.uid;
-    fake_stat->gid = ishstat.gid;
-    fake_stat->rdev = ishstat.rdev;
+    fake_stat->mode = q.stat.mode;
+    fake_stat->uid = q.stat.uid;
+    fake_stat->gid = q.stat.gid;
+    fake_stat->rdev = q.stat.rdev;
     return 0;
 }
 
@@ -424,48 +1058,41 @@ static ssize_t file_readlink(struct mount *mount, const char *path, char *buf, s
 }
 
 static ssize_t fakefs_readlink(struct mount *mount, const char *path, char *buf, size_t bufsize) {
-    db_begin(mount);
-    struct ish_stat ishstat;
-    if (!path_read_stat(mount, path, &ishstat, NULL)) {
-        db_rollback(mount);
+    struct meta_query q = {.path = path, .want_stat = true};
+    if (!meta_query(mount, &q))
         return _ENOENT;
-    }
-    if (!S_ISLNK(ishstat.mode)) {
-        db_rollback(mount);
+    if (!S_ISLNK(q.stat.mode))
         return _EINVAL;
-    }
 
     ssize_t err = realfs.readlink(mount, path, buf, bufsize);
     if (err == _EINVAL)
         err = file_readlink(mount, path, buf, bufsize);
-    db_commit(mount);
     return err;
 }
 
 static int fakefs_readdir(struct fd *fd, struct dir_entry *entry) {
     assert(fd->ops == &fakefs_fdops);
+    if (fd->fakefs_dir == NULL) {
+        fd->fakefs_dir = fakefs_dir_load(fd->mount, fd->fake_inode);
+        if (fd->fakefs_dir == NULL)
+            return _ENOMEM;
+    }
+
     int res;
 retry:
     res = realfs_fdops.readdir(fd, entry);
     if (res <= 0)
         return res;
-
-    // this is annoying
-    char entry_path[MAX_PATH + 1];
-    realfs_getpath(fd, entry_path);
-    if (strcmp(entry->name, "..") == 0) {
-        if (strcmp(entry_path, "") != 0) {
-            *strrchr(entry_path, '/') = '\0';
-        }
-    } else if (strcmp(entry->name, ".") != 0) {
-        // god I don't know what to do if this would overflow
-        strcat(entry_path, "/");
-        strcat(entry_path, entry->name);
+    if (strcmp(entry->name, ".") == 0) {
+        entry->inode = fd->fake_inode;
+    } else if (strcmp(entry->name, "..") == 0) {
+        entry->inode = fd->fakefs_dir->parent;
+    } else {
+        // the real file type is wrong for symlinks and devices
+        struct fakefs_dir_entry *found = fakefs_dir_find(fd->fakefs_dir, entry->name);
+        entry->inode = found != NULL ? found->inode : 0;
+        entry->type = found != NULL ? found->type : 0;
     }
-
-    db_begin(fd->mount);
-    entry->inode = path_get_inode(fd->mount, entry_path);
-    db_commit(fd->mount);
     // it's quite possible that due to some mishap there's no metadata for this file
     // so just skip this entry, instead of crashing the program, so there's hope for recovery
     if (entry->inode == 0)
@@ -473,15 +1100,116 @@ retry:
     return res;
 }
 
+static void fakefs_seekdir(struct fd *fd, unsigned long ptr) {
+    // rewinding, so start over with a fresh listing
+    if (ptr == 0 && fd->fakefs_dir != NULL) {
+        fakefs_dir_free(fd->fakefs_dir);
+        fd->fakefs_dir = NULL;
+    }
+    realfs_fdops.seekdir(fd, ptr);
+}
+
+static int fakefs_close(struct fd *fd) {
+    if (fd->fakefs_dir != NULL)
+        fakefs_dir_free(fd->fakefs_dir);
+    return realfs_close(fd);
+}
+
+static int fakefs_fsync(struct fd *fd) {
+    int err = realfs_fsync(fd);
+    if (err < 0)
+        return err;
+    return fakefs_sync(fd->mount);
+}
+
 static struct fd_ops fakefs_fdops;
 static void __attribute__((constructor)) init_fake_fdops() {
     fakefs_fdops = realfs_fdops;
     fakefs_fdops.readdir = fakefs_readdir;
+    fakefs_fdops.seekdir = fakefs_seekdir;
+    fakefs_fdops.close = fakefs_close;
+    fakefs_fdops.fsync = fakefs_fsync;
 }
 
-int fakefs_rebuild(struct mount *mount);
+int fakefs_rebuild_start(struct mount *mount);
+bool fakefs_rebuild_pending(struct mount *mount);
+void fakefs_rebuild(struct mount *mount);
 int fakefs_migrate(struct mount *mount);
 
+static bool orphans_pending(struct mount *mount) {
+    sqlite3_stmt *statement = db_prepare(mount, "select orphans from meta");
+    bool pending = sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_int64(statement, 0) != 0;
+    db_check_error(mount);
+    sqlite3_finalize(statement);
+    return pending;
+}
+
+// Looks for stats without any dentries, a range of inodes at a time so the
+// mount lock is never held for long. Inodes that are still open are skipped,
+// they'll be cleaned up when they're closed.
+#define SWEEP_CHUNK 1024
+static void fakefs_sweep_orphans(struct mount *mount) {
+    db_begin(mount);
+    db_begin_now(mount);
+    sqlite3_stmt *count = db_prepare(mount, "select orphans, (select max(inode) from stats) from meta");
+    sqlite3_stmt *find = db_prepare(mount, "select inode from stats where inode > ? and inode <= ? "
+            "and not exists (select 1 from dentries where inode = stats.inode)");
+    sqlite3_stmt *clear = db_prepare(mount, "update meta set orphans = 0 where orphans = ?");
+    int64_t orphans = 0;
+    ino_t max_inode = 0;
+    if (db_exec(mount, count)) {
+        orphans = sqlite3_column_int64(count, 0);
+        max_inode = sqlite3_column_int64(count, 1);
+    }
+    db_reset(mount, count);
+    db_commit(mount);
+
+    bool finished = orphans != 0;
+    for (ino_t start = 0; finished && start <= max_inode; start += SWEEP_CHUNK) {
+        ino_t inodes[SWEEP_CHUNK];
+        int inodes_count = 0;
+        db_begin(mount);
+        if (mount->background_exit) {
+            db_commit(mount);
+            finished = false;
+            break;
+        }
+        sqlite3_bind_int64(find, 1, start);
+        sqlite3_bind_int64(find, 2, start + SWEEP_CHUNK);
+        while (inodes_count < SWEEP_CHUNK && db_exec(mount, find))
+            inodes[inodes_count++] = sqlite3_column_int64(find, 0);
+        db_reset(mount, find);
+        for (int i = 0; i < inodes_count; i++) {
+            if (inode_is_orphaned(mount, inodes[i]))
+                try_cleanup_inode(mount, inodes[i]);
+        }
+        db_commit(mount);
+    }
+
+    // anything orphaned during the sweep changes the count, and keeps it
+    // from being cleared
+    if (finished) {
+        db_begin(mount);
+        sqlite3_bind_int64(clear, 1, orphans);
+        db_exec_reset(mount, clear);
+        db_commit(mount);
+    }
+    lock(&mount->lock);
+    sqlite3_finalize(count);
+    sqlite3_finalize(find);
+    sqlite3_finalize(clear);
+    unlock(&mount->lock);
+}
+
+// Maintenance that can wait until the filesystem is already in use
+static void *fakefs_background_thread(void *data) {
+    struct mount *mount = data;
+    if (mount->background_rebuild)
+        fakefs_rebuild(mount);
+    fakefs_sweep_orphans(mount);
+    return NULL;
+}
+
 #if DEBUG_sql
 static int trace_callback(unsigned UNUSED(why), void *UNUSED(fuck), void *stmt, void *_sql) {
     char *sql = _sql;
@@ -490,26 +1218,9 @@ static int trace_callback(unsigned UNUSED(why), void *UNUSED(fuck), void *stmt,
 }
 #endif
 
-static void sqlite_func_change_prefix(sqlite3_context *context, int argc, sqlite3_value **args) {
-    assert(argc == 3);
-    const void *in_blob = sqlite3_value_blob(args[0]);
-    size_t in_size = sqlite3_value_bytes(args[0]);
-    size_t start = sqlite3_value_int64(args[1]);
-    const void *replacement = sqlite3_value_blob(args[2]);
-    size_t replacement_size = sqlite3_value_bytes(args[2]);
-    size_t out_size = in_size - start + replacement_size;
-    char *out_blob = sqlite3_malloc(out_size);
-    memcpy(out_blob, replacement, replacement_size);
-    memcpy(out_blob + replacement_size, in_blob + start, in_size - start);
-    sqlite3_result_blob(context, out_blob, out_size, sqlite3_free);
-}
-
 static int fakefs_mount(struct mount *mount) {
     char db_path[PATH_MAX];
-    strcpy(db_path, mount->source);
-    char *basename = strrchr(db_path, '/') + 1;
-    assert(strcmp(basename, "data") == 0);
-    strcpy(basename, "meta.db");
+    fakefs_db_path(mount, db_path);
 
     // check if it is in fact a sqlite database
     char buf[16] = {};
@@ -528,8 +1239,6 @@ static int fakefs_mount(struct mount *mount) {
         return _EINVAL;
     }
     sqlite3_busy_timeout(mount->db, 1000);
-    sqlite3_create_function(mount->db, "change_prefix", 3, SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, sqlite_func_change_prefix, NULL, NULL);
-    db_check_error(mount);
 
     // let's do WAL mode
     sqlite3_stmt *statement = db_prepare(mount, "pragma journal_mode=wal");
@@ -561,6 +1270,8 @@ static int fakefs_mount(struct mount *mount) {
     // inode numbers will be different. to detect this, the inode of the
     // database file is stored inside the database and compared with the actual
     // database file inode, and if they're different we rebuild the database.
+    // The rebuild itself happens at the end of the mount, see
+    // fs/fake-rebuild.c.
     struct stat statbuf;
     if (stat(db_path, &statbuf) < 0) ERRNO_DIE("stat database");
     ino_t db_inode = statbuf.st_ino;
@@ -569,7 +1280,7 @@ static int fakefs_mount(struct mount *mount) {
         if ((uint64_t) sqlite3_column_int64(statement, 0) != db_inode) {
             sqlite3_finalize(statement);
             statement = NULL;
-            int err = fakefs_rebuild(mount);
+            int err = fakefs_rebuild_start(mount);
             if (err < 0) {
                 close(mount->root_fd);
                 return err;
@@ -587,34 +1298,93 @@ static int fakefs_mount(struct mount *mount) {
     db_check_error(mount);
     sqlite3_finalize(statement);
 
-    // delete orphaned stats
-    statement = db_prepare(mount, "delete from stats where not exists (select 1 from paths where inode = stats.inode)");
-    db_check_error(mount);
-    sqlite3_step(statement);
-    db_check_error(mount);
-    sqlite3_finalize(statement);
-
     lock_init(&mount->lock);
     mount->stmt.begin = db_prepare(mount, "begin");
     mount->stmt.commit = db_prepare(mount, "commit");
     mount->stmt.rollback = db_prepare(mount, "rollback");
-    mount->stmt.path_get_inode = db_prepare(mount, "select inode from paths where path = ?");
-    mount->stmt.path_read_stat = db_prepare(mount, "select inode, stat from stats natural join paths where path = ?");
+    mount->stmt.dentry_lookup = db_prepare(mount, SQL_DENTRY_LOOKUP);
+    mount->stmt.dentry_link = db_prepare(mount, "insert or replace into dentries (parent, name, inode) values (?, ?, ?)");
+    mount->stmt.dentry_unlink = db_prepare(mount, "delete from dentries where parent = ? and name = ?");
+    mount->stmt.dentry_unlink_children = db_prepare(mount, "delete from dentries where parent = ?");
+    mount->stmt.dentry_rename = db_prepare(mount, "update or replace dentries set parent = ?, name = ? where parent = ? and name = ?");
     mount->stmt.path_create_stat = db_prepare(mount, "insert into stats (stat) values (?)");
-    mount->stmt.path_create_path = db_prepare(mount, "insert or replace into paths values (?, last_insert_rowid())");
-    mount->stmt.inode_read_stat = db_prepare(mount, "select stat from stats where inode = ?");
+    mount->stmt.inode_read_stat = db_prepare(mount, SQL_INODE_READ_STAT);
     mount->stmt.inode_write_stat = db_prepare(mount, "update stats set stat = ? where inode = ?");
-    mount->stmt.path_link = db_prepare(mount, "insert or replace into paths (path, inode) values (?, ?)");
-    mount->stmt.path_unlink = db_prepare(mount, "delete from paths where path = ?");
-    mount->stmt.path_rename = db_prepare(mount, "update or replace paths set path = change_prefix(path, ?, ?) "
-            "where (path >= ? and path < ?) or path = ?");
-    mount->stmt.path_from_inode = db_prepare(mount, "select path from paths where inode = ?");
-    mount->stmt.try_cleanup_inode = db_prepare(mount, "delete from stats where inode = ? and not exists (select 1 from paths where inode = stats.inode)");
+    mount->stmt.path_from_inode = db_prepare(mount, "select parent, name from dentries where inode = ?");
+    mount->stmt.inode_parent = db_prepare(mount, SQL_INODE_PARENT);
+    mount->stmt.dir_list = db_prepare(mount, SQL_DIR_LIST);
+    mount->stmt.try_cleanup_inode = db_prepare(mount, "delete from stats where inode = ? and not exists (select 1 from dentries where inode = stats.inode)");
+    mount->stmt.orphans_add = db_prepare(mount, "update meta set orphans = max(orphans + ?, 0)");
+    mount->stmt.data_version = db_prepare(mount, "pragma data_version");
+    mount->stmt.savepoint = db_prepare(mount, "savepoint op");
+    mount->stmt.release = db_prepare(mount, "release op");
+    mount->stmt.rollback_savepoint = db_prepare(mount, "rollback to op");
+
+    mount->db_begun = false;
+    mount->data_version = 0;
+    mount->data_version_checked = 0;
+    mount->cache = fake_cache_new();
+    if (mount->cache == NULL)
+        return _ENOMEM;
+    mount->cache_generation = 0;
+    list_init(&mount->readers);
+    mount->readers_count = 0;
+
+    mount->batch = fakefs_commit_policy.batch;
+    mount->batch_open = false;
+    mount->batch_exit = false;
+    mount->batch_ops = 0;
+    if (mount->batch) {
+        cond_init(&mount->batch_cond);
+        if (pthread_create(&mount->batch_thread, NULL, fakefs_batch_thread, mount) != 0)
+            mount->batch = false;
+    }
+
+    // the rebuild looks at background_exit even when it isn't in the background
+    mount->background_running = false;
+    mount->background_exit = false;
+    mount->background_rebuild = false;
+    // picks up an unfinished rebuild too
+    bool rebuild = fakefs_rebuild_pending(mount);
+    if (rebuild && !fakefs_rebuild_policy.lazy) {
+        fakefs_rebuild(mount);
+        rebuild = false;
+    }
+    mount->background_rebuild = rebuild;
+    if (rebuild || orphans_pending(mount)) {
+        if (pthread_create(&mount->background_thread, NULL, fakefs_background_thread, mount) == 0) {
+            mount->background_running = true;
+        } else {
+            fakefs_background_thread(mount);
+        }
+    }
 
     return 0;
 }
 
 static int fakefs_umount(struct mount *mount) {
+    if (mount->background_running) {
+        lock(&mount->lock);
+        mount->background_exit = true;
+        unlock(&mount->lock);
+        pthread_join(mount->background_thread, NULL);
+    }
+    if (mount->batch) {
+        lock(&mount->lock);
+        mount->batch_exit = true;
+        notify(&mount->batch_cond);
+        unlock(&mount->lock);
+        // commits whatever's left on the way out
+        pthread_join(mount->batch_thread, NULL);
+        cond_destroy(&mount->batch_cond);
+    }
+    struct fakefs_reader *reader, *tmp;
+    list_for_each_entry_safe(&mount->readers, reader, tmp, idle) {
+        list_remove(&reader->idle);
+        reader_close(reader);
+    }
+    if (mount->cache)
+        fake_cache_free(mount->cache);
     if (mount->db)
         sqlite3_close(mount->db);
     /* return realfs.umount(mount); */
@@ -623,14 +1393,46 @@ static int fakefs_umount(struct mount *mount) {
 
 static void fakefs_inode_orphaned(struct mount *mount, struct inode_data *inode) {
     db_begin(mount);
-    try_cleanup_inode(mount, inode->number);
+    if (try_cleanup_inode(mount, inode->number))
+        orphans_add(mount, -1);
     db_commit(mount);
 }
 
+size_t fakefs_show_stats(char *buf, size_t size) {
+    size_t n = 0;
+    lock(&mounts_lock);
+    struct mount *mount;
+    list_for_each_entry(&mounts, mount, mounts) {
+        if (mount->fs != &fakefs)
+            continue;
+        // not locking the mount, since these are just counters
+        struct fakefs_cache_stats stats = fake_cache_stats(mount->cache);
+        int len = snprintf(buf + n, size - n, "%s hits %llu misses %llu evictions %llu entries %llu\n",
+                mount->point[0] == '\0' ? "/" : mount->point,
+                (unsigned long long) stats.hits, (unsigned long long) stats.misses,
+                (unsigned long long) stats.evictions, (unsigned long long) stats.entries);
+        if (len < 0 || (size_t) len >= size - n)
+            break;
+        n += len;
+        if (mount->rebuild_running) {
+            len = snprintf(buf + n, size - n, "%s rebuild %llu of %llu directories\n",
+                    mount->point[0] == '\0' ? "/" : mount->point,
+                    (unsigned long long) mount->rebuild_dirs_done,
+                    (unsigned long long) mount->rebuild_dirs_queued);
+            if (len < 0 || (size_t) len >= size - n)
+                break;
+            n += len;
+        }
+    }
+    unlock(&mounts_lock);
+    return n;
+}
+
 const struct fs_ops fakefs = {
     .magic = 0x66616b65,
     .mount = fakefs_mount,
     .umount = fakefs_umount,
+    .sync = fakefs_sync,
     .statfs = realfs_statfs,
     .open = fakefs_open,
     .readlink = fakefs_readlink,
@@ -640,7 +1442,7 @@ const struct fs_ops fakefs = {
     .symlink = fakefs_symlink,
     .mknod = fakefs_mknod,
 
-    .close = realfs_close,
+    .close = fakefs_close,
     .stat = fakefs_stat,
     .fstat = fakefs_fstat,
     .flock = realfs_flock,
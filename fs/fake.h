@@ -18,6 +18,11 @@ struct ish_stat {
 void db_begin(struct mount *mount);
 void db_commit(struct mount *mount);
 void db_rollback(struct mount *mount);
+// Starts the transaction right away instead of at the first statement
+void db_begin_now(struct mount *mount);
+// Forgets everything cached, after the database was changed behind the
+// cache's back. Needs the mount lock.
+void fakefs_metadata_changed(struct mount *mount);
 
 ino_t path_get_inode(struct mount *mount, const char *path);
 bool path_read_stat(struct mount *mount, const char *path, struct ish_stat *stat, ino_t *inode);
@@ -25,4 +30,19 @@ void path_create(struct mount *mount, const char *path, struct ish_stat *stat);
 
 struct fd *fakefs_open_inode(struct mount *mount, ino_t inode);
 
+// In front of the path and stat lookups, see fs/fake-cache.c. Needs the mount
+// lock.
+struct fakefs_cache *fake_cache_new(void);
+void fake_cache_free(struct fakefs_cache *cache);
+bool fake_cache_get_path(struct fakefs_cache *cache, const char *path, ino_t *inode);
+void fake_cache_put_path(struct fakefs_cache *cache, const char *path, ino_t inode);
+void fake_cache_drop_path(struct fakefs_cache *cache, const char *path);
+// drops the path and everything under it
+void fake_cache_drop_subtree(struct fakefs_cache *cache, const char *path);
+bool fake_cache_get_stat(struct fakefs_cache *cache, ino_t inode, struct ish_stat *stat);
+void fake_cache_put_stat(struct fakefs_cache *cache, ino_t inode, struct ish_stat *stat);
+void fake_cache_drop_stat(struct fakefs_cache *cache, ino_t inode);
+void fake_cache_clear(struct fakefs_cache *cache);
+struct fakefs_cache_stats fake_cache_stats(struct fakefs_cache *cache);
+
 #endif
@@ -8,6 +8,9 @@
 #include "fs/fd.h"
 #include "fs/inode.h"
 
+static lock_t fd_paths_lock = LOCK_INITIALIZER;
+static struct list fd_paths = LIST_INITIALIZER(fd_paths);
+
 struct fd *fd_create(const struct fd_ops *ops) {
     struct fd *fd = malloc(sizeof(struct fd));
     if (fd == NULL)
@@ -36,11 +39,10 @@ int fd_close(struct fd *fd) {
         lock(&fd->poll_lock);
         struct poll_fd *poll_fd, *tmp;
         list_for_each_entry_safe(&fd->poll_fds, poll_fd, tmp, polls) {
-            lock(&poll_fd->poll->lock);
-            list_remove(&poll_fd->polls);
-            list_remove(&poll_fd->fds);
-            unlock(&poll_fd->poll->lock);
-            free(poll_fd);
+            struct poll *poll = poll_fd->poll;
+            lock(&poll->lock);
+            poll_fd_remove(poll_fd);
+            unlock(&poll->lock);
         }
         unlock(&fd->poll_lock);
         if (fd->ops->close)
@@ -52,6 +54,12 @@ int fd_close(struct fd *fd) {
                 err = new_err;
         }
 
+        if (fd->path) {
+            lock(&fd_paths_lock);
+            list_remove(&fd->paths);
+            unlock(&fd_paths_lock);
+            free(fd->path);
+        }
         if (fd->inode)
             inode_release(fd->inode);
         if (fd->mount)
@@ -61,6 +69,76 @@ int fd_close(struct fd *fd) {
     return err;
 }
 
+void fd_set_path(struct fd *fd, const char *path) {
+    char *path_copy = strdup(path);
+    if (path_copy == NULL)
+        return;
+    lock(&fd_paths_lock);
+    if (fd->path != NULL) {
+        free(fd->path);
+        list_remove(&fd->paths);
+    }
+    fd->path = path_copy;
+    list_add(&fd_paths, &fd->paths);
+    unlock(&fd_paths_lock);
+}
+
+bool fd_get_path(struct fd *fd, char *buf) {
+    lock(&fd_paths_lock);
+    bool found = fd->path != NULL;
+    if (found)
+        strcpy(buf, fd->path);
+    unlock(&fd_paths_lock);
+    return found;
+}
+
+// whether the fd's path is path or something under it
+static bool fd_path_under(struct fd *fd, struct mount *mount, const char *path, size_t len) {
+    if (fd->mount != mount || strncmp(fd->path, path, len) != 0)
+        return false;
+    return fd->path[len] == '\0' || fd->path[len] == '/';
+}
+
+// getpath will have to ask the filesystem
+static void fd_path_forget(struct fd *fd) {
+    list_remove(&fd->paths);
+    free(fd->path);
+    fd->path = NULL;
+}
+
+void fd_paths_rename(struct mount *mount, const char *src, const char *dst) {
+    size_t src_len = strlen(src);
+    size_t dst_len = strlen(dst);
+    lock(&fd_paths_lock);
+    struct fd *fd, *tmp;
+    list_for_each_entry_safe(&fd_paths, fd, tmp, paths) {
+        if (!fd_path_under(fd, mount, src, src_len))
+            continue;
+        size_t rest_len = strlen(fd->path + src_len);
+        char *new_path = malloc(dst_len + rest_len + 1);
+        if (new_path == NULL) {
+            fd_path_forget(fd);
+            continue;
+        }
+        memcpy(new_path, dst, dst_len);
+        memcpy(new_path + dst_len, fd->path + src_len, rest_len + 1);
+        free(fd->path);
+        fd->path = new_path;
+    }
+    unlock(&fd_paths_lock);
+}
+
+void fd_paths_remove(struct mount *mount, const char *path) {
+    size_t len = strlen(path);
+    lock(&fd_paths_lock);
+    struct fd *fd, *tmp;
+    list_for_each_entry_safe(&fd_paths, fd, tmp, paths) {
+        if (fd_path_under(fd, mount, path, len))
+            fd_path_forget(fd);
+    }
+    unlock(&fd_paths_lock);
+}
+
 static int fdtable_resize(struct fdtable *table, unsigned size);
 
 struct fdtable *fdtable_new(int size) {
@@ -164,10 +242,9 @@ struct fd *f_get(fd_t f) {
     return fd;
 }
 
-static fd_t f_install_start(struct fd *fd, fd_t start) {
+static fd_t fdtable_install_start(struct fdtable *table, struct fd *fd, fd_t start, unsigned limit) {
     assert(start >= 0);
-    struct fdtable *table = current->files;
-    unsigned size = rlimit(RLIMIT_NOFILE_);
+    unsigned size = limit;
     if (size > table->size)
         size = table->size;
 
@@ -190,19 +267,27 @@ static fd_t f_install_start(struct fd *fd, fd_t start) {
     return f;
 }
 
-fd_t f_install(struct fd *fd, int flags) {
-    lock(&current->files->lock);
-    fd_t f = f_install_start(fd, 0);
+static fd_t f_install_start(struct fd *fd, fd_t start) {
+    return fdtable_install_start(current->files, fd, start, rlimit(RLIMIT_NOFILE_));
+}
+
+fd_t fdtable_install(struct fdtable *table, struct fd *fd, int flags, unsigned limit) {
+    lock(&table->lock);
+    fd_t f = fdtable_install_start(table, fd, 0, limit);
     if (f >= 0) {
         if (flags & O_CLOEXEC_)
-            bit_set(f, current->files->cloexec);
+            bit_set(f, table->cloexec);
         if (flags & O_NONBLOCK_)
             fd->flags |= O_NONBLOCK_;
     }
-    unlock(&current->files->lock);
+    unlock(&table->lock);
     return f;
 }
 
+fd_t f_install(struct fd *fd, int flags) {
+    return fdtable_install(current->files, fd, flags, rlimit(RLIMIT_NOFILE_));
+}
+
 static int fdtable_close(struct fdtable *table, fd_t f) {
     struct fd *fd = fdtable_get(table, f);
     if (fd == NULL)
@@ -1,6 +1,7 @@
 #ifndef FD_H
 #define FD_H
 #include <dirent.h>
+#include <sys/uio.h>
 #include "emu/memory.h"
 #include "util/list.h"
 #include "util/sync.h"
@@ -42,6 +43,10 @@ struct fd {
             struct timer *timer;
             uint64_t expirations;
         };
+        // io_uring
+        struct {
+            struct io_ring *io_ring;
+        };
     };
     // fs data
     union {
@@ -56,6 +61,18 @@ struct fd {
         struct {
             int pty_num;
         };
+        // fakefs
+        struct {
+            // what's in the directory, loaded by the first readdir
+            struct fakefs_dir *fakefs_dir;
+        };
+        // tmpfs
+        struct {
+            struct tmp_inode *tmp_inode;
+            // where readdir left off, and the offset it left off at
+            struct tmp_dentry *tmp_cursor;
+            unsigned long tmp_cursor_offset;
+        };
     };
 
     // fs/inode data
@@ -64,6 +81,12 @@ struct fd {
     DIR *dir;
     struct inode_data *inode;
     ino_t fake_inode;
+    // the path it was opened with, relative to the mount, or NULL if it
+    // wasn't opened by path. renames keep it up to date, and unlinking or
+    // renaming over it clears it. locked by
+    // fd_paths_lock
+    char *path;
+    struct list paths;
     struct statbuf stat; // for adhoc fs
     struct fd_sockrestart sockrestart; // argh
 
@@ -79,12 +102,24 @@ struct fd *fd_create(const struct fd_ops *ops);
 struct fd *fd_retain(struct fd *fd);
 int fd_close(struct fd *fd);
 
+// Remembers the path the fd was opened with so getpath doesn't have to ask
+// the host
+void fd_set_path(struct fd *fd, const char *path);
+// Copies the remembered path into buf and returns true, if there is one
+bool fd_get_path(struct fd *fd, char *buf);
+// Fixes up the paths of open fds after something is renamed
+void fd_paths_rename(struct mount *mount, const char *src, const char *dst);
+// Forgets the paths of open fds on something that was removed or renamed over,
+// since the path doesn't lead to them anymore
+void fd_paths_remove(struct mount *mount, const char *path);
+
 int fd_getflags(struct fd *fd);
 int fd_setflags(struct fd *fd, int flags);
 
 #define NAME_MAX 255
 struct dir_entry {
     qword_t inode;
+    mode_t_ type; // just the S_IFMT part, or 0 if it's not known
     char name[NAME_MAX + 1];
 };
 
@@ -98,6 +133,21 @@ struct fd_ops {
     ssize_t (*read)(struct fd *fd, void *buf, size_t bufsize);
     ssize_t (*write)(struct fd *fd, const void *buf, size_t bufsize);
     off_t_ (*lseek)(struct fd *fd, off_t_ off, int whence);
+    // optional, read or write straight from a list of host buffers, which
+    // lets read and write skip the bounce buffer
+    ssize_t (*readv)(struct fd *fd, const struct iovec *iov, int iovcnt);
+    ssize_t (*writev)(struct fd *fd, const struct iovec *iov, int iovcnt);
+    // optional, read or write at an offset without moving the file position
+    // or taking fd->lock, otherwise pread and pwrite fall back to seeking
+    ssize_t (*pread)(struct fd *fd, void *buf, size_t bufsize, off_t_ off);
+    ssize_t (*pwrite)(struct fd *fd, const void *buf, size_t bufsize, off_t_ off);
+    // optional, the same with a list of host buffers, so preadv and pwritev
+    // are one call instead of one per buffer
+    ssize_t (*preadv)(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off);
+    ssize_t (*pwritev)(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off);
+    // optional, returns the host fd behind this one so sendfile and friends
+    // can move data without it passing through the emulator
+    int (*host_fd)(struct fd *fd);
 
     // Reads a directory entry from the stream
     // required for directories
@@ -149,6 +199,8 @@ struct fd *f_get(fd_t f);
 // steals a reference to the fd, gives it to the table on success and destroys it on error
 // flags is checked for O_CLOEXEC and O_NONBLOCK
 fd_t f_install(struct fd *fd, int flags);
+// for when there's no current task, limit is RLIMIT_NOFILE
+fd_t fdtable_install(struct fdtable *table, struct fd *fd, int flags, unsigned limit);
 int f_close(fd_t f);
 
 #endif
@@ -6,6 +6,7 @@
 #include "fs/fd.h"
 #include "fs/inode.h"
 #include "fs/path.h"
+#include "fs/dcache.h"
 #include "fs/dev.h"
 #include "kernel/task.h"
 #include "kernel/errno.h"
@@ -31,6 +32,19 @@ bool contains_mount_point(const char *path) {
     return false;
 }
 
+// Called after changing a path, with the path already trimmed by
+// find_mount_and_trim_path
+static void invalidate_path(struct mount *mount, const char *path, bool subtree) {
+    char full_path[MAX_PATH];
+    if (strlen(mount->point) + strlen(path) >= sizeof(full_path)) {
+        dcache_invalidate_all();
+        return;
+    }
+    strcpy(full_path, mount->point);
+    strcat(full_path, path);
+    dcache_invalidate(full_path, subtree);
+}
+
 struct fd *generic_openat(struct fd *at, const char *path_raw, int flags, int mode) {
     // TODO really, really, seriously reconsider what I'm doing with the strings
     char path[MAX_PATH];
@@ -39,6 +53,8 @@ struct fd *generic_openat(struct fd *at, const char *path_raw, int flags, int mo
         return ERR_PTR(err);
     struct mount *mount = find_mount_and_trim_path(path);
     struct fd *fd = mount->fs->open(mount, path, flags, mode);
+    if (flags & O_CREAT_)
+        invalidate_path(mount, path, false);
     if (IS_ERR(fd)) {
         // if an error happens after this point, fd_close will release the
         // mount, but right now we need to do it manually
@@ -46,6 +62,7 @@ struct fd *generic_openat(struct fd *at, const char *path_raw, int flags, int mo
         return fd;
     }
     fd->mount = mount;
+    fd_set_path(fd, path);
 
     struct statbuf stat;
     err = fd->mount->fs->fstat(fd, &stat);
@@ -87,9 +104,11 @@ struct fd *generic_open(const char *path, int flags, int mode) {
 }
 
 int generic_getpath(struct fd *fd, char *buf) {
-    int err = fd->mount->fs->getpath(fd, buf);
-    if (err < 0)
-        return err;
+    if (!fd_get_path(fd, buf)) {
+        int err = fd->mount->fs->getpath(fd, buf);
+        if (err < 0)
+            return err;
+    }
     if (strlen(buf) + strlen(fd->mount->point) >= MAX_PATH)
         return _ENAMETOOLONG;
     memmove(buf + strlen(fd->mount->point), buf, strlen(buf) + 1);
@@ -130,6 +149,8 @@ int generic_linkat(struct fd *src_at, const char *src_raw, struct fd *dst_at, co
         err = _EXDEV;
     else
         err = mount->fs->link(mount, src, dst);
+    if (err >= 0)
+        invalidate_path(dst_mount, dst, false);
     mount_release(mount);
     mount_release(dst_mount);
     return err;
@@ -142,6 +163,10 @@ int generic_unlinkat(struct fd *at, const char *path_raw) {
         return err;
     struct mount *mount = find_mount_and_trim_path(path);
     err = mount->fs->unlink(mount, path);
+    if (err >= 0) {
+        invalidate_path(mount, path, false);
+        fd_paths_remove(mount, path);
+    }
     mount_release(mount);
     return err;
 }
@@ -163,6 +188,14 @@ int generic_renameat(struct fd *src_at, const char *src_raw, struct fd *dst_at,
         err = _EXDEV;
     else
         err = mount->fs->rename(mount, src, dst);
+    if (err >= 0) {
+        invalidate_path(mount, src, true);
+        invalidate_path(dst_mount, dst, true);
+        // whatever was at dst is gone now, unless src and dst are the same
+        if (strcmp(src, dst) != 0)
+            fd_paths_remove(dst_mount, dst);
+        fd_paths_rename(mount, src, dst);
+    }
     mount_release(mount);
     mount_release(dst_mount);
     return err;
@@ -175,6 +208,8 @@ int generic_symlinkat(const char *target, struct fd *at, const char *link_raw) {
         return err;
     struct mount *mount = find_mount_and_trim_path(link);
     err = mount->fs->symlink(mount, target, link);
+    if (err >= 0)
+        invalidate_path(mount, link, false);
     mount_release(mount);
     return err;
 }
@@ -194,6 +229,8 @@ int generic_mknod(const char *path_raw, mode_t_ mode, dev_t_ dev) {
         err = _EPERM;
     else
         err = mount->fs->mknod(mount, path, mode, dev);
+    if (err >= 0)
+        invalidate_path(mount, path, false);
     mount_release(mount);
     return err;
 }
@@ -240,6 +277,8 @@ int generic_mkdirat(struct fd *at, const char *path_raw, mode_t_ mode) {
         return err;
     struct mount *mount = find_mount_and_trim_path(path);
     err = mount->fs->mkdir(mount, path, mode);
+    if (err >= 0)
+        invalidate_path(mount, path, false);
     mount_release(mount);
     return err;
 }
@@ -253,6 +292,11 @@ int generic_rmdirat(struct fd *at, const char *path_raw) {
         return _EBUSY;
     struct mount *mount = find_mount_and_trim_path(path);
     err = mount->fs->rmdir(mount, path);
+    // it was empty, so there's nothing under it that's now wrong
+    if (err >= 0) {
+        invalidate_path(mount, path, false);
+        fd_paths_remove(mount, path);
+    }
     mount_release(mount);
     return err;
 }
@@ -77,8 +77,17 @@ static ssize_t random_read(struct fd *UNUSED(fd), void *buf, size_t bufsize) {
     get_random(buf, bufsize);
     return bufsize;
 }
+static ssize_t random_readv(struct fd *UNUSED(fd), const struct iovec *iov, int iovcnt) {
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        get_random(iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    return total;
+}
 struct dev_ops random_dev = {
     .open = null_open,
     .fd.read = random_read,
+    .fd.readv = random_readv,
     .fd.write = null_write,
 };
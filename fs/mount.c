@@ -3,11 +3,13 @@
 #include "kernel/calls.h"
 #include "kernel/fs.h"
 #include "fs/path.h"
+#include "fs/dcache.h"
 
 const struct fs_ops *filesystems[] = {
     &realfs,
     &procfs,
     &devptsfs,
+    &tmpfs,
 };
 
 struct mount *mount_find(char *path) {
@@ -37,18 +39,22 @@ void mount_release(struct mount *mount) {
     unlock(&mounts_lock);
 }
 
-int do_mount(const struct fs_ops *fs, const char *source, const char *point) {
+int do_mount(const struct fs_ops *fs, const char *source, const char *point, const char *options) {
     struct mount *new_mount = malloc(sizeof(struct mount));
     if (new_mount == NULL)
         return _ENOMEM;
     new_mount->point = strdup(point);
     new_mount->source = strdup(source);
+    new_mount->options = strdup(options != NULL ? options : "");
     new_mount->fs = fs;
     new_mount->data = NULL;
     new_mount->refcount = 0;
     if (fs->mount) {
         int err = fs->mount(new_mount);
         if (err < 0) {
+            free((void *) new_mount->options);
+            free((void *) new_mount->source);
+            free((void *) new_mount->point);
             free(new_mount);
             return err;
         }
@@ -61,6 +67,7 @@ int do_mount(const struct fs_ops *fs, const char *source, const char *point) {
             break;
     }
     list_add_before(&mount->mounts, &new_mount->mounts);
+    dcache_invalidate_all();
     return 0;
 }
 
@@ -71,6 +78,8 @@ int mount_remove(struct mount *mount) {
     if (mount->fs->umount)
         mount->fs->umount(mount);
     list_remove(&mount->mounts);
+    dcache_invalidate_all();
+    free((void *) mount->options);
     free((void *) mount->source);
     free((void *) mount->point);
     free(mount);
@@ -104,7 +113,10 @@ dword_t sys_mount(addr_t source_addr, addr_t point_addr, addr_t type_addr, dword
     char type[100];
     if (user_read_string(type_addr, type, sizeof(type)))
         return _EFAULT;
-    STRACE("mount(\"%s\", \"%s\", \"%s\", %#x, %#x)", source, point_raw, type, flags, data_addr);
+    char data[4096] = "";
+    if (data_addr != 0 && user_read_string(data_addr, data, sizeof(data)))
+        return _EFAULT;
+    STRACE("mount(\"%s\", \"%s\", \"%s\", %#x, \"%s\")", source, point_raw, type, flags, data);
 
     if (flags & ~MS_SUPPORTED) {
         FIXME("missing mount flags %#x", flags & ~MS_SUPPORTED);
@@ -134,7 +146,7 @@ dword_t sys_mount(addr_t source_addr, addr_t point_addr, addr_t type_addr, dword
         return err;
 
     lock(&mounts_lock);
-    err = do_mount(fs, source, point);
+    err = do_mount(fs, source, point, data);
     unlock(&mounts_lock);
     return err;
 }
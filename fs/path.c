@@ -1,6 +1,7 @@
 #include <string.h>
 #include "kernel/calls.h"
 #include "fs/path.h"
+#include "fs/dcache.h"
 
 static int __path_normalize(const char *at_path, const char *path, char *out, bool follow_links, int levels) {
     const char *p = path;
@@ -62,13 +63,19 @@ static int __path_normalize(const char *at_path, const char *path, char *out, bo
             // passed to the next path_normalize call
             char possible_symlink[MAX_PATH];
             *o = '\0';
-            strcpy(possible_symlink, out);
-            struct mount *mount = find_mount_and_trim_path(possible_symlink);
-            assert(path_is_normalized(possible_symlink));
-            int res = _EINVAL;
-            if (mount->fs->readlink)
-                res = mount->fs->readlink(mount, possible_symlink, c, MAX_PATH - (c - out));
-            mount_release(mount);
+            ssize_t res;
+            if (!dcache_get(out, c, MAX_PATH - (c - out), &res)) {
+                unsigned generation = dcache_generation();
+                strcpy(possible_symlink, out);
+                struct mount *mount = find_mount_and_trim_path(possible_symlink);
+                assert(path_is_normalized(possible_symlink));
+                res = _EINVAL;
+                if (mount->fs->readlink)
+                    res = mount->fs->readlink(mount, possible_symlink, c, MAX_PATH - (c - out));
+                if (!mount->fs->dynamic)
+                    dcache_put(out, c, res, generation);
+                mount_release(mount);
+            }
             if (res >= 0) {
                 if (levels >= 5)
                     return _ELOOP;
@@ -1,3 +1,11 @@
+#if __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
 #include "kernel/task.h"
 #include <string.h>
 #include <poll.h>
@@ -9,6 +17,7 @@
 #include "fs/fd.h"
 #include "fs/poll.h"
 #include "fs/sockrestart.h"
+extern const struct fd_ops socket_fdops;
 
 // lock order: fd, then poll
 
@@ -17,13 +26,147 @@ struct poll *poll_create() {
     if (poll == NULL)
         return NULL;
     poll->waiters = 0;
-    poll->notify_pipe[0] = -1;
-    poll->notify_pipe[1] = -1;
+    poll->host_fd = -1;
+    poll->wakeup_fd = -1;
+    poll->sockets = 0;
     list_init(&poll->poll_fds);
+    list_init(&poll->ready);
+    poll->generation = 0;
     lock_init(&poll->lock);
     return poll;
 }
 
+// The host side of a poll is an epoll (kqueue on darwin) holding the real fds
+// that have been added, plus a way for poll_wakeup to interrupt a wait. It's
+// created the first time it's needed, so a poll that never waits never pays
+// for it. All of these need the poll locked.
+
+static bool poll_fd_is_host(struct poll_fd *poll_fd) {
+    return poll_fd->fd->ops->poll == realfs_poll;
+}
+
+static int host_poll_init(struct poll *poll) {
+    if (poll->host_fd != -1)
+        return 0;
+#if __linux__
+    poll->host_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (poll->host_fd < 0)
+        goto fail;
+    poll->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (poll->wakeup_fd < 0)
+        goto fail;
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(poll->host_fd, EPOLL_CTL_ADD, poll->wakeup_fd, &event) < 0)
+        goto fail;
+#else
+    poll->host_fd = kqueue();
+    if (poll->host_fd < 0)
+        goto fail;
+    struct kevent event;
+    EV_SET(&event, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+    if (kevent(poll->host_fd, &event, 1, NULL, 0, NULL) < 0)
+        goto fail;
+#endif
+    return 0;
+
+fail:;
+    int err = errno_map();
+    if (poll->host_fd != -1)
+        close(poll->host_fd);
+    if (poll->wakeup_fd != -1)
+        close(poll->wakeup_fd);
+    poll->host_fd = poll->wakeup_fd = -1;
+    return err;
+}
+
+static void host_poll_notify(struct poll *poll) {
+    if (poll->host_fd == -1)
+        return;
+#if __linux__
+    uint64_t one = 1;
+    write(poll->wakeup_fd, &one, sizeof(one));
+#else
+    struct kevent event;
+    EV_SET(&event, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+    kevent(poll->host_fd, &event, 1, NULL, 0, NULL);
+#endif
+}
+
+// Makes the host registration for a real fd match its types and flags. Fds the
+// host won't watch (epoll refuses regular files) are left unregistered, which
+// is fine since they're always ready and stay on the ready list.
+static void host_poll_update(struct poll *poll, struct poll_fd *poll_fd) {
+    int real_fd = poll_fd->fd->real_fd;
+#if __linux__
+    if (poll_fd->types == 0) {
+        if (poll_fd->host_registered)
+            epoll_ctl(poll->host_fd, EPOLL_CTL_DEL, real_fd, NULL);
+        poll_fd->host_registered = false;
+        return;
+    }
+    // the poll types have the same values as the epoll ones
+    struct epoll_event event = {.events = poll_fd->types, .data.ptr = poll_fd};
+    if (poll_fd->flags & POLL_EDGE_TRIGGERED)
+        event.events |= EPOLLET;
+    int op = poll_fd->host_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int err = epoll_ctl(poll->host_fd, op, real_fd, &event);
+    if (err < 0 && errno == EEXIST)
+        err = epoll_ctl(poll->host_fd, EPOLL_CTL_MOD, real_fd, &event);
+    poll_fd->host_registered = err == 0;
+#else
+    struct kevent events[2];
+    if (poll_fd->types == 0) {
+        if (poll_fd->host_registered) {
+            EV_SET(&events[0], real_fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+            EV_SET(&events[1], real_fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+            kevent(poll->host_fd, events, 2, NULL, 0, NULL);
+        }
+        poll_fd->host_registered = false;
+        return;
+    }
+    int flags = EV_ADD | (poll_fd->flags & POLL_EDGE_TRIGGERED ? EV_CLEAR : 0);
+    EV_SET(&events[0], real_fd, EVFILT_READ,
+            flags | (poll_fd->types & (POLL_READ | POLL_PRI) ? EV_ENABLE : EV_DISABLE), 0, 0, poll_fd);
+    EV_SET(&events[1], real_fd, EVFILT_WRITE,
+            flags | (poll_fd->types & POLL_WRITE ? EV_ENABLE : EV_DISABLE), 0, 0, poll_fd);
+    poll_fd->host_registered = kevent(poll->host_fd, events, 2, NULL, 0, NULL) == 0;
+#endif
+}
+
+// Returns the number of events, which are poll_fds or NULL for a wakeup.
+static int host_poll_wait(struct poll *poll, struct poll_fd **ready, int max, int timeout_millis) {
+#if __linux__
+    struct epoll_event events[max];
+    int count = epoll_wait(poll->host_fd, events, max, timeout_millis);
+    for (int i = 0; i < count; i++) {
+        ready[i] = events[i].data.ptr;
+        if (ready[i] == NULL) {
+            uint64_t value;
+            read(poll->wakeup_fd, &value, sizeof(value));
+        }
+    }
+#else
+    struct kevent events[max];
+    struct timespec timeout = {timeout_millis / 1000, (timeout_millis % 1000) * 1000000};
+    int count = kevent(poll->host_fd, NULL, 0, events, max, timeout_millis < 0 ? NULL : &timeout);
+    for (int i = 0; i < count; i++)
+        ready[i] = events[i].filter == EVFILT_USER ? NULL : events[i].udata;
+#endif
+    return count;
+}
+
+// After sockrestart replaces listening sockets with dup2, the old registrations
+// are gone along with the old sockets.
+static void host_poll_rearm(struct poll *poll) {
+    struct poll_fd *poll_fd;
+    list_for_each_entry(&poll->poll_fds, poll_fd, fds) {
+        if (poll_fd->host_registered) {
+            poll_fd->host_registered = false;
+            host_poll_update(poll, poll_fd);
+        }
+    }
+}
+
 // does not do its own locking
 static struct poll_fd *poll_find_fd(struct poll *poll, struct fd *fd) {
     struct poll_fd *poll_fd, *tmp;
@@ -34,6 +177,21 @@ static struct poll_fd *poll_find_fd(struct poll *poll, struct fd *fd) {
     return NULL;
 }
 
+static bool poll_contains(struct poll *poll, struct poll_fd *needle) {
+    struct poll_fd *poll_fd;
+    list_for_each_entry(&poll->poll_fds, poll_fd, fds) {
+        if (poll_fd == needle)
+            return true;
+    }
+    return false;
+}
+
+// needs the poll locked
+static void poll_fd_queue(struct poll_fd *poll_fd) {
+    if (poll_fd->types != 0 && list_null(&poll_fd->ready))
+        list_add_tail(&poll_fd->poll->ready, &poll_fd->ready);
+}
+
 bool poll_has_fd(struct poll *poll, struct fd *fd) {
     return poll_find_fd(poll, fd) != NULL;
 }
@@ -50,11 +208,28 @@ int poll_add_fd(struct poll *poll, struct fd *fd, int types, union poll_fd_info
     }
     poll_fd->fd = fd;
     poll_fd->poll = poll;
-    poll_fd->types = types;
+    poll_fd->types = types & ~POLL_FLAGS;
+    poll_fd->flags = types & POLL_FLAGS;
     poll_fd->info = info;
+    poll_fd->ready.next = poll_fd->ready.prev = NULL;
+    poll_fd->host_registered = false;
+    if (poll_fd_is_host(poll_fd)) {
+        err = host_poll_init(poll);
+        if (err < 0) {
+            free(poll_fd);
+            goto out;
+        }
+        host_poll_update(poll, poll_fd);
+    }
+    if (fd->ops == &socket_fdops)
+        poll->sockets++;
 
     list_add(&fd->poll_fds, &poll_fd->polls);
     list_add(&poll->poll_fds, &poll_fd->fds);
+    // it might already be ready, and nobody's going to tell us
+    poll_fd_queue(poll_fd);
+    if (poll->waiters > 0)
+        host_poll_notify(poll);
 
     err = 0;
 out:
@@ -63,6 +238,21 @@ out:
     return err;
 }
 
+void poll_fd_remove(struct poll_fd *poll_fd) {
+    struct poll *poll = poll_fd->poll;
+    if (poll_fd->host_registered) {
+        poll_fd->types = 0;
+        host_poll_update(poll, poll_fd);
+    }
+    if (poll_fd->fd->ops == &socket_fdops)
+        poll->sockets--;
+    list_remove(&poll_fd->polls);
+    list_remove(&poll_fd->fds);
+    list_remove_safe(&poll_fd->ready);
+    free(poll_fd);
+    poll->generation++;
+}
+
 int poll_del_fd(struct poll *poll, struct fd *fd) {
     int err;
     lock(&fd->poll_lock);
@@ -73,9 +263,7 @@ int poll_del_fd(struct poll *poll, struct fd *fd) {
         goto out;
     }
 
-    list_remove(&poll_fd->polls);
-    list_remove(&poll_fd->fds);
-    free(poll_fd);
+    poll_fd_remove(poll_fd);
 
     err = 0;
 out:
@@ -94,8 +282,15 @@ int poll_mod_fd(struct poll *poll, struct fd *fd, int types, union poll_fd_info
         goto out;
     }
 
-    poll_fd->types = types;
+    poll_fd->types = types & ~POLL_FLAGS;
+    poll_fd->flags = types & POLL_FLAGS;
     poll_fd->info = info;
+    if (poll_fd_is_host(poll_fd))
+        host_poll_update(poll, poll_fd);
+    // this also rearms a oneshot fd
+    poll_fd_queue(poll_fd);
+    if (poll->waiters > 0)
+        host_poll_notify(poll);
 
     err = 0;
 out:
@@ -110,114 +305,133 @@ void poll_wakeup(struct fd *fd) {
     list_for_each_entry(&fd->poll_fds, poll_fd, polls) {
         struct poll *poll = poll_fd->poll;
         lock(&poll->lock);
-        if (poll->notify_pipe[1] != -1)
-            write(poll->notify_pipe[1], "", 1);
+        poll_fd_queue(poll_fd);
+        if (poll->waiters > 0)
+            host_poll_notify(poll);
         unlock(&poll->lock);
     }
     unlock(&fd->poll_lock);
 }
 
+// Reports the fds on the ready list that still have events. Needs the poll
+// locked. O(ready) instead of O(fds).
+static int poll_report_ready(struct poll *poll, poll_callback_t callback, void *context) {
+    struct list pending;
+    list_init(&pending);
+    struct poll_fd *poll_fd, *tmp;
+    list_for_each_entry_safe(&poll->ready, poll_fd, tmp, ready) {
+        list_remove(&poll_fd->ready);
+        list_add_tail(&pending, &poll_fd->ready);
+    }
+
+    int res = 0;
+    list_for_each_entry_safe(&pending, poll_fd, tmp, ready) {
+        list_remove(&poll_fd->ready);
+        struct fd *fd = poll_fd->fd;
+        int types = 0;
+        if (fd->ops->poll)
+            types = fd->ops->poll(fd);
+        // POLLNVAL should only be returned by poll() when given a bad fd
+        assert(!(types & POLL_NVAL));
+        types &= poll_fd->types;
+        if (!types)
+            continue;
+        if (callback(context, types, poll_fd->info) != 1) {
+            poll_fd_queue(poll_fd);
+            continue;
+        }
+        res++;
+        if (poll_fd->flags & POLL_ONESHOT) {
+            poll_fd->types = 0;
+            if (poll_fd->host_registered)
+                host_poll_update(poll, poll_fd);
+        } else if (!(poll_fd->flags & POLL_EDGE_TRIGGERED)) {
+            poll_fd_queue(poll_fd);
+        }
+    }
+    return res;
+}
+
+#define HOST_EVENTS_MAX 64
+
 int poll_wait(struct poll *poll_, poll_callback_t callback, void *context, struct timespec *timeout) {
     lock(&poll_->lock);
-    if (poll_->waiters++ == 0) {
-        assert(poll_->notify_pipe[0] == -1 && poll_->notify_pipe[1] == -1);
-        if (pipe(poll_->notify_pipe) < 0) {
-            unlock(&poll_->lock);
-            return errno_map();
-        }
-        fcntl(poll_->notify_pipe[0], F_SETFL, O_NONBLOCK);
-        fcntl(poll_->notify_pipe[1], F_SETFL, O_NONBLOCK);
+    int res = host_poll_init(poll_);
+    if (res < 0) {
+        unlock(&poll_->lock);
+        return res;
     }
+    poll_->waiters++;
 
     // TODO this is pretty broken with regards to timeouts
-    int res = 0;
     while (true) {
         // check if any fds are ready
-        struct poll_fd *poll_fd;
-        list_for_each_entry(&poll_->poll_fds, poll_fd, fds) {
-            struct fd *fd = poll_fd->fd;
-            int poll_types = 0;
-            if (fd->ops->poll)
-                poll_types = fd->ops->poll(fd);
-            // POLLNVAL should only be returned by poll() when given a bad fd
-            assert(!(poll_types & POLL_NVAL));
-            poll_types &= poll_fd->types;
-            if (poll_types) {
-                if (callback(context, poll_types, poll_fd->info) == 1)
-                    res++;
-            }
-        }
+        res = poll_report_ready(poll_, callback, context);
         if (res > 0)
             break;
 
-        // wait for a ready notification
-        size_t pollfd_count = 1;
-        list_for_each_entry(&poll_->poll_fds, poll_fd, fds) {
-            if (poll_fd->fd->ops->poll == realfs_poll)
-                pollfd_count++;
-        }
-        struct pollfd pollfds[pollfd_count];
-        pollfds[0].fd = poll_->notify_pipe[0];
-        pollfds[0].events = POLLIN;
-        int i = 1;
-        list_for_each_entry(&poll_->poll_fds, poll_fd, fds) {
-            if (poll_fd->fd->ops->poll != realfs_poll)
-                continue;
-            pollfds[i].fd = poll_fd->fd->real_fd;
-            pollfds[i].events = poll_fd->types;
-            sockrestart_begin_listen_wait(poll_fd->fd);
-            i++;
-        }
-
+        // wait for a ready notification, either from poll_wakeup or from the
+        // host noticing a real fd
+        bool listening = poll_->sockets > 0;
+        if (listening)
+            sockrestart_begin_wait();
+        unsigned generation = poll_->generation;
         unlock(&poll_->lock);
         int timeout_millis = -1;
         if (timeout != NULL)
             timeout_millis = timeout->tv_sec * 1000 + timeout->tv_nsec / 1000000;
-        int err;
-        do {
-            err = poll(pollfds, pollfd_count, timeout_millis);
-        } while (sockrestart_should_restart_listen_wait() && errno == EINTR);
+        struct poll_fd *ready[HOST_EVENTS_MAX];
+        int count = host_poll_wait(poll_, ready, HOST_EVENTS_MAX, timeout_millis);
+        int saved_errno = errno;
         lock(&poll_->lock);
-        list_for_each_entry(&poll_->poll_fds, poll_fd, fds) {
-            sockrestart_end_listen_wait(poll_fd->fd);
+        if (listening)
+            sockrestart_end_wait();
+        if (count < 0 && saved_errno == EINTR && sockrestart_should_restart_listen_wait()) {
+            host_poll_rearm(poll_);
+            continue;
         }
-        if (err < 0) {
+        if (count < 0) {
+            errno = saved_errno;
             res = errno_map();
             break;
         }
-        if (err == 0)
+        if (count == 0)
             // timed out and still nobody is ready
             break;
 
-        if (pollfds[0].revents & POLLIN) {
-            char fuck;
-            if (read(poll_->notify_pipe[0], &fuck, 1) != 1) {
-                res = errno_map();
-                break;
-            }
+        // if anything was removed in the meantime the pointers can't be
+        // trusted without checking
+        bool stale = poll_->generation != generation;
+        for (int i = 0; i < count; i++) {
+            if (ready[i] == NULL || (stale && !poll_contains(poll_, ready[i])))
+                continue;
+            poll_fd_queue(ready[i]);
         }
     }
 
-    if (--poll_->waiters == 0) {
-        close(poll_->notify_pipe[0]);
-        close(poll_->notify_pipe[1]);
-        poll_->notify_pipe[0] = -1;
-        poll_->notify_pipe[1] = -1;
-    }
+    poll_->waiters--;
     unlock(&poll_->lock);
     return res;
 }
 
-void poll_destroy(struct poll *poll) {
+void poll_clear(struct poll *poll) {
     struct poll_fd *poll_fd;
     struct poll_fd *tmp;
     list_for_each_entry_safe(&poll->poll_fds, poll_fd, tmp, fds) {
-        lock(&poll_fd->fd->poll_lock);
-        list_remove(&poll_fd->polls);
-        list_remove(&poll_fd->fds);
-        unlock(&poll_fd->fd->poll_lock);
-        free(poll_fd);
+        struct fd *fd = poll_fd->fd;
+        lock(&fd->poll_lock);
+        lock(&poll->lock);
+        poll_fd_remove(poll_fd);
+        unlock(&poll->lock);
+        unlock(&fd->poll_lock);
     }
+}
 
+void poll_destroy(struct poll *poll) {
+    poll_clear(poll);
+    if (poll->host_fd != -1)
+        close(poll->host_fd);
+    if (poll->wakeup_fd != -1)
+        close(poll->wakeup_fd);
     free(poll);
 }
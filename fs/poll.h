@@ -4,7 +4,16 @@
 
 struct poll {
     struct list poll_fds;
-    int notify_pipe[2];
+    // fds that might have events, filled in by poll_wakeup and the host poll
+    struct list ready;
+    // bumped when a poll_fd is freed, so poll_wait knows to check the
+    // pointers it got from the host
+    unsigned generation;
+    // host epoll or kqueue with the real fds in it, and an eventfd for
+    // poll_wakeup (kqueue uses EVFILT_USER instead). -1 until first used.
+    int host_fd;
+    int wakeup_fd;
+    int sockets; // for sockrestart
     int waiters;
     lock_t lock;
 };
@@ -13,7 +22,10 @@ struct poll_fd {
     // locked by containing struct poll
     struct fd *fd;
     struct list fds;
-    int types;
+    int types; // zero for a oneshot fd that has fired
+    int flags; // POLL_EDGE_TRIGGERED, POLL_ONESHOT
+    struct list ready; // null if not on the ready list
+    bool host_registered;
     union poll_fd_info {
         void *ptr;
         int fd;
@@ -36,6 +48,10 @@ struct poll_fd {
 #define POLL_ERR 8
 #define POLL_HUP 16
 #define POLL_NVAL 32
+// flags, which can be passed in with the types
+#define POLL_ONESHOT (1 << 30)
+#define POLL_EDGE_TRIGGERED (1 << 31)
+#define POLL_FLAGS (POLL_ONESHOT | POLL_EDGE_TRIGGERED)
 struct poll_event {
     struct fd *fd;
     int types;
@@ -45,14 +61,22 @@ bool poll_has_fd(struct poll *poll, struct fd *fd);
 int poll_add_fd(struct poll *poll, struct fd *fd, int types, union poll_fd_info info);
 int poll_mod_fd(struct poll *poll, struct fd *fd, int types, union poll_fd_info info);
 int poll_del_fd(struct poll *poll, struct fd *fd);
+// frees the poll_fd, needs both the fd and the poll locked
+void poll_fd_remove(struct poll_fd *poll_fd);
 // please do not call this while holding any locks you would acquire in your poll operation
 void poll_wakeup(struct fd *fd);
 // Waits for events on the fds in this poll, and calls the callback for each one found.
 // Returns the number of times the callback returned 1, or negative for error.
+// Only fds on the ready list are checked. Level triggered fds stay on it after
+// being reported, edge triggered ones wait for the next poll_wakeup, and
+// oneshot ones are disabled until poll_mod_fd. If the callback returns 0 the
+// fd is kept for next time.
 typedef int (*poll_callback_t)(void *context, int types, union poll_fd_info info);
 int poll_wait(struct poll *poll, poll_callback_t callback, void *context, struct timespec *timeout);
-// does not lock the poll because lock ordering, you must ensure no other
+// these don't lock the poll because lock ordering, you must ensure no other
 // thread will add or remove fds from this poll
+// removes all the fds but keeps the host side, so the poll can be reused
+void poll_clear(struct poll *poll);
 void poll_destroy(struct poll *poll);
 
 #endif
@@ -155,6 +155,7 @@ static int proc_readdir(struct fd *fd, struct dir_entry *entry) {
         return 0;
     proc_entry_getname(&proc_entry, entry->name);
     entry->inode = 0;
+    entry->type = proc_entry_mode(&proc_entry) & S_IFMT;
     return 1;
 }
 
@@ -191,6 +192,7 @@ static ssize_t proc_readlink(struct mount *UNUSED(mount), const char *path, char
 
 const struct fs_ops procfs = {
     .name = "proc", .magic = 0x9fa0,
+    .dynamic = true,
     .open = proc_open,
     .getpath = proc_getpath,
     .stat = proc_stat,
@@ -1,7 +1,11 @@
 #include <sys/stat.h>
 #include <inttypes.h>
 #include "kernel/calls.h"
+#include "kernel/ipc.h"
+#include "kernel/random.h"
 #include "fs/proc.h"
+#include "fs/dcache.h"
+#include "emu/tlb.h"
 #include "platform/platform.h"
 
 static ssize_t proc_show_version(struct proc_entry *UNUSED(entry), char *buf) {
@@ -46,12 +50,92 @@ static int proc_readlink_self(struct proc_entry *UNUSED(entry), char *buf) {
     return 0;
 }
 
+static ssize_t proc_show_sysvipc_shm(struct proc_entry *UNUSED(entry), char *buf) {
+    return ipc_show_shm(buf, 4096);
+}
+
+static ssize_t proc_show_sysvipc_sem(struct proc_entry *UNUSED(entry), char *buf) {
+    return ipc_show_sem(buf, 4096);
+}
+
+struct proc_dir_entry proc_sysvipc_entries[] = {
+    {"shm", .show = proc_show_sysvipc_shm},
+    {"sem", .show = proc_show_sysvipc_sem},
+};
+
+static ssize_t proc_show_random_uuid(struct proc_entry *UNUSED(entry), char *buf) {
+    uint8_t uuid[16];
+    get_random((char *) uuid, sizeof(uuid));
+    uuid[6] = (uuid[6] & 0x0f) | 0x40;
+    uuid[8] = (uuid[8] & 0x3f) | 0x80;
+    return sprintf(buf, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x\n",
+            uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+            uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+}
+
+static ssize_t proc_show_random_entropy_avail(struct proc_entry *UNUSED(entry), char *buf) {
+    return sprintf(buf, "256\n");
+}
+
+static ssize_t proc_show_random_stats(struct proc_entry *UNUSED(entry), char *buf) {
+    size_t n = 0;
+    n += sprintf(buf + n, "bytes %"PRIu64"\n", random_stats.bytes);
+    n += sprintf(buf + n, "requests %"PRIu64"\n", random_stats.requests);
+    n += sprintf(buf + n, "reseeds %"PRIu64"\n", random_stats.reseeds);
+    n += sprintf(buf + n, "host_calls %"PRIu64"\n", random_stats.host_calls);
+    return n;
+}
+
+static ssize_t proc_show_vm_tlb_stats(struct proc_entry *UNUSED(entry), char *buf) {
+    size_t n = 0;
+    n += sprintf(buf + n, "hits %"PRIu64"\n", tlb_stats.hits);
+    n += sprintf(buf + n, "misses %"PRIu64"\n", tlb_stats.misses);
+    n += sprintf(buf + n, "flushes %"PRIu64"\n", tlb_stats.flushes);
+    n += sprintf(buf + n, "invalidations %"PRIu64"\n", tlb_stats.invalidations);
+    return n;
+}
+
+static ssize_t proc_show_fs_fakefs(struct proc_entry *UNUSED(entry), char *buf) {
+    return fakefs_show_stats(buf, 4096);
+}
+
+static ssize_t proc_show_fs_dcache(struct proc_entry *UNUSED(entry), char *buf) {
+    return dcache_show_stats(buf, 4096);
+}
+
+struct proc_dir_entry proc_fs_entries[] = {
+    {"dcache", .show = proc_show_fs_dcache},
+    {"fakefs", .show = proc_show_fs_fakefs},
+};
+
+struct proc_dir_entry proc_sys_kernel_random_entries[] = {
+    {"uuid", .show = proc_show_random_uuid},
+    {"entropy_avail", .show = proc_show_random_entropy_avail},
+    {"stats", .show = proc_show_random_stats},
+};
+
+struct proc_dir_entry proc_sys_kernel_entries[] = {
+    {"random", S_IFDIR, .children = proc_sys_kernel_random_entries, .children_sizeof = sizeof(proc_sys_kernel_random_entries)},
+};
+
+struct proc_dir_entry proc_sys_vm_entries[] = {
+    {"tlb_stats", .show = proc_show_vm_tlb_stats},
+};
+
+struct proc_dir_entry proc_sys_entries[] = {
+    {"kernel", S_IFDIR, .children = proc_sys_kernel_entries, .children_sizeof = sizeof(proc_sys_kernel_entries)},
+    {"vm", S_IFDIR, .children = proc_sys_vm_entries, .children_sizeof = sizeof(proc_sys_vm_entries)},
+};
+
 // in no particular order
 struct proc_dir_entry proc_root_entries[] = {
     {"version", .show = proc_show_version},
     {"stat", .show = proc_show_stat},
     {"meminfo", .show = proc_show_meminfo},
     {"self", S_IFLNK, .readlink = proc_readlink_self},
+    {"sysvipc", S_IFDIR, .children = proc_sysvipc_entries, .children_sizeof = sizeof(proc_sysvipc_entries)},
+    {"sys", S_IFDIR, .children = proc_sys_entries, .children_sizeof = sizeof(proc_sys_entries)},
+    {"fs", S_IFDIR, .children = proc_fs_entries, .children_sizeof = sizeof(proc_fs_entries)},
 };
 #define PROC_ROOT_LEN sizeof(proc_root_entries)/sizeof(proc_root_entries[0])
 
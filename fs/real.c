@@ -147,6 +147,52 @@ ssize_t realfs_write(struct fd *fd, const void *buf, size_t bufsize) {
     return res;
 }
 
+ssize_t realfs_readv(struct fd *fd, const struct iovec *iov, int iovcnt) {
+    ssize_t res = readv(fd->real_fd, iov, iovcnt);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+ssize_t realfs_writev(struct fd *fd, const struct iovec *iov, int iovcnt) {
+    ssize_t res = writev(fd->real_fd, iov, iovcnt);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+ssize_t realfs_pread(struct fd *fd, void *buf, size_t bufsize, off_t_ off) {
+    ssize_t res = pread(fd->real_fd, buf, bufsize, off);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+ssize_t realfs_pwrite(struct fd *fd, const void *buf, size_t bufsize, off_t_ off) {
+    ssize_t res = pwrite(fd->real_fd, buf, bufsize, off);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+ssize_t realfs_preadv(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off) {
+    ssize_t res = preadv(fd->real_fd, iov, iovcnt, off);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+ssize_t realfs_pwritev(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off) {
+    ssize_t res = pwritev(fd->real_fd, iov, iovcnt, off);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+int realfs_host_fd(struct fd *fd) {
+    return fd->real_fd;
+}
+
 static void realfs_opendir(struct fd *fd) {
     if (fd->dir == NULL) {
         int dirfd = dup(fd->real_fd);
@@ -167,6 +213,7 @@ int realfs_readdir(struct fd *fd, struct dir_entry *entry) {
             return 0;
     }
     entry->inode = dirent->d_ino;
+    entry->type = dirent->d_type == DT_UNKNOWN ? 0 : DTTOIF(dirent->d_type);
     strcpy(entry->name, dirent->d_name);
     return 1;
 }
@@ -416,6 +463,8 @@ int realfs_setflags(struct fd *fd, dword_t flags) {
 
 const struct fs_ops realfs = {
     .name = "real", .magic = 0x7265616c,
+    // the host can change anything in here
+    .dynamic = true,
     .mount = realfs_mount,
     .statfs = realfs_statfs,
 
@@ -443,6 +492,13 @@ const struct fs_ops realfs = {
 const struct fd_ops realfs_fdops = {
     .read = realfs_read,
     .write = realfs_write,
+    .readv = realfs_readv,
+    .writev = realfs_writev,
+    .pread = realfs_pread,
+    .pwrite = realfs_pwrite,
+    .preadv = realfs_preadv,
+    .pwritev = realfs_pwritev,
+    .host_fd = realfs_host_fd,
     .readdir = realfs_readdir,
     .telldir = realfs_telldir,
     .seekdir = realfs_seekdir,
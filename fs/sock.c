@@ -1,19 +1,32 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include "kernel/calls.h"
+#include "kernel/time.h"
+#include "util/timer.h"
 #include "fs/fd.h"
 #include "fs/sock.h"
 #include "debug.h"
 
 const struct fd_ops socket_fdops;
 
-static fd_t sock_fd_create(int sock_fd, int flags) {
+struct fd *sock_fd_new(int sock_fd) {
     struct fd *fd = adhoc_fd_create(&socket_fdops);
     if (fd == NULL)
-        return _ENOMEM;
+        return NULL;
     fd->stat.mode = S_IFSOCK | 0666;
     fd->real_fd = sock_fd;
+    return fd;
+}
+
+static fd_t sock_fd_create(int sock_fd, int flags) {
+    struct fd *fd = sock_fd_new(sock_fd);
+    if (fd == NULL)
+        return _ENOMEM;
     return f_install(fd, flags);
 }
 
@@ -58,7 +71,7 @@ static struct fd *sock_getfd(fd_t sock_fd) {
     return sock;
 }
 
-static int sockaddr_read(addr_t sockaddr_addr, void *sockaddr, size_t sockaddr_len) {
+int sockaddr_read(addr_t sockaddr_addr, void *sockaddr, size_t sockaddr_len) {
     if (user_read(sockaddr_addr, sockaddr, sockaddr_len))
         return _EFAULT;
     struct sockaddr *real_addr = sockaddr;
@@ -392,72 +405,202 @@ dword_t sys_getsockopt(fd_t sock_fd, dword_t level, dword_t option, addr_t value
     return 0;
 }
 
-dword_t sys_sendmsg(fd_t sock_fd, addr_t msghdr_addr, int_t flags) {
+// Translates a guest msghdr into a host one. The host iovecs point straight
+// into guest memory, unless the buffers are too fragmented to fit in a
+// user_iov, in which case the data goes through a bounce buffer.
+#define MSG_CONTROL_INLINE 256
+struct msg_buf {
+    struct msghdr_ fake;
+    struct user_iov uiov;
+    size_t size;
+    char *bounce;
+    char name[sizeof(struct sockaddr_storage)];
+    char control_inline[MSG_CONTROL_INLINE];
+    char *control;
+};
+
+// calls fn on each guest iovec in the message, without a malloc
+static int msg_for_each_iovec(struct msg_buf *mb, int (*fn)(struct msg_buf *mb, struct iovec_ *iov, void *arg), void *arg) {
+    struct iovec_ iovs[16];
+    for (uint_t i = 0; i < mb->fake.msg_iovlen; i += 16) {
+        uint_t n = mb->fake.msg_iovlen - i;
+        if (n > 16)
+            n = 16;
+        if (user_read(mb->fake.msg_iov + i * sizeof(struct iovec_), iovs, n * sizeof(struct iovec_)))
+            return _EFAULT;
+        for (uint_t j = 0; j < n; j++) {
+            int err = fn(mb, &iovs[j], arg);
+            if (err != 0)
+                return err;
+        }
+    }
+    return 0;
+}
+
+static int msg_iovec_add(struct msg_buf *mb, struct iovec_ *iov, void *arg) {
+    int type = *(int *) arg;
+    if (iov->len > INT32_MAX - mb->size)
+        return _EINVAL;
+    mb->size += iov->len;
+    if (mb->uiov.size + iov->len != mb->size)
+        return 0; // already too fragmented, just count
+    return user_iov_add(&mb->uiov, iov->base, iov->len, type);
+}
+
+struct msg_copy {
+    size_t done;
+    size_t size;
+    bool to_guest;
+};
+static int msg_iovec_copy(struct msg_buf *mb, struct iovec_ *iov, void *arg) {
+    struct msg_copy *copy = arg;
+    size_t size = copy->size - copy->done;
+    if (size > iov->len)
+        size = iov->len;
+    if (size == 0)
+        return 1;
     int err;
-    STRACE("sendmsg(%d, %#x, %d)", sock_fd, msghdr_addr, flags);
-    struct fd *sock = sock_getfd(sock_fd);
-    if (sock == NULL)
-        return _EBADF;
+    if (copy->to_guest)
+        err = user_write(iov->base, mb->bounce + copy->done, size);
+    else
+        err = user_read(iov->base, mb->bounce + copy->done, size);
+    if (err)
+        return _EFAULT;
+    copy->done += size;
+    return 0;
+}
 
-    struct msghdr msg;
-    struct msghdr_ msg_fake;
-    if (user_get(msghdr_addr, msg_fake))
+static int msg_bounce(struct msg_buf *mb, size_t size, bool to_guest) {
+    struct msg_copy copy = {.size = size, .to_guest = to_guest};
+    int err = msg_for_each_iovec(mb, msg_iovec_copy, &copy);
+    return err < 0 ? err : 0;
+}
+
+static void msg_release(struct msg_buf *mb) {
+    user_iov_put(&mb->uiov);
+    free(mb->bounce);
+    mb->bounce = NULL;
+    if (mb->control != mb->control_inline)
+        free(mb->control);
+    mb->control = NULL;
+}
+
+static int msg_prepare(struct msg_buf *mb, struct msghdr *msg, addr_t msghdr_addr, bool recv) {
+    user_iov_init(&mb->uiov);
+    mb->size = 0;
+    mb->bounce = NULL;
+    mb->control = NULL;
+    *msg = (struct msghdr) {};
+    if (user_get(msghdr_addr, mb->fake))
         return _EFAULT;
 
     // msg_name
-    char msg_name[msg_fake.msg_namelen];
-    if (msg_fake.msg_name != 0) {
-        int err = sockaddr_read(msg_fake.msg_name, msg_name, msg_fake.msg_namelen);
-        if (err < 0)
+    if (mb->fake.msg_name != 0) {
+        size_t namelen = mb->fake.msg_namelen;
+        if (namelen > sizeof(mb->name)) {
+            if (!recv)
+                return _EINVAL;
+            namelen = sizeof(mb->name);
+        }
+        if (!recv) {
+            int err = sockaddr_read(mb->fake.msg_name, mb->name, namelen);
+            if (err < 0)
+                return err;
+        }
+        msg->msg_name = mb->name;
+        msg->msg_namelen = namelen;
+    }
+
+    // msg_control
+    if (mb->fake.msg_control != 0 && mb->fake.msg_controllen != 0) {
+        mb->control = mb->control_inline;
+        if (mb->fake.msg_controllen > sizeof(mb->control_inline)) {
+            mb->control = malloc(mb->fake.msg_controllen);
+            if (mb->control == NULL)
+                return _ENOMEM;
+        }
+        if (!recv && user_read(mb->fake.msg_control, mb->control, mb->fake.msg_controllen))
+            return _EFAULT;
+        msg->msg_control = mb->control;
+        msg->msg_controllen = mb->fake.msg_controllen;
+    }
+
+    // msg_iov
+    if (mb->fake.msg_iovlen > UIO_MAXIOV_)
+        return _EMSGSIZE;
+    int type = recv ? MEM_WRITE : MEM_READ;
+    int err = msg_for_each_iovec(mb, msg_iovec_add, &type);
+    if (err < 0)
+        return err;
+    if (mb->uiov.size == mb->size) {
+        msg->msg_iov = mb->uiov.iov;
+        msg->msg_iovlen = mb->uiov.count;
+    } else {
+        user_iov_put(&mb->uiov);
+        mb->bounce = malloc(mb->size);
+        if (mb->bounce == NULL)
+            return _ENOMEM;
+        if (!recv && (err = msg_bounce(mb, mb->size, false)) < 0)
             return err;
-        msg.msg_name = msg_name;
-        msg.msg_namelen = msg_fake.msg_namelen;
+        mb->uiov.iov[0].iov_base = mb->bounce;
+        mb->uiov.iov[0].iov_len = mb->size;
+        msg->msg_iov = mb->uiov.iov;
+        msg->msg_iovlen = 1;
     }
+    return 0;
+}
 
-    // msg_iovec
-    struct iovec_ msg_iov_fake[msg_fake.msg_iovlen];
-    if (user_get(msg_fake.msg_iov, msg_iov_fake))
-        return _EFAULT;
-    struct iovec msg_iov[msg_fake.msg_iovlen];
-    memset(msg_iov, 0, sizeof(msg_iov));
-    msg.msg_iov = msg_iov;
-    msg.msg_iovlen = sizeof(msg_iov) / sizeof(msg_iov[0]);
-    for (int i = 0; i < msg.msg_iovlen; i++) {
-        msg_iov[i].iov_len = msg_iov_fake[i].len;
-        msg_iov[i].iov_base = malloc(msg_iov_fake[i].len);
-        err = _EFAULT;
-        if (user_read(msg_iov_fake[i].base, msg_iov[i].iov_base, msg_iov_fake[i].len))
-            goto out_free_iov;
+static int msg_finish_recv(struct msg_buf *mb, struct msghdr *msg, addr_t msghdr_addr, size_t res) {
+    if (mb->bounce != NULL) {
+        int err = msg_bounce(mb, res, true);
+        if (err < 0)
+            return err;
     }
 
-    // msg_control
-    char *msg_control = NULL;
-    if (msg_fake.msg_control != 0) {
-        msg_control = malloc(msg_fake.msg_controllen);
-        err = _EFAULT;
-        if (user_read(msg_fake.msg_control, msg_control, msg_fake.msg_controllen))
-            goto out_free_control;
+    // msg_name (changed)
+    if (mb->fake.msg_name != 0 && msg->msg_namelen > 0) {
+        size_t namelen = msg->msg_namelen;
+        if (namelen > (size_t) mb->fake.msg_namelen)
+            namelen = mb->fake.msg_namelen;
+        int err = sockaddr_write(mb->fake.msg_name, mb->name, namelen);
+        if (err < 0)
+            return err;
     }
-    msg.msg_control = msg_control;
-    msg.msg_controllen = msg_fake.msg_controllen;
+    mb->fake.msg_namelen = msg->msg_namelen;
+
+    // msg_control (changed)
+    if (mb->control != NULL)
+        if (user_write(mb->fake.msg_control, mb->control, msg->msg_controllen))
+            return _EFAULT;
+    mb->fake.msg_controllen = msg->msg_controllen;
+
+    // msg_flags (changed)
+    mb->fake.msg_flags = sock_flags_from_real(msg->msg_flags);
+
+    if (user_put(msghdr_addr, mb->fake))
+        return _EFAULT;
+    return 0;
+}
 
-    msg.msg_flags = sock_flags_to_real(msg_fake.msg_flags);
-    err = _EINVAL;
-    if (msg.msg_flags < 0)
-        goto out_free_control;
+dword_t sys_sendmsg(fd_t sock_fd, addr_t msghdr_addr, int_t flags) {
+    STRACE("sendmsg(%d, %#x, %d)", sock_fd, msghdr_addr, flags);
+    struct fd *sock = sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
     int real_flags = sock_flags_to_real(flags);
     if (real_flags < 0)
-        goto out_free_control;
+        return _EINVAL;
 
+    struct msg_buf mb;
+    struct msghdr msg;
+    int err = msg_prepare(&mb, &msg, msghdr_addr, false);
+    if (err < 0)
+        goto out;
     err = sendmsg(sock->real_fd, &msg, real_flags);
     if (err < 0)
         err = errno_map();
-
-out_free_control:
-    free(msg_control);
-out_free_iov:
-    for (int i = 0; i < msg.msg_iovlen; i++)
-        free(msg_iov[i].iov_base);
+out:
+    msg_release(&mb);
     return err;
 }
 
@@ -466,89 +609,240 @@ dword_t sys_recvmsg(fd_t sock_fd, addr_t msghdr_addr, int_t flags) {
     struct fd *sock = sock_getfd(sock_fd);
     if (sock == NULL)
         return _EBADF;
+    int real_flags = sock_flags_to_real(flags);
+    if (real_flags < 0)
+        return _EINVAL;
 
+    struct msg_buf mb;
     struct msghdr msg;
-    struct msghdr_ msg_fake;
-    if (user_get(msghdr_addr, msg_fake))
-        return _EFAULT;
+    ssize_t res = msg_prepare(&mb, &msg, msghdr_addr, true);
+    if (res < 0)
+        goto out;
+    res = recvmsg(sock->real_fd, &msg, real_flags);
+    if (res < 0) {
+        res = errno_map();
+        goto out;
+    }
+    int err = msg_finish_recv(&mb, &msg, msghdr_addr, res);
+    if (err < 0)
+        res = err;
+out:
+    msg_release(&mb);
+    return res;
+}
 
-    // msg_name
-    char msg_name[msg_fake.msg_namelen];
-    if (msg_fake.msg_name != 0) {
-        msg.msg_name = msg_name;
-        msg.msg_namelen = sizeof(msg_name);
-    } else {
-        msg.msg_name = NULL;
-        msg.msg_namelen = 0;
+// sendmmsg and recvmmsg go to the host this many messages at a time. The
+// msg_bufs are about 2k each, too big for the stack, so each call allocates
+// one batch's worth.
+#define MMSG_BATCH 32
+#ifndef __linux__
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned msg_len;
+};
+#endif
+
+static int host_sendmmsg(int sock, struct mmsghdr *msgs, unsigned count, int flags) {
+#ifdef __linux__
+    return sendmmsg(sock, msgs, count, flags);
+#else
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        ssize_t res = sendmsg(sock, &msgs[i].msg_hdr, flags);
+        if (res < 0)
+            return i > 0 ? (int) i : -1;
+        msgs[i].msg_len = res;
     }
+    return i;
+#endif
+}
 
-    // msg_control (no initial content)
-    char msg_control[msg_fake.msg_controllen];
-    msg.msg_control = msg_control;
-    msg.msg_controllen = sizeof(msg_control);
+static int host_recvmmsg(int sock, struct mmsghdr *msgs, unsigned count, int flags, bool wait_for_one, struct timespec *timeout) {
+#ifdef __linux__
+    if (wait_for_one)
+        flags |= MSG_WAITFORONE;
+    return recvmmsg(sock, msgs, count, flags, timeout);
+#else
+    struct timespec deadline;
+    if (timeout != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline = timespec_add(deadline, *timeout);
+    }
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        ssize_t res = recvmsg(sock, &msgs[i].msg_hdr, flags);
+        if (res < 0)
+            return i > 0 ? (int) i : -1;
+        msgs[i].msg_len = res;
+        if (wait_for_one)
+            flags |= MSG_DONTWAIT;
+        if (timeout != NULL) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (timespec_positive(timespec_subtract(now, deadline))) {
+                i++;
+                break;
+            }
+        }
+    }
+    return i;
+#endif
+}
 
+dword_t sys_sendmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, int_t flags) {
+    STRACE("sendmmsg(%d, %#x, %d, %d)", sock_fd, msgvec_addr, vlen, flags);
+    struct fd *sock = sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
     int real_flags = sock_flags_to_real(flags);
     if (real_flags < 0)
         return _EINVAL;
+    if (vlen > UIO_MAXIOV_)
+        vlen = UIO_MAXIOV_;
 
-    // msg_iovec (no initial content)
-    struct iovec_ msg_iov_fake[msg_fake.msg_iovlen];
-    if (user_get(msg_fake.msg_iov, msg_iov_fake))
-        return _EFAULT;
-    struct iovec msg_iov[msg_fake.msg_iovlen];
-    msg.msg_iov = msg_iov;
-    msg.msg_iovlen = sizeof(msg_iov) / sizeof(msg_iov[0]);
-    for (int i = 0; i < msg.msg_iovlen; i++) {
-        msg_iov[i].iov_len = msg_iov_fake[i].len;
-        msg_iov[i].iov_base = malloc(msg_iov_fake[i].len);
+    unsigned batch = vlen < MMSG_BATCH ? vlen : MMSG_BATCH;
+    if (batch == 0)
+        return 0;
+    struct msg_buf *mbs = malloc(sizeof(struct msg_buf) * batch);
+    if (mbs == NULL)
+        return _ENOMEM;
+    struct mmsghdr msgs[MMSG_BATCH];
+
+    uint_t sent = 0;
+    int err = 0;
+    while (sent < vlen && err == 0) {
+        unsigned count = 0;
+        while (count < batch && sent + count < vlen) {
+            addr_t addr = msgvec_addr + (sent + count) * sizeof(struct mmsghdr_);
+            err = msg_prepare(&mbs[count], &msgs[count].msg_hdr, addr, false);
+            if (err < 0) {
+                msg_release(&mbs[count]);
+                break;
+            }
+            count++;
+        }
+
+        int res = 0;
+        if (count > 0) {
+            res = host_sendmmsg(sock->real_fd, msgs, count, real_flags);
+            if (res < 0)
+                err = errno_map();
+        }
+        for (unsigned i = 0; i < count; i++)
+            msg_release(&mbs[i]);
+        for (int i = 0; i < res; i++) {
+            addr_t addr = msgvec_addr + (sent + i) * sizeof(struct mmsghdr_);
+            uint_t len = msgs[i].msg_len;
+            if (user_put(addr + offsetof(struct mmsghdr_, msg_len), len))
+                err = _EFAULT;
+        }
+        sent += res;
+        if ((unsigned) res < count && err == 0)
+            break;
     }
+    free(mbs);
+    if (sent == 0 && err < 0)
+        return err;
+    return sent;
+}
 
-    ssize_t res = recvmsg(sock->real_fd, &msg, real_flags);
-    // don't return error quite yet, there are outstanding mallocs
+dword_t sys_recvmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, int_t flags, addr_t timeout_addr) {
+    STRACE("recvmmsg(%d, %#x, %d, %d, %#x)", sock_fd, msgvec_addr, vlen, flags, timeout_addr);
+    struct fd *sock = sock_getfd(sock_fd);
+    if (sock == NULL)
+        return _EBADF;
+    bool wait_for_one = flags & MSG_WAITFORONE_;
+    int real_flags = sock_flags_to_real(flags & ~MSG_WAITFORONE_);
+    if (real_flags < 0)
+        return _EINVAL;
+    if (vlen > UIO_MAXIOV_)
+        vlen = UIO_MAXIOV_;
 
-    // msg_iovec (changed)
-    // copy as many bytes as were received, according to the return value
-    size_t n = res;
-    if (res < 0)
-        n = 0;
-    for (int i = 0; i < msg.msg_iovlen; i++) {
-        size_t chunk_size = msg_iov[i].iov_len;
-        if (chunk_size > n)
-            chunk_size = n;
-        if (chunk_size > 0)
-            if (user_write(msg_iov_fake[i].base, msg_iov[i].iov_base, chunk_size))
-                return _EFAULT;
-        n -= chunk_size;
-        free(msg_iov[i].iov_base);
+    struct timespec timeout, deadline;
+    if (timeout_addr != 0) {
+        struct timespec_ timeout_fake;
+        if (user_get(timeout_addr, timeout_fake))
+            return _EFAULT;
+        timeout.tv_sec = timeout_fake.sec;
+        timeout.tv_nsec = timeout_fake.nsec;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline = timespec_add(deadline, timeout);
     }
 
-    // by now the iovecs have been freed so we can return
-    if (res < 0)
-        return errno_map();
+    unsigned batch = vlen < MMSG_BATCH ? vlen : MMSG_BATCH;
+    if (batch == 0)
+        return 0;
+    struct msg_buf *mbs = malloc(sizeof(struct msg_buf) * batch);
+    if (mbs == NULL)
+        return _ENOMEM;
+    struct mmsghdr msgs[MMSG_BATCH];
+
+    uint_t received = 0;
+    int err = 0;
+    while (received < vlen && err == 0) {
+        unsigned count = 0;
+        while (count < batch && received + count < vlen) {
+            addr_t addr = msgvec_addr + (received + count) * sizeof(struct mmsghdr_);
+            err = msg_prepare(&mbs[count], &msgs[count].msg_hdr, addr, true);
+            if (err < 0) {
+                msg_release(&mbs[count]);
+                break;
+            }
+            count++;
+        }
 
-    // msg_name (changed)
-    if (msg.msg_name != 0) {
-        int err = sockaddr_write(msg_fake.msg_name, msg.msg_name, msg_fake.msg_namelen);
-        if (err < 0)
-            return err;
+        int res = 0;
+        if (count > 0) {
+            struct timespec remaining;
+            if (timeout_addr != 0) {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                remaining = timespec_subtract(deadline, now);
+                if (!timespec_positive(remaining))
+                    remaining = (struct timespec) {};
+            }
+            res = host_recvmmsg(sock->real_fd, msgs, count, real_flags,
+                    wait_for_one, timeout_addr != 0 ? &remaining : NULL);
+            if (res < 0) {
+                err = errno_map();
+                // later batches don't wait, so running out of messages is fine
+                if (received > 0 && err == _EAGAIN)
+                    err = 0;
+                res = 0;
+            }
+        }
+        for (int i = 0; i < res; i++) {
+            addr_t addr = msgvec_addr + (received + i) * sizeof(struct mmsghdr_);
+            int finish_err = msg_finish_recv(&mbs[i], &msgs[i].msg_hdr, addr, msgs[i].msg_len);
+            uint_t len = msgs[i].msg_len;
+            if (finish_err == 0 && user_put(addr + offsetof(struct mmsghdr_, msg_len), len))
+                finish_err = _EFAULT;
+            if (finish_err < 0)
+                err = finish_err;
+        }
+        for (unsigned i = 0; i < count; i++)
+            msg_release(&mbs[i]);
+        received += res;
+        if ((unsigned) res < count)
+            break;
+        if (wait_for_one && received > 0)
+            real_flags |= MSG_DONTWAIT;
     }
-    msg_fake.msg_namelen = msg.msg_namelen;
-
-    // msg_control (changed)
-    if (msg_fake.msg_controllen != 0)
-        if (user_write(msg_fake.msg_control, msg.msg_control, msg.msg_controllen))
+    free(mbs);
+
+    if (timeout_addr != 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec remaining = timespec_subtract(deadline, now);
+        if (!timespec_positive(remaining))
+            remaining = (struct timespec) {};
+        struct timespec_ timeout_fake = {.sec = remaining.tv_sec, .nsec = remaining.tv_nsec};
+        if (user_put(timeout_addr, timeout_fake))
             return _EFAULT;
-    msg_fake.msg_controllen = msg.msg_controllen;
-
-    // msg_flags (changed)
-    msg_fake.msg_flags = sock_flags_from_real(msg.msg_flags);
-
-    if (user_put(msghdr_addr, msg_fake))
-        return _EFAULT;
-
-    if (res < 0)
-        return errno_map();
-    return res;
+    }
+    if (received == 0 && err < 0)
+        return err;
+    return received;
 }
 
 static void sock_translate_err(struct fd *fd, int *err) {
@@ -576,6 +870,18 @@ static ssize_t sock_write(struct fd *fd, const void *buf, size_t size) {
     return err;
 }
 
+static ssize_t sock_readv(struct fd *fd, const struct iovec *iov, int iovcnt) {
+    int err = realfs_readv(fd, iov, iovcnt);
+    sock_translate_err(fd, &err);
+    return err;
+}
+
+static ssize_t sock_writev(struct fd *fd, const struct iovec *iov, int iovcnt) {
+    int err = realfs_writev(fd, iov, iovcnt);
+    sock_translate_err(fd, &err);
+    return err;
+}
+
 static int sock_close(struct fd *fd) {
     sockrestart_end_listen(fd);
     return realfs_close(fd);
@@ -584,6 +890,9 @@ static int sock_close(struct fd *fd) {
 const struct fd_ops socket_fdops = {
     .read = sock_read,
     .write = sock_write,
+    .readv = sock_readv,
+    .writev = sock_writev,
+    .host_fd = realfs_host_fd,
     .close = sock_close,
     .poll = realfs_poll,
     .getflags = realfs_getflags,
@@ -614,8 +923,8 @@ static struct socket_call {
     {(syscall_t) sys_sendmsg, 3},
     {(syscall_t) sys_recvmsg, 3},
     {NULL}, // accept4
-    {NULL}, // recvmmsg
-    {NULL}, // sendmmsg
+    {(syscall_t) sys_recvmmsg, 5},
+    {(syscall_t) sys_sendmmsg, 4},
 };
 
 dword_t sys_socketcall(dword_t call_num, addr_t args_addr) {
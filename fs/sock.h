@@ -9,12 +9,19 @@
 #include "debug.h"
 
 dword_t sys_socketcall(dword_t call_num, addr_t args_addr);
+dword_t sys_sendmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, int_t flags);
+dword_t sys_recvmmsg(fd_t sock_fd, addr_t msgvec_addr, uint_t vlen, int_t flags, addr_t timeout_addr);
 
 struct sockaddr_ {
     uint16_t family;
     char data[14];
 };
 
+// Wraps a host socket in an fd, without installing it
+struct fd *sock_fd_new(int sock_fd);
+// Reads a guest sockaddr and converts it to the host's format in place
+int sockaddr_read(addr_t sockaddr_addr, void *sockaddr, size_t sockaddr_len);
+
 size_t sockaddr_size(void *p);
 // result comes from malloc
 struct sockaddr *sockaddr_to_real(void *p);
@@ -29,6 +36,11 @@ struct msghdr_ {
     int_t msg_flags;
 };
 
+struct mmsghdr_ {
+    struct msghdr_ msg_hdr;
+    uint_t msg_len;
+};
+
 #define PF_LOCAL_ 1
 #define PF_INET_ 2
 #define PF_INET6_ 10
@@ -98,6 +110,7 @@ static inline int sock_type_to_real(int type, int protocol) {
 #define MSG_DONTWAIT_ 0x40
 #define MSG_EOR_    0x80
 #define MSG_WAITALL_ 0x100
+#define MSG_WAITFORONE_ 0x10000
 
 static inline int sock_flags_to_real(int fake) {
     int real = 0;
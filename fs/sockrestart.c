@@ -29,8 +29,10 @@ void sockrestart_end_listen(struct fd *sock) {
 
 static struct list listen_tasks = LIST_INITIALIZER(listen_tasks);
 
-void sockrestart_begin_listen_wait(struct fd *sock) {
-    if (sock->ops != &socket_fdops)
+// these can be called from io_uring workers, which have no current task and
+// can't be interrupted anyway
+void sockrestart_begin_wait() {
+    if (current == NULL)
         return;
     lock(&sockrestart_lock);
     if (current->sockrestart.count == 0)
@@ -39,8 +41,8 @@ void sockrestart_begin_listen_wait(struct fd *sock) {
     unlock(&sockrestart_lock);
 }
 
-void sockrestart_end_listen_wait(struct fd *sock) {
-    if (sock->ops != &socket_fdops)
+void sockrestart_end_wait() {
+    if (current == NULL)
         return;
     lock(&sockrestart_lock);
     current->sockrestart.count--;
@@ -49,7 +51,19 @@ void sockrestart_end_listen_wait(struct fd *sock) {
     unlock(&sockrestart_lock);
 }
 
+void sockrestart_begin_listen_wait(struct fd *sock) {
+    if (sock->ops == &socket_fdops)
+        sockrestart_begin_wait();
+}
+
+void sockrestart_end_listen_wait(struct fd *sock) {
+    if (sock->ops == &socket_fdops)
+        sockrestart_end_wait();
+}
+
 bool sockrestart_should_restart_listen_wait() {
+    if (current == NULL)
+        return false;
     lock(&sockrestart_lock);
     bool punt = current->sockrestart.punt;
     current->sockrestart.punt = false;
@@ -21,6 +21,9 @@ void sockrestart_end_listen(struct fd *sock);
 void sockrestart_begin_listen_wait(struct fd *sock);
 void sockrestart_end_listen_wait(struct fd *sock);
 bool sockrestart_should_restart_listen_wait(void);
+// for waiting on a set of fds that might include listening sockets
+void sockrestart_begin_wait(void);
+void sockrestart_end_wait(void);
 void sockrestart_on_suspend(void);
 void sockrestart_on_resume(void);
 
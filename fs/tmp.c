@@ -0,0 +1,1005 @@
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "kernel/calls.h"
+#include "kernel/errno.h"
+#include "kernel/fs.h"
+#include "kernel/ipc.h"
+#include "fs/dev.h"
+#include "fs/fd.h"
+#include "fs/poll.h"
+#include "util/hash.h"
+
+// tmpfs keeps everything in memory, for /tmp and other scratch space where
+// going through the host filesystem (and the fakefs database) for every file
+// is a waste. Directories are lists of dentries, with a hash table on top for
+// lookups. The data of a regular file lives in a host shared memory object
+// (see host_shm_create), created the first time the file gets any data, so
+// reading and writing is just a copy, and mmap hands the same pages to
+// pt_map. Everything except reading file data is protected by the mount's
+// lock.
+
+#define TMP_HASH_SIZE (1 << 12)
+// these have different values on darwin
+#define UTIME_NOW_ ((1l << 30) - 1)
+#define UTIME_OMIT_ ((1l << 30) - 2)
+
+struct tmp_inode {
+    ino_t number;
+    mode_t_ mode;
+    uid_t_ uid;
+    uid_t_ gid;
+    dev_t_ rdev;
+    unsigned nlink;
+    // number of fds open on it, it's freed when this and nlink are both 0
+    unsigned opens;
+    struct timespec atime;
+    struct timespec mtime;
+    struct timespec ctime;
+    // the dentry it was most recently linked as, for .. and getpath, or NULL
+    struct tmp_dentry *dentry;
+    union {
+        // directory
+        struct {
+            struct list children;
+            unsigned long next_pos;
+        };
+        // regular file
+        struct {
+            int data_fd; // -1 until there's data
+            off_t_ size;
+        };
+        // symlink
+        char *target;
+    };
+};
+
+struct tmp_dentry {
+    struct tmp_inode *dir;
+    // NULL for the cursors readdir leaves in the children list
+    struct tmp_inode *inode;
+    // the order it was added to the directory in, readdir offsets are based
+    // on this
+    unsigned long pos;
+    struct list siblings;
+    struct list chain;
+    unsigned hash;
+    char name[];
+};
+
+struct tmpfs {
+    lock_t lock;
+    struct tmp_inode *root;
+    ino_t next_inode;
+    dev_t_ dev;
+    uint64_t pages_used;
+    uint64_t pages_max;
+    uint64_t inodes;
+    struct list hash[TMP_HASH_SIZE];
+};
+
+static struct timespec tmp_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return now;
+}
+
+static uint64_t size_pages(off_t_ size) {
+    return (size + PAGE_SIZE - 1) / PAGE_SIZE;
+}
+
+static unsigned dentry_hash(struct tmp_inode *dir, const char *name) {
+    // mix in the directory so the same name in different directories
+    // doesn't land in the same bucket
+    return hash_str(HASH_INIT ^ (unsigned) dir->number, name);
+}
+
+static struct tmp_dentry *dir_lookup(struct tmpfs *fs, struct tmp_inode *dir, const char *name) {
+    unsigned hash = dentry_hash(dir, name);
+    struct tmp_dentry *dentry;
+    list_for_each_entry(&fs->hash[hash % TMP_HASH_SIZE], dentry, chain) {
+        if (dentry->hash == hash && dentry->dir == dir && strcmp(dentry->name, name) == 0)
+            return dentry;
+    }
+    return NULL;
+}
+
+static bool dir_is_empty(struct tmp_inode *dir) {
+    struct tmp_dentry *dentry;
+    list_for_each_entry(&dir->children, dentry, siblings) {
+        if (dentry->inode != NULL)
+            return false;
+    }
+    return true;
+}
+
+static struct tmp_inode *inode_new(struct tmpfs *fs, mode_t_ mode, dev_t_ rdev) {
+    struct tmp_inode *inode = calloc(1, sizeof(struct tmp_inode));
+    if (inode == NULL)
+        return NULL;
+    inode->number = fs->next_inode++;
+    inode->mode = mode;
+    inode->rdev = rdev;
+    if (current != NULL) {
+        inode->uid = current->euid;
+        inode->gid = current->egid;
+    }
+    inode->atime = inode->mtime = inode->ctime = tmp_now();
+    if (S_ISDIR(mode)) {
+        list_init(&inode->children);
+        // one for . and one for the dentry it's about to get
+        inode->nlink = 1;
+    } else if (S_ISREG(mode)) {
+        inode->data_fd = -1;
+    }
+    fs->inodes++;
+    return inode;
+}
+
+static void inode_try_free(struct tmpfs *fs, struct tmp_inode *inode) {
+    if (inode->nlink != 0 || inode->opens != 0)
+        return;
+    if (S_ISREG(inode->mode)) {
+        if (inode->data_fd >= 0)
+            close(inode->data_fd);
+        fs->pages_used -= size_pages(inode->size);
+    } else if (S_ISLNK(inode->mode)) {
+        free(inode->target);
+    }
+    fs->inodes--;
+    free(inode);
+}
+
+static int dentry_link(struct tmpfs *fs, struct tmp_inode *dir, const char *name, struct tmp_inode *inode) {
+    size_t name_size = strlen(name) + 1;
+    struct tmp_dentry *dentry = malloc(sizeof(struct tmp_dentry) + name_size);
+    if (dentry == NULL)
+        return _ENOMEM;
+    memcpy(dentry->name, name, name_size);
+    dentry->dir = dir;
+    dentry->inode = inode;
+    dentry->pos = dir->next_pos++;
+    dentry->hash = dentry_hash(dir, name);
+    list_add_tail(&dir->children, &dentry->siblings);
+    list_add(&fs->hash[dentry->hash % TMP_HASH_SIZE], &dentry->chain);
+
+    inode->nlink++;
+    if (S_ISDIR(inode->mode))
+        dir->nlink++;
+    inode->dentry = dentry;
+    inode->ctime = dir->mtime = dir->ctime = tmp_now();
+    return 0;
+}
+
+static void dentry_unlink(struct tmpfs *fs, struct tmp_dentry *dentry) {
+    struct tmp_inode *inode = dentry->inode;
+    struct tmp_inode *dir = dentry->dir;
+    list_remove(&dentry->siblings);
+    list_remove(&dentry->chain);
+    if (inode->dentry == dentry)
+        inode->dentry = NULL;
+    free(dentry);
+
+    inode->nlink--;
+    if (S_ISDIR(inode->mode)) {
+        dir->nlink--;
+        // if all that's left is . then it's gone
+        if (inode->nlink == 1)
+            inode->nlink = 0;
+    }
+    inode->ctime = dir->mtime = dir->ctime = tmp_now();
+    inode_try_free(fs, inode);
+}
+
+// Resolves everything but the last component of the path, returning the
+// directory it's in and pointing *name at the last component. Returns NULL if
+// the path is the root.
+static struct tmp_inode *walk_parent(struct tmpfs *fs, const char *path, const char **name) {
+    struct tmp_inode *dir = fs->root;
+    char component[NAME_MAX + 1];
+    while (*path == '/')
+        path++;
+    if (*path == '\0')
+        return NULL;
+    while (true) {
+        const char *end = path;
+        while (*end != '/' && *end != '\0')
+            end++;
+        if (end - path > NAME_MAX)
+            return ERR_PTR(_ENAMETOOLONG);
+        const char *next = end;
+        while (*next == '/')
+            next++;
+        if (*next == '\0') {
+            *name = path;
+            return dir;
+        }
+
+        memcpy(component, path, end - path);
+        component[end - path] = '\0';
+        struct tmp_dentry *dentry = dir_lookup(fs, dir, component);
+        if (dentry == NULL)
+            return ERR_PTR(_ENOENT);
+        if (!S_ISDIR(dentry->inode->mode))
+            return ERR_PTR(_ENOTDIR);
+        dir = dentry->inode;
+        path = next;
+    }
+}
+
+static struct tmp_inode *walk(struct tmpfs *fs, const char *path) {
+    const char *name;
+    struct tmp_inode *dir = walk_parent(fs, path, &name);
+    if (dir == NULL)
+        return fs->root;
+    if (IS_ERR(dir))
+        return dir;
+    struct tmp_dentry *dentry = dir_lookup(fs, dir, name);
+    if (dentry == NULL)
+        return ERR_PTR(_ENOENT);
+    return dentry->inode;
+}
+
+// Makes a new inode at path
+static struct tmp_inode *tmp_create(struct tmpfs *fs, const char *path, mode_t_ mode, dev_t_ rdev) {
+    const char *name;
+    struct tmp_inode *dir = walk_parent(fs, path, &name);
+    if (dir == NULL)
+        return ERR_PTR(_EEXIST);
+    if (IS_ERR(dir))
+        return dir;
+    if (dir_lookup(fs, dir, name) != NULL)
+        return ERR_PTR(_EEXIST);
+    struct tmp_inode *inode = inode_new(fs, mode, rdev);
+    if (inode == NULL)
+        return ERR_PTR(_ENOMEM);
+    int err = dentry_link(fs, dir, name, inode);
+    if (err < 0) {
+        inode_try_free(fs, inode);
+        return ERR_PTR(err);
+    }
+    return inode;
+}
+
+static int file_resize(struct tmpfs *fs, struct tmp_inode *inode, off_t_ size) {
+    uint64_t old_pages = size_pages(inode->size);
+    uint64_t new_pages = size_pages(size);
+    if (new_pages > old_pages && fs->pages_used + new_pages - old_pages > fs->pages_max)
+        return _ENOSPC;
+    if (inode->data_fd < 0 && size > 0) {
+        int data_fd = host_shm_create(size);
+        if (data_fd < 0)
+            return data_fd;
+        inode->data_fd = data_fd;
+    } else if (inode->data_fd >= 0 && ftruncate(inode->data_fd, size) < 0) {
+        return errno_map();
+    }
+    fs->pages_used = fs->pages_used - old_pages + new_pages;
+    inode->size = size;
+    inode->mtime = inode->ctime = tmp_now();
+    return 0;
+}
+
+static void copy_stat(struct tmpfs *fs, struct tmp_inode *inode, struct statbuf *stat) {
+    *stat = (struct statbuf) {};
+    stat->dev = fs->dev;
+    stat->inode = inode->number;
+    stat->mode = inode->mode;
+    stat->nlink = inode->nlink;
+    stat->uid = inode->uid;
+    stat->gid = inode->gid;
+    stat->rdev = inode->rdev;
+    if (S_ISREG(inode->mode))
+        stat->size = inode->size;
+    else if (S_ISLNK(inode->mode))
+        stat->size = strlen(inode->target);
+    stat->blksize = PAGE_SIZE;
+    stat->blocks = size_pages(stat->size) * (PAGE_SIZE / 512);
+    stat->atime = inode->atime.tv_sec;
+    stat->atime_nsec = inode->atime.tv_nsec;
+    stat->mtime = inode->mtime.tv_sec;
+    stat->mtime_nsec = inode->mtime.tv_nsec;
+    stat->ctime = inode->ctime.tv_sec;
+    stat->ctime_nsec = inode->ctime.tv_nsec;
+}
+
+static int inode_setattr(struct tmpfs *fs, struct tmp_inode *inode, struct attr attr) {
+    switch (attr.type) {
+        case attr_uid:
+            inode->uid = attr.uid;
+            break;
+        case attr_gid:
+            inode->gid = attr.gid;
+            break;
+        case attr_mode:
+            inode->mode = (inode->mode & S_IFMT) | (attr.mode & ~S_IFMT);
+            break;
+        case attr_size:
+            if (S_ISDIR(inode->mode))
+                return _EISDIR;
+            if (!S_ISREG(inode->mode))
+                return _EINVAL;
+            return file_resize(fs, inode, attr.size);
+    }
+    inode->ctime = tmp_now();
+    return 0;
+}
+
+static const struct fd_ops tmpfs_fdops;
+
+static struct fd *tmpfs_open(struct mount *mount, const char *path, int flags, int mode) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, path);
+    if (PTR_ERR(inode) == _ENOENT && flags & O_CREAT_)
+        inode = tmp_create(fs, path, S_IFREG | (mode & ~S_IFMT), 0);
+    else if (!IS_ERR(inode) && flags & O_CREAT_ && flags & O_EXCL_)
+        inode = ERR_PTR(_EEXIST);
+    if (IS_ERR(inode)) {
+        unlock(&fs->lock);
+        return (struct fd *) inode;
+    }
+    if (flags & O_TRUNC_ && flags & (O_WRONLY_ | O_RDWR_) && S_ISREG(inode->mode)) {
+        int err = file_resize(fs, inode, 0);
+        if (err < 0) {
+            unlock(&fs->lock);
+            return ERR_PTR(err);
+        }
+    }
+    struct fd *fd = fd_create(&tmpfs_fdops);
+    if (fd == NULL) {
+        unlock(&fs->lock);
+        return ERR_PTR(_ENOMEM);
+    }
+    fd->tmp_inode = inode;
+    fd->tmp_cursor = NULL;
+    inode->opens++;
+    unlock(&fs->lock);
+    return fd;
+}
+
+static int tmpfs_close(struct fd *fd) {
+    struct tmpfs *fs = fd->mount->data;
+    lock(&fs->lock);
+    if (fd->tmp_cursor != NULL) {
+        list_remove(&fd->tmp_cursor->siblings);
+        free(fd->tmp_cursor);
+    }
+    fd->tmp_inode->opens--;
+    inode_try_free(fs, fd->tmp_inode);
+    unlock(&fs->lock);
+    return 0;
+}
+
+static ssize_t tmpfs_readlink(struct mount *mount, const char *path, char *buf, size_t bufsize) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, path);
+    ssize_t res;
+    if (IS_ERR(inode)) {
+        res = PTR_ERR(inode);
+    } else if (!S_ISLNK(inode->mode)) {
+        res = _EINVAL;
+    } else {
+        res = strlen(inode->target);
+        if ((size_t) res > bufsize)
+            res = bufsize;
+        memcpy(buf, inode->target, res);
+    }
+    unlock(&fs->lock);
+    return res;
+}
+
+static int tmpfs_link(struct mount *mount, const char *src, const char *dst) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, src);
+    const char *name;
+    struct tmp_inode *dir = walk_parent(fs, dst, &name);
+    int err;
+    if (IS_ERR(inode))
+        err = PTR_ERR(inode);
+    else if (S_ISDIR(inode->mode))
+        err = _EPERM;
+    else if (dir == NULL)
+        err = _EEXIST;
+    else if (IS_ERR(dir))
+        err = PTR_ERR(dir);
+    else if (dir_lookup(fs, dir, name) != NULL)
+        err = _EEXIST;
+    else
+        err = dentry_link(fs, dir, name, inode);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int tmpfs_unlink(struct mount *mount, const char *path) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    const char *name;
+    struct tmp_inode *dir = walk_parent(fs, path, &name);
+    struct tmp_dentry *dentry = NULL;
+    int err = 0;
+    if (dir == NULL)
+        err = _EISDIR;
+    else if (IS_ERR(dir))
+        err = PTR_ERR(dir);
+    else if ((dentry = dir_lookup(fs, dir, name)) == NULL)
+        err = _ENOENT;
+    else if (S_ISDIR(dentry->inode->mode))
+        err = _EISDIR;
+    else
+        dentry_unlink(fs, dentry);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int tmpfs_rmdir(struct mount *mount, const char *path) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    const char *name;
+    struct tmp_inode *dir = walk_parent(fs, path, &name);
+    struct tmp_dentry *dentry = NULL;
+    int err = 0;
+    if (dir == NULL)
+        err = _EBUSY;
+    else if (IS_ERR(dir))
+        err = PTR_ERR(dir);
+    else if ((dentry = dir_lookup(fs, dir, name)) == NULL)
+        err = _ENOENT;
+    else if (!S_ISDIR(dentry->inode->mode))
+        err = _ENOTDIR;
+    else if (!dir_is_empty(dentry->inode))
+        err = _ENOTEMPTY;
+    else
+        dentry_unlink(fs, dentry);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int do_rename(struct tmpfs *fs, const char *src, const char *dst) {
+    const char *src_name, *dst_name;
+    struct tmp_inode *src_dir = walk_parent(fs, src, &src_name);
+    if (src_dir == NULL)
+        return _EBUSY;
+    if (IS_ERR(src_dir))
+        return PTR_ERR(src_dir);
+    struct tmp_dentry *src_dentry = dir_lookup(fs, src_dir, src_name);
+    if (src_dentry == NULL)
+        return _ENOENT;
+    struct tmp_inode *inode = src_dentry->inode;
+    struct tmp_inode *dst_dir = walk_parent(fs, dst, &dst_name);
+    if (dst_dir == NULL)
+        return _EBUSY;
+    if (IS_ERR(dst_dir))
+        return PTR_ERR(dst_dir);
+
+    struct tmp_dentry *dst_dentry = dir_lookup(fs, dst_dir, dst_name);
+    if (dst_dentry != NULL) {
+        struct tmp_inode *replaced = dst_dentry->inode;
+        if (replaced == inode)
+            return 0;
+        if (S_ISDIR(inode->mode) && !S_ISDIR(replaced->mode))
+            return _ENOTDIR;
+        if (!S_ISDIR(inode->mode) && S_ISDIR(replaced->mode))
+            return _EISDIR;
+        if (S_ISDIR(replaced->mode) && !dir_is_empty(replaced))
+            return _ENOTEMPTY;
+    }
+    // a directory can't be moved inside itself
+    if (S_ISDIR(inode->mode)) {
+        for (struct tmp_inode *d = dst_dir; d != NULL; d = d->dentry ? d->dentry->dir : NULL) {
+            if (d == inode)
+                return _EINVAL;
+        }
+    }
+
+    if (dst_dentry != NULL)
+        dentry_unlink(fs, dst_dentry);
+    // link the new name first so the inode doesn't get freed in between
+    int err = dentry_link(fs, dst_dir, dst_name, inode);
+    if (err < 0)
+        return err;
+    dentry_unlink(fs, src_dentry);
+    return 0;
+}
+
+static int tmpfs_rename(struct mount *mount, const char *src, const char *dst) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    int err = do_rename(fs, src, dst);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int tmpfs_symlink(struct mount *mount, const char *target, const char *link) {
+    struct tmpfs *fs = mount->data;
+    char *target_copy = strdup(target);
+    if (target_copy == NULL)
+        return _ENOMEM;
+    lock(&fs->lock);
+    struct tmp_inode *inode = tmp_create(fs, link, S_IFLNK | 0777, 0);
+    if (IS_ERR(inode)) {
+        unlock(&fs->lock);
+        free(target_copy);
+        return PTR_ERR(inode);
+    }
+    inode->target = target_copy;
+    unlock(&fs->lock);
+    return 0;
+}
+
+static int tmpfs_mknod(struct mount *mount, const char *path, mode_t_ mode, dev_t_ dev) {
+    // fifos and sockets would need somewhere to live outside the filesystem
+    if (!S_ISREG(mode) && !S_ISCHR(mode) && !S_ISBLK(mode))
+        return _EPERM;
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = tmp_create(fs, path, mode, S_ISREG(mode) ? 0 : dev);
+    unlock(&fs->lock);
+    if (IS_ERR(inode))
+        return PTR_ERR(inode);
+    return 0;
+}
+
+static int tmpfs_mkdir(struct mount *mount, const char *path, mode_t_ mode) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = tmp_create(fs, path, S_IFDIR | (mode & ~S_IFMT), 0);
+    unlock(&fs->lock);
+    if (IS_ERR(inode))
+        return PTR_ERR(inode);
+    return 0;
+}
+
+static int tmpfs_stat(struct mount *mount, const char *path, struct statbuf *stat, bool UNUSED(follow_links)) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, path);
+    if (!IS_ERR(inode))
+        copy_stat(fs, inode, stat);
+    unlock(&fs->lock);
+    if (IS_ERR(inode))
+        return PTR_ERR(inode);
+    return 0;
+}
+
+static int tmpfs_fstat(struct fd *fd, struct statbuf *stat) {
+    struct tmpfs *fs = fd->mount->data;
+    lock(&fs->lock);
+    copy_stat(fs, fd->tmp_inode, stat);
+    unlock(&fs->lock);
+    return 0;
+}
+
+static int tmpfs_setattr(struct mount *mount, const char *path, struct attr attr) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, path);
+    int err = IS_ERR(inode) ? PTR_ERR(inode) : inode_setattr(fs, inode, attr);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int tmpfs_fsetattr(struct fd *fd, struct attr attr) {
+    struct tmpfs *fs = fd->mount->data;
+    lock(&fs->lock);
+    int err = inode_setattr(fs, fd->tmp_inode, attr);
+    unlock(&fs->lock);
+    return err;
+}
+
+static int tmpfs_utime(struct mount *mount, const char *path, struct timespec atime, struct timespec mtime) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    struct tmp_inode *inode = walk(fs, path);
+    if (!IS_ERR(inode)) {
+        struct timespec now = tmp_now();
+        if (atime.tv_nsec != UTIME_OMIT_)
+            inode->atime = atime.tv_nsec == UTIME_NOW_ ? now : atime;
+        if (mtime.tv_nsec != UTIME_OMIT_)
+            inode->mtime = mtime.tv_nsec == UTIME_NOW_ ? now : mtime;
+        inode->ctime = now;
+    }
+    unlock(&fs->lock);
+    if (IS_ERR(inode))
+        return PTR_ERR(inode);
+    return 0;
+}
+
+static int tmpfs_getpath(struct fd *fd, char *buf) {
+    struct tmpfs *fs = fd->mount->data;
+    lock(&fs->lock);
+    // built backwards from the end of the buffer
+    char *start = buf + MAX_PATH - 1;
+    *start = '\0';
+    int err = 0;
+    for (struct tmp_inode *inode = fd->tmp_inode; inode != fs->root; inode = inode->dentry->dir) {
+        if (inode->dentry == NULL) {
+            err = _ENOENT;
+            break;
+        }
+        size_t name_len = strlen(inode->dentry->name);
+        if ((size_t) (start - buf) < name_len + 1) {
+            err = _ENAMETOOLONG;
+            break;
+        }
+        start -= name_len;
+        memcpy(start, inode->dentry->name, name_len);
+        *--start = '/';
+    }
+    unlock(&fs->lock);
+    if (err < 0)
+        return err;
+    memmove(buf, start, strlen(start) + 1);
+    return 0;
+}
+
+static int tmpfs_flock(struct fd *UNUSED(fd), int UNUSED(operation)) {
+    FIXME("flock on tmpfs");
+    return _ENOLCK;
+}
+
+static int tmpfs_statfs(struct mount *mount, struct statfsbuf *stat) {
+    struct tmpfs *fs = mount->data;
+    lock(&fs->lock);
+    *stat = (struct statfsbuf) {
+        .type = mount->fs->magic,
+        .bsize = PAGE_SIZE,
+        .frsize = PAGE_SIZE,
+        .blocks = fs->pages_max,
+        .bfree = fs->pages_max - fs->pages_used,
+        .bavail = fs->pages_max - fs->pages_used,
+        .files = fs->inodes,
+        .namelen = NAME_MAX,
+    };
+    unlock(&fs->lock);
+    return 0;
+}
+
+// Options are comma separated, size=bytes (with k, m, or g, or % of memory)
+// and mode=octal for the root directory. By default it can use half of
+// memory, like on Linux.
+static int parse_options(struct tmpfs *fs, const char *options) {
+    uint64_t memory = (uint64_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+    fs->pages_max = memory / 2 / PAGE_SIZE;
+    char *copy = strdup(options);
+    if (copy == NULL)
+        return _ENOMEM;
+    int err = 0;
+    char *rest = copy;
+    char *option;
+    while ((option = strsep(&rest, ",")) != NULL) {
+        if (*option == '\0')
+            continue;
+        char *end;
+        if (strncmp(option, "size=", 5) == 0) {
+            uint64_t size = strtoull(option + 5, &end, 10);
+            switch (*end) {
+                case 'k': case 'K': size <<= 10; end++; break;
+                case 'm': case 'M': size <<= 20; end++; break;
+                case 'g': case 'G': size <<= 30; end++; break;
+                case '%': size = memory / 100 * size; end++; break;
+            }
+            if (*end != '\0' || end == option + 5) {
+                err = _EINVAL;
+                break;
+            }
+            fs->pages_max = size_pages(size);
+        } else if (strncmp(option, "mode=", 5) == 0) {
+            mode_t_ mode = strtoul(option + 5, &end, 8);
+            if (*end != '\0' || end == option + 5) {
+                err = _EINVAL;
+                break;
+            }
+            fs->root->mode = S_IFDIR | (mode & 07777);
+        } else {
+            FIXME("tmpfs option %s", option);
+        }
+    }
+    free(copy);
+    return err;
+}
+
+static int tmpfs_mount(struct mount *mount) {
+    static unsigned mounts_count;
+    struct tmpfs *fs = malloc(sizeof(struct tmpfs));
+    if (fs == NULL)
+        return _ENOMEM;
+    lock_init(&fs->lock);
+    for (int i = 0; i < TMP_HASH_SIZE; i++)
+        list_init(&fs->hash[i]);
+    fs->next_inode = 1;
+    fs->pages_used = 0;
+    fs->inodes = 0;
+    // anonymous devices are major 0
+    fs->dev = dev_make(0, ++mounts_count);
+    fs->root = inode_new(fs, S_IFDIR | 01777, 0);
+    if (fs->root == NULL) {
+        free(fs);
+        return _ENOMEM;
+    }
+    fs->root->nlink = 2;
+    int err = parse_options(fs, mount->options);
+    if (err < 0) {
+        free(fs->root);
+        free(fs);
+        return err;
+    }
+    mount->data = fs;
+    return 0;
+}
+
+// Nothing is open at this point, so everything goes. A directory only has
+// the one dentry, other inodes can be hardlinked and are freed with the last.
+static void free_tree(struct tmp_inode *dir) {
+    struct tmp_dentry *dentry, *tmp;
+    list_for_each_entry_safe(&dir->children, dentry, tmp, siblings) {
+        struct tmp_inode *inode = dentry->inode;
+        free(dentry);
+        if (inode == NULL)
+            continue;
+        if (S_ISDIR(inode->mode)) {
+            free_tree(inode);
+        } else {
+            if (--inode->nlink > 0)
+                continue;
+            if (S_ISREG(inode->mode) && inode->data_fd >= 0)
+                close(inode->data_fd);
+            else if (S_ISLNK(inode->mode))
+                free(inode->target);
+        }
+        free(inode);
+    }
+}
+
+static int tmpfs_umount(struct mount *mount) {
+    // nothing can be open, since the mount can't be removed while it has
+    // references
+    struct tmpfs *fs = mount->data;
+    free_tree(fs->root);
+    free(fs->root);
+    free(fs);
+    return 0;
+}
+
+static ssize_t tmpfs_pread(struct fd *fd, void *buf, size_t bufsize, off_t_ off) {
+    struct tmpfs *fs = fd->mount->data;
+    struct tmp_inode *inode = fd->tmp_inode;
+    if (S_ISDIR(inode->mode))
+        return _EISDIR;
+    lock(&fs->lock);
+    off_t_ size = inode->size;
+    int data_fd = inode->data_fd;
+    inode->atime = tmp_now();
+    unlock(&fs->lock);
+    if (off >= size)
+        return 0;
+    if ((off_t_) bufsize > size - off)
+        bufsize = size - off;
+    // the data is only ever freed along with the inode, which can't happen
+    // while this fd is open, so it can be read without the lock
+    ssize_t res = pread(data_fd, buf, bufsize, off);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+static ssize_t file_write(struct fd *fd, const void *buf, size_t bufsize, off_t_ off, bool append, off_t_ *end) {
+    struct tmpfs *fs = fd->mount->data;
+    struct tmp_inode *inode = fd->tmp_inode;
+    if (S_ISDIR(inode->mode))
+        return _EISDIR;
+    if (bufsize == 0)
+        return 0;
+    lock(&fs->lock);
+    if (append)
+        off = inode->size;
+    ssize_t res = 0;
+    if (off + (off_t_) bufsize > inode->size)
+        res = file_resize(fs, inode, off + bufsize);
+    if (res >= 0) {
+        res = pwrite(inode->data_fd, buf, bufsize, off);
+        if (res < 0)
+            res = errno_map();
+        else
+            inode->mtime = inode->ctime = tmp_now();
+    }
+    unlock(&fs->lock);
+    if (res >= 0 && end != NULL)
+        *end = off + res;
+    return res;
+}
+
+static ssize_t tmpfs_pwrite(struct fd *fd, const void *buf, size_t bufsize, off_t_ off) {
+    return file_write(fd, buf, bufsize, off, false, NULL);
+}
+
+static ssize_t tmpfs_read(struct fd *fd, void *buf, size_t bufsize) {
+    lock(&fd->lock);
+    ssize_t res = tmpfs_pread(fd, buf, bufsize, fd->offset);
+    if (res > 0)
+        fd->offset += res;
+    unlock(&fd->lock);
+    return res;
+}
+
+static ssize_t tmpfs_write(struct fd *fd, const void *buf, size_t bufsize) {
+    lock(&fd->lock);
+    off_t_ end;
+    ssize_t res = file_write(fd, buf, bufsize, fd->offset, fd->flags & O_APPEND_, &end);
+    if (res >= 0)
+        fd->offset = end;
+    unlock(&fd->lock);
+    return res;
+}
+
+// called with fd->lock held
+static off_t_ tmpfs_lseek(struct fd *fd, off_t_ off, int whence) {
+    struct tmpfs *fs = fd->mount->data;
+    if (whence == LSEEK_CUR) {
+        off += fd->offset;
+    } else if (whence == LSEEK_END) {
+        lock(&fs->lock);
+        off += S_ISREG(fd->tmp_inode->mode) ? fd->tmp_inode->size : 0;
+        unlock(&fs->lock);
+    } else if (whence != LSEEK_SET) {
+        return _EINVAL;
+    }
+    if (off < 0)
+        return _EINVAL;
+    fd->offset = off;
+    return off;
+}
+
+// Offsets 0 and 1 are . and .., after that it's the pos of the next entry
+// plus 2. A cursor dentry in the directory's list remembers where the last
+// readdir left off, so a full listing doesn't go through the list over and
+// over, and entries being added or removed in the meantime don't confuse it.
+static int tmpfs_readdir(struct fd *fd, struct dir_entry *entry) {
+    struct tmpfs *fs = fd->mount->data;
+    struct tmp_inode *dir = fd->tmp_inode;
+    if (!S_ISDIR(dir->mode))
+        return _ENOTDIR;
+    if (fd->offset < 2) {
+        struct tmp_inode *inode = dir;
+        strcpy(entry->name, ".");
+        if (fd->offset == 1) {
+            lock(&fs->lock);
+            if (dir->dentry != NULL)
+                inode = dir->dentry->dir;
+            unlock(&fs->lock);
+            strcpy(entry->name, "..");
+        }
+        entry->inode = inode->number;
+        entry->type = S_IFDIR;
+        fd->offset++;
+        return 1;
+    }
+
+    lock(&fs->lock);
+    struct tmp_dentry *cursor = fd->tmp_cursor;
+    if (cursor == NULL) {
+        cursor = fd->tmp_cursor = calloc(1, sizeof(struct tmp_dentry) + 1);
+        if (cursor == NULL) {
+            unlock(&fs->lock);
+            return _ENOMEM;
+        }
+        cursor->dir = dir;
+    }
+    if (list_null(&cursor->siblings) || fd->offset != fd->tmp_cursor_offset) {
+        if (!list_null(&cursor->siblings))
+            list_remove(&cursor->siblings);
+        struct tmp_dentry *dentry;
+        list_for_each_entry(&dir->children, dentry, siblings) {
+            if (dentry->inode != NULL && dentry->pos + 2 >= fd->offset)
+                break;
+        }
+        list_add_before(&dentry->siblings, &cursor->siblings);
+    }
+
+    struct tmp_dentry *next = list_entry(cursor->siblings.next, struct tmp_dentry, siblings);
+    while (&next->siblings != &dir->children && next->inode == NULL)
+        next = list_entry(next->siblings.next, struct tmp_dentry, siblings);
+    if (&next->siblings == &dir->children) {
+        fd->tmp_cursor_offset = fd->offset;
+        unlock(&fs->lock);
+        return 0;
+    }
+    list_remove(&cursor->siblings);
+    list_add_after(&next->siblings, &cursor->siblings);
+    entry->inode = next->inode->number;
+    entry->type = next->inode->mode & S_IFMT;
+    strcpy(entry->name, next->name);
+    fd->offset = fd->tmp_cursor_offset = next->pos + 3;
+    unlock(&fs->lock);
+    return 1;
+}
+
+static int tmpfs_mmap(struct fd *fd, struct mem *mem, page_t start, pages_t pages, off_t offset, int prot, int flags) {
+    if (pages == 0)
+        return 0;
+    struct tmpfs *fs = fd->mount->data;
+    struct tmp_inode *inode = fd->tmp_inode;
+    if (!S_ISREG(inode->mode))
+        return _ENODEV;
+    lock(&fs->lock);
+    off_t_ size = inode->size;
+    int data_fd = inode->data_fd;
+    unlock(&fs->lock);
+
+    // only the pages that are in the file can come from it
+    pages_t file_pages = 0;
+    if (data_fd >= 0 && offset < size)
+        file_pages = size_pages(size - offset) < pages ? size_pages(size - offset) : pages;
+    if (file_pages > 0) {
+        int mmap_flags = flags & MMAP_SHARED ? MAP_SHARED : MAP_PRIVATE;
+        int mmap_prot = PROT_READ;
+        if (prot & P_WRITE) mmap_prot |= PROT_WRITE;
+        off_t real_offset = (offset / real_page_size) * real_page_size;
+        off_t correction = offset - real_offset;
+        char *memory = mmap(NULL, (file_pages * PAGE_SIZE) + correction,
+                mmap_prot, mmap_flags, data_fd, real_offset);
+        if (memory == MAP_FAILED)
+            return errno_map();
+        memory += correction;
+        int err = pt_map(mem, start, file_pages, memory, prot | (flags & MMAP_SHARED ? P_SHARED : 0));
+        if (err < 0) {
+            munmap(memory - correction, (file_pages * PAGE_SIZE) + correction);
+            return err;
+        }
+    }
+    return pt_map_nothing(mem, start + file_pages, pages - file_pages, prot);
+}
+
+static int tmpfs_fsync(struct fd *UNUSED(fd)) {
+    return 0;
+}
+
+// regular files never block, same as on a real disk
+static int tmpfs_poll(struct fd *UNUSED(fd)) {
+    return POLL_READ | POLL_WRITE;
+}
+
+const struct fs_ops tmpfs = {
+    .name = "tmpfs", .magic = 0x01021994,
+    .mount = tmpfs_mount,
+    .umount = tmpfs_umount,
+    .statfs = tmpfs_statfs,
+
+    .open = tmpfs_open,
+    .readlink = tmpfs_readlink,
+    .link = tmpfs_link,
+    .unlink = tmpfs_unlink,
+    .rmdir = tmpfs_rmdir,
+    .rename = tmpfs_rename,
+    .symlink = tmpfs_symlink,
+    .mknod = tmpfs_mknod,
+    .mkdir = tmpfs_mkdir,
+
+    .close = tmpfs_close,
+    .stat = tmpfs_stat,
+    .fstat = tmpfs_fstat,
+    .setattr = tmpfs_setattr,
+    .fsetattr = tmpfs_fsetattr,
+    .utime = tmpfs_utime,
+    .getpath = tmpfs_getpath,
+    .flock = tmpfs_flock,
+};
+
+static const struct fd_ops tmpfs_fdops = {
+    .read = tmpfs_read,
+    .write = tmpfs_write,
+    .pread = tmpfs_pread,
+    .pwrite = tmpfs_pwrite,
+    .lseek = tmpfs_lseek,
+    .readdir = tmpfs_readdir,
+    .mmap = tmpfs_mmap,
+    .poll = tmpfs_poll,
+    .fsync = tmpfs_fsync,
+    .close = tmpfs_close,
+};
@@ -2,6 +2,7 @@
 #include "debug.h"
 #include <string.h>
 #include "kernel/calls.h"
+#include "kernel/init.h"
 #include "fs/poll.h"
 #include "fs/tty.h"
 
@@ -387,6 +388,7 @@ static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
             err = _EAGAIN;
             if (fd->flags & O_NONBLOCK_)
                 goto out;
+            boot_ready();
             err = wait_for(&tty->produced, &tty->lock, NULL);
             if (err < 0)
                 goto out;
@@ -416,6 +418,7 @@ static ssize_t tty_read(struct fd *fd, void *buf, size_t bufsize) {
             err = _EAGAIN;
             if (fd->flags & O_NONBLOCK_)
                 goto out;
+            boot_ready();
             // there should be no timeout for the first character read
             err = wait_for(&tty->produced, &tty->lock, tty->bufsize == 0 ? NULL : timeout_ptr);
             if (err == _ETIMEDOUT)
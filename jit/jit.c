@@ -155,7 +155,6 @@ void cpu_run(struct cpu_state *cpu) {
 
     int i = 0;
     read_wrlock(&cpu->mem->lock);
-    unsigned changes = cpu->mem->changes;
 
     while (true) {
         addr_t ip = frame.cpu.eip;
@@ -202,11 +201,7 @@ void cpu_run(struct cpu_state *cpu) {
 
             jit = cpu->mem->jit;
             last_block = NULL;
-            tlb.mem = cpu->mem;
-            if (cpu->mem->changes != changes) {
-                tlb_flush(&tlb);
-                changes = cpu->mem->changes;
-            }
+            tlb_refresh(&tlb, cpu->mem);
             memset(cache, 0, sizeof(cache));
             frame.cpu = *cpu;
             frame.last_block = NULL;
@@ -218,10 +213,9 @@ void cpu_run(struct cpu_state *cpu) {
 
 void cpu_run(struct cpu_state *cpu) {
     int i = 0;
-    struct tlb tlb = {.mem = cpu->mem};
-    tlb_flush(&tlb);
+    struct tlb tlb;
+    tlb_init(&tlb, cpu->mem);
     read_wrlock(&cpu->mem->lock);
-    int changes = cpu->mem->changes;
     while (true) {
         int interrupt = cpu_step32(cpu, &tlb);
         if (interrupt == INT_NONE && i++ >= 100000) {
@@ -233,12 +227,7 @@ void cpu_run(struct cpu_state *cpu) {
             read_wrunlock(&cpu->mem->lock);
             handle_interrupt(interrupt);
             read_wrlock(&cpu->mem->lock);
-            if (tlb.mem != cpu->mem)
-                tlb.mem = cpu->mem;
-            if (cpu->mem->changes != changes) {
-                tlb_flush(&tlb);
-                changes = cpu->mem->changes;
-            }
+            tlb_refresh(&tlb, cpu->mem);
         }
     }
 }
@@ -2,7 +2,7 @@
 #include "kernel/calls.h"
 #include "emu/interrupt.h"
 
-#define NUM_SYSCALLS 400
+#define NUM_SYSCALLS 450
 
 dword_t syscall_stub() {
     return _ENOSYS;
@@ -11,7 +11,7 @@ dword_t syscall_success_stub() {
     return 0;
 }
 
-syscall_t syscall_table[] = {
+syscall_t syscall_table[NUM_SYSCALLS] = {
     [1]   = (syscall_t) sys_exit,
     [2]   = (syscall_t) sys_fork,
     [3]   = (syscall_t) sys_read,
@@ -34,7 +34,7 @@ syscall_t syscall_table[] = {
     [25]  = (syscall_t) sys_stime,
     [29]  = (syscall_t) sys_pause,
     [33]  = (syscall_t) sys_access,
-    [36]  = (syscall_t) syscall_success_stub, // sync
+    [36]  = (syscall_t) sys_sync,
     [37]  = (syscall_t) sys_kill,
     [38]  = (syscall_t) sys_rename,
     [39]  = (syscall_t) sys_mkdir,
@@ -76,6 +76,7 @@ syscall_t syscall_table[] = {
     [104] = (syscall_t) sys_setitimer,
     [114] = (syscall_t) sys_wait4,
     [116] = (syscall_t) sys_sysinfo,
+    [117] = (syscall_t) sys_ipc,
     [118] = (syscall_t) sys_fsync,
     [120] = (syscall_t) sys_clone,
     [122] = (syscall_t) sys_uname,
@@ -101,6 +102,7 @@ syscall_t syscall_table[] = {
     [176] = (syscall_t) sys_rt_sigpending,
     [179] = (syscall_t) sys_rt_sigsuspend,
     [180] = (syscall_t) sys_pread,
+    [181] = (syscall_t) sys_pwrite,
     [183] = (syscall_t) sys_getcwd,
     [184] = (syscall_t) sys_capget,
     [185] = (syscall_t) sys_capset,
@@ -163,6 +165,9 @@ syscall_t syscall_table[] = {
     [307] = (syscall_t) sys_faccessat,
     [308] = (syscall_t) sys_pselect,
     [309] = (syscall_t) sys_ppoll,
+    [313] = (syscall_t) sys_splice,
+    [315] = (syscall_t) sys_tee,
+    [316] = (syscall_t) sys_vmsplice,
     [319] = (syscall_t) sys_epoll_pwait,
     [320] = (syscall_t) sys_utimensat,
     [322] = (syscall_t) sys_timerfd_create,
@@ -171,10 +176,24 @@ syscall_t syscall_table[] = {
     [328] = (syscall_t) sys_eventfd2,
     [329] = (syscall_t) sys_epoll_create,
     [331] = (syscall_t) sys_pipe2,
+    [333] = (syscall_t) sys_preadv,
+    [334] = (syscall_t) sys_pwritev,
+    [337] = (syscall_t) sys_recvmmsg,
     [340] = (syscall_t) sys_prlimit,
+    [344] = (syscall_t) sys_syncfs,
+    [345] = (syscall_t) sys_sendmmsg,
     [353] = (syscall_t) sys_renameat2,
     [355] = (syscall_t) sys_getrandom,
     [377] = (syscall_t) sys_copy_file_range,
+    [393] = (syscall_t) sys_semget,
+    [394] = (syscall_t) sys_semctl,
+    [395] = (syscall_t) sys_shmget,
+    [396] = (syscall_t) sys_shmctl,
+    [397] = (syscall_t) sys_shmat,
+    [398] = (syscall_t) sys_shmdt,
+    [425] = (syscall_t) sys_io_uring_setup,
+    [426] = (syscall_t) sys_io_uring_enter,
+    [427] = (syscall_t) sys_io_uring_register,
 };
 
 void handle_interrupt(int interrupt) {
@@ -1,6 +1,7 @@
 #ifndef CALLS_H
 #define CALLS_H
 
+#include <sys/uio.h>
 #include "kernel/task.h"
 #include "kernel/errno.h"
 #include "fs/fd.h"
@@ -20,7 +21,30 @@ int must_check user_write(addr_t addr, const void *buf, size_t count);
 int must_check user_read_task(struct task *task, addr_t addr, void *buf, size_t count);
 int must_check user_write_task(struct task *task, addr_t addr, const void *buf, size_t count);
 int must_check user_read_string(addr_t addr, char *buf, size_t max);
+// Copy a string of at most max bytes including the terminator. Returns the
+// length, _EFAULT, or _ENAMETOOLONG if there was no terminator.
+ssize_t must_check user_copy_string(addr_t addr, char *buf, size_t max);
 int must_check user_write_string(addr_t addr, const char *buf);
+
+// Guest buffers resolved to the host memory behind them
+#define USER_IOV_MAX 64
+struct user_iov {
+    struct iovec iov[USER_IOV_MAX];
+    struct data *data[USER_IOV_MAX];
+    int count;
+    size_t size; // can be short if the buffer is too fragmented
+};
+// Resolve a guest buffer to host iovecs, merging pages that are contiguous in
+// host memory. With MEM_WRITE, COW is broken and compiled code is thrown out
+// for each page up front. The memory stays alive until user_iov_put, even if
+// the guest unmaps it. Returns _EFAULT if any page isn't accessible.
+int must_check user_iov_get(struct user_iov *uiov, addr_t addr, size_t size, int type);
+// Same but for building up a list of buffers. Start with user_iov_init, and
+// call user_iov_put even if this fails.
+void user_iov_init(struct user_iov *uiov);
+int must_check user_iov_add(struct user_iov *uiov, addr_t addr, size_t size, int type);
+void user_iov_put(struct user_iov *uiov);
+
 #define user_get(addr, var) user_read(addr, &(var), sizeof(var))
 #define user_put(addr, var) user_write(addr, &(var), sizeof(var))
 #define user_get_task(task, addr, var) user_read_task(task, addr, &(var), sizeof(var))
@@ -54,7 +78,7 @@ addr_t sys_mmap(struct mmap_arg_struct *args);
 addr_t sys_mmap2(addr_t addr, dword_t len, dword_t prot, dword_t flags, fd_t fd_no, dword_t offset);
 int_t sys_munmap(addr_t addr, uint_t len);
 int_t sys_mprotect(addr_t addr, uint_t len, int_t prot);
-int_t sys_mremap(addr_t addr, dword_t old_len, dword_t new_len, dword_t flags);
+int_t sys_mremap(addr_t addr, dword_t old_len, dword_t new_len, dword_t flags, addr_t new_addr);
 dword_t sys_madvise(addr_t addr, dword_t len, dword_t advice);
 dword_t sys_mbind(addr_t addr, dword_t len, int_t mode, addr_t nodemask, dword_t maxnode, uint_t flags);
 int_t sys_mlock(addr_t addr, dword_t len);
@@ -68,19 +92,25 @@ struct iovec_ {
     addr_t base;
     uint_t len;
 };
+#define UIO_MAXIOV_ 1024
 dword_t sys_read(fd_t fd_no, addr_t buf_addr, dword_t size);
 dword_t sys_readv(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count);
 dword_t sys_write(fd_t fd_no, addr_t buf_addr, dword_t size);
 dword_t sys_writev(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count);
 dword_t sys__llseek(fd_t f, dword_t off_high, dword_t off_low, addr_t res_addr, dword_t whence);
 dword_t sys_lseek(fd_t f, dword_t off, dword_t whence);
-dword_t sys_pread(fd_t f, addr_t buf_addr, dword_t buf_size, off_t_ off);
+dword_t sys_pread(fd_t f, addr_t buf_addr, dword_t buf_size, dword_t off_low, dword_t off_high);
+dword_t sys_pwrite(fd_t f, addr_t buf_addr, dword_t buf_size, dword_t off_low, dword_t off_high);
+dword_t sys_preadv(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t off_low, dword_t off_high);
+dword_t sys_pwritev(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t off_low, dword_t off_high);
 dword_t sys_ioctl(fd_t f, dword_t cmd, dword_t arg);
 dword_t sys_fcntl64(fd_t f, dword_t cmd, dword_t arg);
 dword_t sys_dup(fd_t fd);
 dword_t sys_dup2(fd_t fd, fd_t new_fd);
 dword_t sys_close(fd_t fd);
 dword_t sys_fsync(fd_t f);
+dword_t sys_sync(void);
+dword_t sys_syncfs(fd_t f);
 dword_t sys_flock(fd_t fd, dword_t operation);
 int_t sys_pipe(addr_t pipe_addr);
 int_t sys_pipe2(addr_t pipe_addr, int_t flags);
@@ -145,6 +175,9 @@ dword_t sys_umask(dword_t mask);
 dword_t sys_sendfile(fd_t out_fd, fd_t in_fd, addr_t offset_addr, dword_t count);
 dword_t sys_sendfile64(fd_t out_fd, fd_t in_fd, addr_t offset_addr, dword_t count);
 dword_t sys_copy_file_range(fd_t in_fd, addr_t in_off, fd_t out_fd, addr_t out_off, dword_t len, uint_t flags);
+dword_t sys_splice(fd_t in_fd, addr_t in_off, fd_t out_fd, addr_t out_off, dword_t len, uint_t flags);
+dword_t sys_tee(fd_t in_fd, fd_t out_fd, dword_t len, uint_t flags);
+dword_t sys_vmsplice(fd_t fd, addr_t iovec_addr, dword_t iovec_count, uint_t flags);
 
 dword_t sys_statfs64(addr_t path_addr, addr_t buf_addr);
 dword_t sys_fstatfs64(fd_t f, addr_t buf_addr);
@@ -226,6 +259,22 @@ dword_t sys_sysinfo(addr_t info_addr);
 
 // futexes
 
+// sysv ipc
+int_t sys_ipc(uint_t call, int_t first, int_t second, int_t third, addr_t ptr, int_t fifth);
+int_t sys_shmget(int_t key, uint_t size, int_t flags);
+addr_t sys_shmat(int_t id, addr_t addr, int_t flags);
+int_t sys_shmdt(addr_t addr);
+int_t sys_shmctl(int_t id, int_t cmd, addr_t buf_addr);
+int_t sys_semget(int_t key, int_t nsems, int_t flags);
+int_t sys_semop(int_t id, addr_t sops_addr, uint_t nsops);
+int_t sys_semtimedop(int_t id, addr_t sops_addr, uint_t nsops, addr_t timeout_addr);
+int_t sys_semctl(int_t id, int_t num, int_t cmd, dword_t arg);
+
+// io_uring
+dword_t sys_io_uring_setup(uint_t entries, addr_t params_addr);
+dword_t sys_io_uring_enter(fd_t f, uint_t to_submit, uint_t min_complete, uint_t flags, addr_t sig_addr);
+dword_t sys_io_uring_register(fd_t f, uint_t opcode, addr_t arg, uint_t nr_args);
+
 // misc
 dword_t sys_futex(addr_t uaddr, dword_t op, dword_t val, addr_t timeout_or_val2, addr_t uaddr2, dword_t val3);
 dword_t sys_getrandom(addr_t buf_addr, dword_t len, dword_t flags);
@@ -26,8 +26,8 @@ struct epoll_event_ {
 #define EPOLL_CTL_ADD_ 1
 #define EPOLL_CTL_DEL_ 2
 #define EPOLL_CTL_MOD_ 3
-#define EPOLLET_ (1 << 31)
-#define EPOLLONESHOT_ (1 << 30)
+#define EPOLLEXCLUSIVE_ (1 << 28)
+#define EPOLLWAKEUP_ (1 << 29)
 
 int_t sys_epoll_ctl(fd_t epoll_f, int_t op, fd_t f, addr_t event_addr) {
     STRACE("epoll_ctl(%d, %d, %d, %#x)", epoll_f, op, f, event_addr);
@@ -47,7 +47,16 @@ int_t sys_epoll_ctl(fd_t epoll_f, int_t op, fd_t f, addr_t event_addr) {
     if (user_get(event_addr, event))
         return _EFAULT;
     STRACE(" {events: %#x, data: %#x}", event.events, event.data);
-    if (event.events & (EPOLLET_|EPOLLONESHOT_))
+    // EPOLLET and EPOLLONESHOT have the same values as the poll flags.
+    // exclusive wakeups only matter with multiple waiters, so accept it on add
+    // and ignore it. Linux doesn't let it be changed later.
+    if (event.events & EPOLLEXCLUSIVE_ && op != EPOLL_CTL_ADD_)
+        return _EINVAL;
+    // wakeup is about suspend
+    event.events &= ~(EPOLLEXCLUSIVE_|EPOLLWAKEUP_);
+    // errors and hangups are always reported
+    event.events |= POLL_ERR|POLL_HUP;
+    if (fd == epoll)
         return _EINVAL;
 
     if (op == EPOLL_CTL_ADD_) {
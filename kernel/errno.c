@@ -47,6 +47,8 @@ int err_map(int err) {
         ERRCASE(ENOSYS)
         ERRCASE(ENOTEMPTY)
         ERRCASE(ELOOP)
+        ERRCASE(ENOMSG)
+        ERRCASE(EIDRM)
         ERRCASE(ENOSTR)
         ERRCASE(ENODATA)
         ERRCASE(ETIME)
@@ -89,6 +91,7 @@ int err_map(int err) {
         ERRCASE(EINPROGRESS)
         ERRCASE(ESTALE)
         ERRCASE(EDQUOT)
+        ERRCASE(ECANCELED)
     }
 #undef ERRCASE
     debugger;
@@ -16,7 +16,6 @@
 #include "kernel/vdso.h"
 
 static inline dword_t align_stack(dword_t sp);
-static inline ssize_t user_strlen(dword_t p);
 static inline int user_memset(addr_t start, byte_t val, dword_t len);
 static inline dword_t copy_string(dword_t sp, const char *string);
 static inline dword_t copy_strings(dword_t sp, const char *strings);
@@ -333,19 +332,24 @@ static int elf_exec(struct fd *fd, const char *file, const char *argv, const cha
     p += sizeof(dword_t);
 
     // argv
+    // the strings on the stack are copies of ours, so measure ours instead
+    const char *args = argv;
     while (argc-- > 0) {
         if (user_put(p, argv_addr))
             return _EFAULT;
-        argv_addr += user_strlen(argv_addr) + 1;
+        argv_addr += strlen(args) + 1;
+        args += strlen(args) + 1;
         p += sizeof(dword_t); // null terminator
     }
     p += sizeof(dword_t); // null terminator
 
     // envp
+    args = envp;
     while (envc-- > 0) {
         if (user_put(p, envp_addr))
             return _EFAULT;
-        envp_addr += user_strlen(envp_addr) + 1;
+        envp_addr += strlen(args) + 1;
+        args += strlen(args) + 1;
         p += sizeof(dword_t);
     }
     p += sizeof(dword_t); // null terminator
@@ -417,17 +421,6 @@ static inline dword_t copy_strings(addr_t sp, const char *strings) {
     return sp;
 }
 
-static inline ssize_t user_strlen(addr_t p) {
-    size_t i = 0;
-    char c;
-    do {
-        if (user_get(p + i, c))
-            return -1;
-        i++;
-    } while (c != '\0');
-    return i - 1;
-}
-
 static inline int user_memset(addr_t start, byte_t val, dword_t len) {
     while (len--)
         if (user_put(start++, val))
@@ -597,17 +590,14 @@ static int user_read_string_array(addr_t addr, char *buf, size_t max) {
             return _EFAULT;
         if (str_addr == 0)
             break;
-        size_t str_p = 0;
-        for (;;) {
-            if (p >= max)
-                return _E2BIG;
-            if (user_get(str_addr + str_p, buf[p]))
-                return _EFAULT;
-            str_p++;
-            p++;
-            if (buf[p - 1] == '\0')
-                break;
-        }
+        if (p >= max)
+            return _E2BIG;
+        ssize_t len = user_copy_string(str_addr, buf + p, max - p);
+        if (len == _ENAMETOOLONG)
+            return _E2BIG;
+        if (len < 0)
+            return len;
+        p += len + 1;
         i++;
     }
     if (p >= max)
@@ -3,6 +3,7 @@
 #include "kernel/calls.h"
 #include "kernel/mm.h"
 #include "kernel/futex.h"
+#include "kernel/ipc.h"
 #include "fs/fd.h"
 #include "fs/tty.h"
 
@@ -40,6 +41,7 @@ noreturn void do_exit(int status) {
     }
 
     // release all our resources
+    exit_sem(current);
     mm_release(current->mm);
     fdtable_release(current->files);
     fs_info_release(current->fs);
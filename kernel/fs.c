@@ -1,6 +1,12 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#endif
 #include "debug.h"
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include "kernel/calls.h"
 #include "kernel/errno.h"
 #include "kernel/task.h"
@@ -177,106 +183,201 @@ dword_t sys_mknod(addr_t path_addr, mode_t_ mode, dev_t_ dev) {
     return generic_mknod(path, mode, dev);
 }
 
-dword_t sys_read(fd_t fd_no, addr_t buf_addr, dword_t size) {
-    STRACE("read(%d, 0x%x, %d)", fd_no, buf_addr, size);
+static struct iovec_ *read_iovecs(addr_t iovec_addr, dword_t iovec_count) {
+    if (iovec_count > UIO_MAXIOV_)
+        return ERR_PTR(_EINVAL);
+    struct iovec_ *iovecs = malloc(sizeof(struct iovec_) * iovec_count);
+    if (iovecs == NULL)
+        return ERR_PTR(_ENOMEM);
+    if (user_read(iovec_addr, iovecs, sizeof(struct iovec_) * iovec_count)) {
+        free(iovecs);
+        return ERR_PTR(_EFAULT);
+    }
+    dword_t total = 0;
+    for (unsigned i = 0; i < iovec_count; i++) {
+        if (iovecs[i].len > INT32_MAX - total) {
+            free(iovecs);
+            return ERR_PTR(_EINVAL);
+        }
+        total += iovecs[i].len;
+    }
+    return iovecs;
+}
+
+// Resolve all the buffers into host memory. Returns 1 if they all fit, 0 if
+// the caller has to fall back to copying. That includes buffers with
+// unmapped pages, since a short read might never get to them, and the copy
+// only faults on what it actually touches.
+static int iovecs_get(struct user_iov *uiov, struct iovec_ *iovecs, unsigned count, int type) {
+    user_iov_init(uiov);
+    size_t total = 0;
+    for (unsigned i = 0; i < count; i++) {
+        int err = user_iov_add(uiov, iovecs[i].base, iovecs[i].len, type);
+        if (err < 0) {
+            user_iov_put(uiov);
+            return 0;
+        }
+        total += iovecs[i].len;
+        if (uiov->size != total) {
+            user_iov_put(uiov);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static ssize_t fd_read_copy(struct fd *fd, addr_t buf_addr, size_t size) {
     char *buf = (char *) malloc(size+1);
     if (buf == NULL)
         return _ENOMEM;
-    int_t res = 0;
-    struct fd *fd = f_get(fd_no);
-    if (fd == NULL || fd->ops->read == NULL) {
-        res = _EBADF;
-        goto out;
-    }
-    if (S_ISDIR(fd->type)) {
-        res = _EISDIR;
-        goto out;
-    }
-    res = fd->ops->read(fd, buf, size);
+    ssize_t res = fd->ops->read(fd, buf, size);
     if (res >= 0) {
         buf[res] = '\0';
         STRACE(" \"%.99s\"", buf);
         if (user_write(buf_addr, buf, res))
             res = _EFAULT;
     }
-out:
     free(buf);
     return res;
 }
 
-dword_t sys_readv(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count) {
-    dword_t iovec_size = sizeof(struct iovec_) * iovec_count;
-    struct iovec_ *iovecs = malloc(iovec_size);
-    if (iovecs == NULL)
-        return _ENOMEM;
-    int res = 0;
-    if (user_read(iovec_addr, iovecs, iovec_size)) {
-        res = _EFAULT;
-        goto err;
-    }
-    dword_t count = 0;
-    for (unsigned i = 0; i < iovec_count; i++) {
-        res = sys_read(fd_no, iovecs[i].base, iovecs[i].len);
-        if (res < 0)
-            goto err;
-        count += res;
-        if ((unsigned) res < iovecs[i].len)
-            break;
-    }
-    free(iovecs);
-    return count;
-
-err:
-    free(iovecs);
-    return res;
-}
-
-dword_t sys_write(fd_t fd_no, addr_t buf_addr, dword_t size) {
+static ssize_t fd_write_copy(struct fd *fd, addr_t buf_addr, size_t size) {
     // FIXME this is a DOS vector
     char *buf = malloc(size + 1);
     if (buf == NULL)
         return _ENOMEM;
-    dword_t res = 0;
-    if (user_read(buf_addr, buf, size)) {
-        res = _EFAULT;
+    ssize_t res = _EFAULT;
+    if (user_read(buf_addr, buf, size))
         goto out;
-    }
     buf[size] = '\0';
-    STRACE("write(%d, \"%.100s\", %d)", fd_no, buf, size);
-    struct fd *fd = f_get(fd_no);
-    if (fd == NULL || fd->ops->write == NULL) {
-        res = _EBADF;
-        goto out;
-    }
+    STRACE(" \"%.100s\"", buf);
     res = fd->ops->write(fd, buf, size);
 out:
     free(buf);
     return res;
 }
 
-dword_t sys_writev(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count) {
-    dword_t iovec_size = sizeof(struct iovec_) * iovec_count;
-    struct iovec_ *iovecs = malloc(iovec_size);
-    if (iovecs == NULL)
-        return _ENOMEM;
-    int res = 0;
-    if (user_read(iovec_addr, iovecs, iovec_size)) {
-        res = _EFAULT;
-        goto err;
+// Do the whole list with one call to the fd's readv/writev if it has one,
+// otherwise go through a buffer one iovec at a time.
+static ssize_t fd_readv(struct fd *fd, struct iovec_ *iovecs, unsigned count) {
+    if (fd->ops->readv != NULL) {
+        struct user_iov uiov;
+        int err = iovecs_get(&uiov, iovecs, count, MEM_WRITE);
+        if (err < 0)
+            return err;
+        if (err == 1) {
+            ssize_t res = fd->ops->readv(fd, uiov.iov, uiov.count);
+            if (res > 0 && uiov.count > 0) {
+                size_t shown = (size_t) res < uiov.iov[0].iov_len ? (size_t) res : uiov.iov[0].iov_len;
+                STRACE(" \"%.*s\"", shown < 99 ? (int) shown : 99, (char *) uiov.iov[0].iov_base);
+            }
+            user_iov_put(&uiov);
+            return res;
+        }
     }
-    dword_t count = 0;
-    for (unsigned i = 0; i < iovec_count; i++) {
-        res = sys_write(fd_no, iovecs[i].base, iovecs[i].len);
+
+    ssize_t total = 0;
+    for (unsigned i = 0; i < count; i++) {
+        ssize_t res = fd_read_copy(fd, iovecs[i].base, iovecs[i].len);
+        if (res < 0)
+            return total > 0 ? total : res;
+        total += res;
+        if ((size_t) res < iovecs[i].len)
+            break;
+    }
+    return total;
+}
+
+static ssize_t fd_writev(struct fd *fd, struct iovec_ *iovecs, unsigned count) {
+    if (fd->ops->writev != NULL) {
+        struct user_iov uiov;
+        int err = iovecs_get(&uiov, iovecs, count, MEM_READ);
+        if (err < 0)
+            return err;
+        if (err == 1) {
+            if (uiov.count > 0)
+                STRACE(" \"%.*s\"", uiov.iov[0].iov_len < 100 ? (int) uiov.iov[0].iov_len : 100, (char *) uiov.iov[0].iov_base);
+            ssize_t res = fd->ops->writev(fd, uiov.iov, uiov.count);
+            user_iov_put(&uiov);
+            return res;
+        }
+    }
+
+    ssize_t total = 0;
+    for (unsigned i = 0; i < count; i++) {
+        ssize_t res = fd_write_copy(fd, iovecs[i].base, iovecs[i].len);
         if (res < 0)
-            goto err;
-        count += res;
-        if ((unsigned) res < iovecs[i].len)
+            return total > 0 ? total : res;
+        total += res;
+        if ((size_t) res < iovecs[i].len)
             break;
     }
+    return total;
+}
+
+static struct fd *fd_for_read(fd_t fd_no, int *err) {
+    struct fd *fd = f_get(fd_no);
+    *err = _EBADF;
+    if (fd == NULL || fd->ops->read == NULL)
+        return NULL;
+    *err = _EISDIR;
+    if (S_ISDIR(fd->type))
+        return NULL;
+    return fd;
+}
+
+static struct fd *fd_for_write(fd_t fd_no, int *err) {
+    struct fd *fd = f_get(fd_no);
+    *err = _EBADF;
+    if (fd == NULL || fd->ops->write == NULL)
+        return NULL;
+    return fd;
+}
+
+dword_t sys_read(fd_t fd_no, addr_t buf_addr, dword_t size) {
+    STRACE("read(%d, 0x%x, %d)", fd_no, buf_addr, size);
+    int err;
+    struct fd *fd = fd_for_read(fd_no, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ iovec = {buf_addr, size};
+    return fd_readv(fd, &iovec, 1);
+}
+
+dword_t sys_readv(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count) {
+    STRACE("readv(%d, %#x, %d)", fd_no, iovec_addr, iovec_count);
+    int err;
+    struct fd *fd = fd_for_read(fd_no, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ *iovecs = read_iovecs(iovec_addr, iovec_count);
+    if (IS_ERR(iovecs))
+        return PTR_ERR(iovecs);
+    ssize_t res = fd_readv(fd, iovecs, iovec_count);
     free(iovecs);
-    return count;
+    return res;
+}
 
-err:
+dword_t sys_write(fd_t fd_no, addr_t buf_addr, dword_t size) {
+    STRACE("write(%d, 0x%x, %d)", fd_no, buf_addr, size);
+    int err;
+    struct fd *fd = fd_for_write(fd_no, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ iovec = {buf_addr, size};
+    return fd_writev(fd, &iovec, 1);
+}
+
+dword_t sys_writev(fd_t fd_no, addr_t iovec_addr, dword_t iovec_count) {
+    STRACE("writev(%d, %#x, %d)", fd_no, iovec_addr, iovec_count);
+    int err;
+    struct fd *fd = fd_for_write(fd_no, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ *iovecs = read_iovecs(iovec_addr, iovec_count);
+    if (IS_ERR(iovecs))
+        return PTR_ERR(iovecs);
+    ssize_t res = fd_writev(fd, iovecs, iovec_count);
     free(iovecs);
     return res;
 }
@@ -310,26 +411,175 @@ dword_t sys_lseek(fd_t f, dword_t off, dword_t whence) {
     return res;
 }
 
-dword_t sys_pread(fd_t f, addr_t buf_addr, dword_t size, off_t_ off) {
-    STRACE("pread(%d, 0x%x, %d, %d)", f, buf_addr, size, off);
-    struct fd *fd = f_get(f);
-    if (fd == NULL)
-        return _EBADF;
-    char *buf = malloc(size+1);
-    if (buf == NULL)
-        return _EFAULT;
-    lock(&fd->lock);
-    int_t res = fd->ops->lseek(fd, off, LSEEK_SET);
-    if (res < 0)
-        goto out;
-    res = fd->ops->read(fd, buf, size);
-    if (res >= 0) {
-        if (user_write(buf_addr, buf, res))
+// Positional io. Files that can do it natively don't need the lock and leave
+// the file position alone, everything else gets a seek first.
+static ssize_t fd_pread_native(struct fd *fd, struct iovec_ *iovecs, unsigned count, off_t_ off) {
+    struct user_iov uiov;
+    int err = iovecs_get(&uiov, iovecs, count, MEM_WRITE);
+    if (err < 0)
+        return err;
+    ssize_t total = 0;
+    if (err == 1 && fd->ops->preadv != NULL) {
+        total = fd->ops->preadv(fd, uiov.iov, uiov.count, off);
+        user_iov_put(&uiov);
+        return total;
+    }
+    if (err == 1) {
+        for (int i = 0; i < uiov.count; i++) {
+            ssize_t res = fd->ops->pread(fd, uiov.iov[i].iov_base, uiov.iov[i].iov_len, off + total);
+            if (res < 0) {
+                if (total == 0)
+                    total = res;
+                break;
+            }
+            total += res;
+            if ((size_t) res < uiov.iov[i].iov_len)
+                break;
+        }
+        user_iov_put(&uiov);
+        return total;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        char *buf = malloc(iovecs[i].len + 1);
+        if (buf == NULL)
+            return total > 0 ? total : _ENOMEM;
+        ssize_t res = fd->ops->pread(fd, buf, iovecs[i].len, off + total);
+        if (res >= 0 && user_write(iovecs[i].base, buf, res))
             res = _EFAULT;
+        free(buf);
+        if (res < 0)
+            return total > 0 ? total : res;
+        total += res;
+        if ((size_t) res < iovecs[i].len)
+            break;
     }
-out:
+    return total;
+}
+
+static ssize_t fd_pwrite_native(struct fd *fd, struct iovec_ *iovecs, unsigned count, off_t_ off) {
+    struct user_iov uiov;
+    int err = iovecs_get(&uiov, iovecs, count, MEM_READ);
+    if (err < 0)
+        return err;
+    ssize_t total = 0;
+    if (err == 1 && fd->ops->pwritev != NULL) {
+        total = fd->ops->pwritev(fd, uiov.iov, uiov.count, off);
+        user_iov_put(&uiov);
+        return total;
+    }
+    if (err == 1) {
+        for (int i = 0; i < uiov.count; i++) {
+            ssize_t res = fd->ops->pwrite(fd, uiov.iov[i].iov_base, uiov.iov[i].iov_len, off + total);
+            if (res < 0) {
+                if (total == 0)
+                    total = res;
+                break;
+            }
+            total += res;
+            if ((size_t) res < uiov.iov[i].iov_len)
+                break;
+        }
+        user_iov_put(&uiov);
+        return total;
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        char *buf = malloc(iovecs[i].len + 1);
+        if (buf == NULL)
+            return total > 0 ? total : _ENOMEM;
+        ssize_t res = _EFAULT;
+        if (!user_read(iovecs[i].base, buf, iovecs[i].len))
+            res = fd->ops->pwrite(fd, buf, iovecs[i].len, off + total);
+        free(buf);
+        if (res < 0)
+            return total > 0 ? total : res;
+        total += res;
+        if ((size_t) res < iovecs[i].len)
+            break;
+    }
+    return total;
+}
+
+static ssize_t fd_preadv(struct fd *fd, struct iovec_ *iovecs, unsigned count, off_t_ off) {
+    if (off < 0)
+        return _EINVAL;
+    if (fd->ops->pread != NULL)
+        return fd_pread_native(fd, iovecs, count, off);
+    if (fd->ops->lseek == NULL)
+        return _ESPIPE;
+    lock(&fd->lock);
+    ssize_t res = fd->ops->lseek(fd, off, LSEEK_SET);
+    if (res >= 0)
+        res = fd_readv(fd, iovecs, count);
     unlock(&fd->lock);
-    free(buf);
+    return res;
+}
+
+static ssize_t fd_pwritev(struct fd *fd, struct iovec_ *iovecs, unsigned count, off_t_ off) {
+    if (off < 0)
+        return _EINVAL;
+    if (fd->ops->pwrite != NULL)
+        return fd_pwrite_native(fd, iovecs, count, off);
+    if (fd->ops->lseek == NULL)
+        return _ESPIPE;
+    lock(&fd->lock);
+    ssize_t res = fd->ops->lseek(fd, off, LSEEK_SET);
+    if (res >= 0)
+        res = fd_writev(fd, iovecs, count);
+    unlock(&fd->lock);
+    return res;
+}
+
+dword_t sys_pread(fd_t f, addr_t buf_addr, dword_t size, dword_t off_low, dword_t off_high) {
+    off_t_ off = ((off_t_) off_high << 32) | off_low;
+    STRACE("pread(%d, 0x%x, %d, %lld)", f, buf_addr, size, (long long) off);
+    int err;
+    struct fd *fd = fd_for_read(f, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ iovec = {buf_addr, size};
+    return fd_preadv(fd, &iovec, 1, off);
+}
+
+dword_t sys_pwrite(fd_t f, addr_t buf_addr, dword_t size, dword_t off_low, dword_t off_high) {
+    off_t_ off = ((off_t_) off_high << 32) | off_low;
+    STRACE("pwrite(%d, 0x%x, %d, %lld)", f, buf_addr, size, (long long) off);
+    int err;
+    struct fd *fd = fd_for_write(f, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ iovec = {buf_addr, size};
+    return fd_pwritev(fd, &iovec, 1, off);
+}
+
+dword_t sys_preadv(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t off_low, dword_t off_high) {
+    off_t_ off = ((off_t_) off_high << 32) | off_low;
+    STRACE("preadv(%d, %#x, %d, %lld)", f, iovec_addr, iovec_count, (long long) off);
+    int err;
+    struct fd *fd = fd_for_read(f, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ *iovecs = read_iovecs(iovec_addr, iovec_count);
+    if (IS_ERR(iovecs))
+        return PTR_ERR(iovecs);
+    ssize_t res = fd_preadv(fd, iovecs, iovec_count, off);
+    free(iovecs);
+    return res;
+}
+
+dword_t sys_pwritev(fd_t f, addr_t iovec_addr, dword_t iovec_count, dword_t off_low, dword_t off_high) {
+    off_t_ off = ((off_t_) off_high << 32) | off_low;
+    STRACE("pwritev(%d, %#x, %d, %lld)", f, iovec_addr, iovec_count, (long long) off);
+    int err;
+    struct fd *fd = fd_for_write(f, &err);
+    if (fd == NULL)
+        return err;
+    struct iovec_ *iovecs = read_iovecs(iovec_addr, iovec_count);
+    if (IS_ERR(iovecs))
+        return PTR_ERR(iovecs);
+    ssize_t res = fd_pwritev(fd, iovecs, iovec_count, off);
+    free(iovecs);
     return res;
 }
 
@@ -688,16 +938,362 @@ dword_t sys_fsync(fd_t f) {
     return err;
 }
 
-// a few stubs
-dword_t sys_sendfile(fd_t UNUSED(out_fd), fd_t UNUSED(in_fd), addr_t UNUSED(offset_addr), dword_t UNUSED(count)) {
-    return _EINVAL;
+dword_t sys_sync() {
+    STRACE("sync()");
+    lock(&mounts_lock);
+    struct mount *mount;
+    list_for_each_entry(&mounts, mount, mounts) {
+        if (mount->fs->sync)
+            mount->fs->sync(mount);
+    }
+    unlock(&mounts_lock);
+    return 0;
+}
+
+dword_t sys_syncfs(fd_t f) {
+    STRACE("syncfs(%d)", f);
+    struct fd *fd = f_get(f);
+    if (fd == NULL)
+        return _EBADF;
+    if (fd->mount == NULL || fd->mount->fs->sync == NULL)
+        return 0;
+    return fd->mount->fs->sync(fd->mount);
+}
+
+// Moving data between fds. When both ends have host fds the host kernel does
+// the copy, otherwise it goes through a bounded buffer.
+
+#define COPY_BUF_SIZE (1 << 16)
+
+static int host_fd(struct fd *fd) {
+    if (fd->ops->host_fd == NULL)
+        return -1;
+    return fd->ops->host_fd(fd);
+}
+
+static bool fd_is_pipe(struct fd *fd) {
+    int real_fd = host_fd(fd);
+    if (real_fd < 0)
+        return false;
+    struct stat stat;
+    if (fstat(real_fd, &stat) < 0)
+        return false;
+    return S_ISFIFO(stat.st_mode);
+}
+
+// read or write at an offset without disturbing the file position
+static ssize_t fd_pread_buf(struct fd *fd, void *buf, size_t size, off_t_ off) {
+    if (fd->ops->pread != NULL)
+        return fd->ops->pread(fd, buf, size, off);
+    if (fd->ops->lseek == NULL)
+        return _ESPIPE;
+    lock(&fd->lock);
+    ssize_t res = fd->ops->lseek(fd, 0, LSEEK_CUR);
+    if (res >= 0) {
+        off_t_ saved = res;
+        res = fd->ops->lseek(fd, off, LSEEK_SET);
+        if (res >= 0)
+            res = fd->ops->read(fd, buf, size);
+        fd->ops->lseek(fd, saved, LSEEK_SET);
+    }
+    unlock(&fd->lock);
+    return res;
+}
+
+static ssize_t fd_pwrite_buf(struct fd *fd, const void *buf, size_t size, off_t_ off) {
+    if (fd->ops->pwrite != NULL)
+        return fd->ops->pwrite(fd, buf, size, off);
+    if (fd->ops->lseek == NULL)
+        return _ESPIPE;
+    lock(&fd->lock);
+    ssize_t res = fd->ops->lseek(fd, 0, LSEEK_CUR);
+    if (res >= 0) {
+        off_t_ saved = res;
+        res = fd->ops->lseek(fd, off, LSEEK_SET);
+        if (res >= 0)
+            res = fd->ops->write(fd, buf, size);
+        fd->ops->lseek(fd, saved, LSEEK_SET);
+    }
+    unlock(&fd->lock);
+    return res;
+}
+
+// NULL offsets mean use and advance the file position
+static ssize_t fd_copy_buf(struct fd *in, off_t_ *in_off, struct fd *out, off_t_ *out_off, size_t count) {
+    size_t buf_size = count < COPY_BUF_SIZE ? count : COPY_BUF_SIZE;
+    char *buf = malloc(buf_size + 1);
+    if (buf == NULL)
+        return _ENOMEM;
+    ssize_t total = 0;
+    ssize_t err = 0;
+    while ((size_t) total < count) {
+        size_t size = count - total < buf_size ? count - total : buf_size;
+        ssize_t in_res;
+        if (in_off != NULL)
+            in_res = fd_pread_buf(in, buf, size, *in_off);
+        else
+            in_res = in->ops->read(in, buf, size);
+        if (in_res <= 0) {
+            err = in_res;
+            break;
+        }
+        if (in_off != NULL)
+            *in_off += in_res;
+
+        ssize_t written = 0;
+        while (written < in_res) {
+            ssize_t out_res;
+            if (out_off != NULL)
+                out_res = fd_pwrite_buf(out, buf + written, in_res - written, *out_off);
+            else
+                out_res = out->ops->write(out, buf + written, in_res - written);
+            if (out_res <= 0) {
+                err = out_res;
+                break;
+            }
+            if (out_off != NULL)
+                *out_off += out_res;
+            written += out_res;
+        }
+        total += written;
+        if (written < in_res) {
+            // give back what was read but not written, if we can
+            if (in_off != NULL)
+                *in_off -= in_res - written;
+            else if (in->ops->lseek != NULL)
+                in->ops->lseek(in, -(in_res - written), LSEEK_CUR);
+            break;
+        }
+        if ((size_t) in_res < size)
+            break;
+    }
+    free(buf);
+    if (total == 0 && err < 0)
+        return err;
+    return total;
+}
+
+enum copy_kind {
+    COPY_SENDFILE,
+    COPY_SPLICE,
+    COPY_FILE_RANGE,
+};
+
+// Returns _ENOSYS if the host can't do this one, in which case nothing was
+// copied and the caller should use the buffer.
+static ssize_t fd_copy_host(enum copy_kind kind, struct fd *in, off_t_ *in_off, struct fd *out, off_t_ *out_off, size_t count) {
+#ifdef __linux__
+    int in_real = host_fd(in);
+    int out_real = host_fd(out);
+    if (in_real < 0 || out_real < 0)
+        return _ENOSYS;
+    loff_t in_pos = in_off ? *in_off : 0;
+    loff_t out_pos = out_off ? *out_off : 0;
+    ssize_t res;
+    switch (kind) {
+        case COPY_SENDFILE:
+            if (out_off != NULL)
+                return _ENOSYS;
+            if (in_off != NULL) {
+                off_t pos = in_pos;
+                res = sendfile(out_real, in_real, &pos, count);
+                in_pos = pos;
+            } else {
+                res = sendfile(out_real, in_real, NULL, count);
+            }
+            break;
+        case COPY_SPLICE:
+            res = splice(in_real, in_off ? &in_pos : NULL, out_real, out_off ? &out_pos : NULL, count, 0);
+            break;
+        case COPY_FILE_RANGE:
+            res = copy_file_range(in_real, in_off ? &in_pos : NULL, out_real, out_off ? &out_pos : NULL, count, 0);
+            break;
+    }
+    if (res < 0) {
+        if (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP)
+            return _ENOSYS;
+        return errno_map();
+    }
+    if (in_off != NULL)
+        *in_off = in_pos;
+    if (out_off != NULL)
+        *out_off = out_pos;
+    return res;
+#else
+    return _ENOSYS;
+#endif
+}
+
+static ssize_t fd_copy(enum copy_kind kind, struct fd *in, off_t_ *in_off, struct fd *out, off_t_ *out_off, size_t count) {
+    if (count == 0)
+        return 0;
+    ssize_t res = fd_copy_host(kind, in, in_off, out, out_off, count);
+    if (res != _ENOSYS)
+        return res;
+    return fd_copy_buf(in, in_off, out, out_off, count);
+}
+
+static dword_t do_sendfile(fd_t out_f, fd_t in_f, off_t_ *off, dword_t count) {
+    int err;
+    struct fd *in = fd_for_read(in_f, &err);
+    if (in == NULL)
+        return err;
+    struct fd *out = fd_for_write(out_f, &err);
+    if (out == NULL)
+        return err;
+    if (off != NULL && *off < 0)
+        return _EINVAL;
+    return fd_copy(COPY_SENDFILE, in, off, out, NULL, count);
+}
+
+dword_t sys_sendfile(fd_t out_fd, fd_t in_fd, addr_t offset_addr, dword_t count) {
+    STRACE("sendfile(%d, %d, %#x, %d)", out_fd, in_fd, offset_addr, count);
+    if (offset_addr == 0)
+        return do_sendfile(out_fd, in_fd, NULL, count);
+    sdword_t offset;
+    if (user_get(offset_addr, offset))
+        return _EFAULT;
+    off_t_ off = offset;
+    dword_t res = do_sendfile(out_fd, in_fd, &off, count);
+    offset = off;
+    if ((int_t) res >= 0 && user_put(offset_addr, offset))
+        return _EFAULT;
+    return res;
+}
+
+dword_t sys_sendfile64(fd_t out_fd, fd_t in_fd, addr_t offset_addr, dword_t count) {
+    STRACE("sendfile64(%d, %d, %#x, %d)", out_fd, in_fd, offset_addr, count);
+    if (offset_addr == 0)
+        return do_sendfile(out_fd, in_fd, NULL, count);
+    off_t_ off;
+    if (user_get(offset_addr, off))
+        return _EFAULT;
+    dword_t res = do_sendfile(out_fd, in_fd, &off, count);
+    if ((int_t) res >= 0 && user_put(offset_addr, off))
+        return _EFAULT;
+    return res;
+}
+
+// splice and copy_file_range both take optional pointers to 64-bit offsets
+static int get_offset(addr_t addr, off_t_ *off, off_t_ **off_ptr) {
+    *off_ptr = NULL;
+    if (addr == 0)
+        return 0;
+    if (user_get(addr, *off))
+        return _EFAULT;
+    if (*off < 0)
+        return _EINVAL;
+    *off_ptr = off;
+    return 0;
+}
+
+dword_t sys_splice(fd_t in_f, addr_t in_off_addr, fd_t out_f, addr_t out_off_addr, dword_t len, uint_t flags) {
+    STRACE("splice(%d, %#x, %d, %#x, %d, %#x)", in_f, in_off_addr, out_f, out_off_addr, len, flags);
+    int err;
+    struct fd *in = fd_for_read(in_f, &err);
+    if (in == NULL)
+        return err;
+    struct fd *out = fd_for_write(out_f, &err);
+    if (out == NULL)
+        return err;
+    bool in_pipe = fd_is_pipe(in);
+    bool out_pipe = fd_is_pipe(out);
+    if (!in_pipe && !out_pipe)
+        return _EINVAL;
+    if ((in_pipe && in_off_addr != 0) || (out_pipe && out_off_addr != 0))
+        return _ESPIPE;
+
+    off_t_ in_off, out_off;
+    off_t_ *in_off_ptr, *out_off_ptr;
+    if ((err = get_offset(in_off_addr, &in_off, &in_off_ptr)) < 0)
+        return err;
+    if ((err = get_offset(out_off_addr, &out_off, &out_off_ptr)) < 0)
+        return err;
+    ssize_t res = fd_copy(COPY_SPLICE, in, in_off_ptr, out, out_off_ptr, len);
+    if (res >= 0) {
+        if (in_off_ptr && user_put(in_off_addr, in_off))
+            return _EFAULT;
+        if (out_off_ptr && user_put(out_off_addr, out_off))
+            return _EFAULT;
+    }
+    return res;
 }
-dword_t sys_sendfile64(fd_t UNUSED(out_fd), fd_t UNUSED(in_fd), addr_t UNUSED(offset_addr), dword_t UNUSED(count)) {
+
+dword_t sys_tee(fd_t in_f, fd_t out_f, dword_t len, uint_t flags) {
+    STRACE("tee(%d, %d, %d, %#x)", in_f, out_f, len, flags);
+    int err;
+    struct fd *in = fd_for_read(in_f, &err);
+    if (in == NULL)
+        return err;
+    struct fd *out = fd_for_write(out_f, &err);
+    if (out == NULL)
+        return err;
+    // there's no way to peek at a pipe ourselves, so this one is host only
+    if (!fd_is_pipe(in) || !fd_is_pipe(out) || in == out)
+        return _EINVAL;
+#ifdef __linux__
+    ssize_t res = tee(host_fd(in), host_fd(out), len, 0);
+    if (res < 0)
+        return errno_map();
+    return res;
+#else
     return _EINVAL;
+#endif
+}
+
+dword_t sys_vmsplice(fd_t f, addr_t iovec_addr, dword_t iovec_count, uint_t flags) {
+    STRACE("vmsplice(%d, %#x, %d, %#x)", f, iovec_addr, iovec_count, flags);
+    struct fd *fd = f_get(f);
+    if (fd == NULL)
+        return _EBADF;
+    if (!fd_is_pipe(fd))
+        return _EBADF;
+    int fd_flags = fd->ops->getflags(fd);
+    if (fd_flags < 0)
+        return fd_flags;
+    struct iovec_ *iovecs = read_iovecs(iovec_addr, iovec_count);
+    if (IS_ERR(iovecs))
+        return PTR_ERR(iovecs);
+    // gifting pages isn't possible, so this is readv or writev on the pipe
+    ssize_t res;
+    if ((fd_flags & (O_WRONLY_|O_RDWR_)) == O_RDONLY_)
+        res = fd_readv(fd, iovecs, iovec_count);
+    else
+        res = fd_writev(fd, iovecs, iovec_count);
+    free(iovecs);
+    return res;
 }
-dword_t sys_copy_file_range(fd_t UNUSED(in_fd), addr_t UNUSED(in_off), fd_t UNUSED(out_fd),
-        addr_t UNUSED(out_off), dword_t UNUSED(len), uint_t UNUSED(flags)) {
-    return _EPERM; // good enough for ruby
+
+dword_t sys_copy_file_range(fd_t in_f, addr_t in_off_addr, fd_t out_f, addr_t out_off_addr, dword_t len, uint_t flags) {
+    STRACE("copy_file_range(%d, %#x, %d, %#x, %d, %#x)", in_f, in_off_addr, out_f, out_off_addr, len, flags);
+    if (flags != 0)
+        return _EINVAL;
+    int err;
+    struct fd *in = fd_for_read(in_f, &err);
+    if (in == NULL)
+        return err;
+    struct fd *out = fd_for_write(out_f, &err);
+    if (out == NULL)
+        return err;
+    if (S_ISDIR(out->type))
+        return _EISDIR;
+    if (!S_ISREG(in->type) || !S_ISREG(out->type))
+        return _EINVAL;
+
+    off_t_ in_off, out_off;
+    off_t_ *in_off_ptr, *out_off_ptr;
+    if ((err = get_offset(in_off_addr, &in_off, &in_off_ptr)) < 0)
+        return err;
+    if ((err = get_offset(out_off_addr, &out_off, &out_off_ptr)) < 0)
+        return err;
+    ssize_t res = fd_copy(COPY_FILE_RANGE, in, in_off_ptr, out, out_off_ptr, len);
+    if (res >= 0) {
+        if (in_off_ptr && user_put(in_off_addr, in_off))
+            return _EFAULT;
+        if (out_off_ptr && user_put(out_off_addr, out_off))
+            return _EFAULT;
+    }
+    return res;
 }
 
 dword_t sys_xattr_stub(addr_t UNUSED(path_addr), addr_t UNUSED(name_addr),
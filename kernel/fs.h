@@ -67,6 +67,7 @@ int generic_mkdirat(struct fd *at, const char *path, mode_t_ mode);
 struct mount {
     const char *point;
     const char *source;
+    const char *options;
     const struct fs_ops *fs;
     unsigned refcount;
     struct list mounts;
@@ -80,19 +81,54 @@ struct mount {
                 sqlite3_stmt *begin;
                 sqlite3_stmt *commit;
                 sqlite3_stmt *rollback;
-                sqlite3_stmt *path_get_inode;
-                sqlite3_stmt *path_read_stat;
+                sqlite3_stmt *dentry_lookup;
+                sqlite3_stmt *dentry_link;
+                sqlite3_stmt *dentry_unlink;
+                sqlite3_stmt *dentry_unlink_children;
+                sqlite3_stmt *dentry_rename;
                 sqlite3_stmt *path_create_stat;
-                sqlite3_stmt *path_create_path;
                 sqlite3_stmt *inode_read_stat;
                 sqlite3_stmt *inode_write_stat;
-                sqlite3_stmt *path_link;
-                sqlite3_stmt *path_unlink;
-                sqlite3_stmt *path_rename;
                 sqlite3_stmt *path_from_inode;
+                sqlite3_stmt *inode_parent;
+                sqlite3_stmt *dir_list;
                 sqlite3_stmt *try_cleanup_inode;
+                sqlite3_stmt *orphans_add;
+                sqlite3_stmt *data_version;
+                sqlite3_stmt *savepoint;
+                sqlite3_stmt *release;
+                sqlite3_stmt *rollback_savepoint;
             } stmt;
             lock_t lock;
+            bool db_begun;
+            struct fakefs_cache *cache;
+            // bumped on every commit, so readers know whether what they
+            // found can go in the cache
+            unsigned cache_generation;
+            // idle read only connections, locked by the mount lock
+            struct list readers;
+            unsigned readers_count;
+            // for noticing when the file provider changes the database
+            int data_version;
+            time_t data_version_checked;
+            // group commit, see fs/fake.c
+            bool batch;
+            bool batch_open;
+            bool batch_exit;
+            unsigned batch_ops;
+            int batch_changes;
+            struct timespec batch_start;
+            pthread_t batch_thread;
+            cond_t batch_cond;
+            // maintenance after mounting, see fs/fake.c
+            bool background_running;
+            bool background_exit;
+            bool background_rebuild;
+            pthread_t background_thread;
+            // see fs/fake-rebuild.c
+            bool rebuild_running;
+            uint64_t rebuild_dirs_done;
+            uint64_t rebuild_dirs_queued;
         };
     };
 };
@@ -104,7 +140,8 @@ void mount_retain(struct mount *mount);
 void mount_release(struct mount *mount);
 
 // must hold mounts_lock while calling these, or traversing mounts
-int do_mount(const struct fs_ops *fs, const char *source, const char *point);
+// options is the data string passed to mount(2), or NULL
+int do_mount(const struct fs_ops *fs, const char *source, const char *point, const char *options);
 int do_umount(const char *point);
 int mount_remove(struct mount *mount);
 extern struct list mounts;
@@ -114,6 +151,7 @@ extern struct list mounts;
 #define O_WRONLY_ (1 << 0)
 #define O_RDWR_ (1 << 1)
 #define O_CREAT_ (1 << 6)
+#define O_EXCL_ (1 << 7)
 #define O_NOCTTY_ (1 << 8)
 #define O_TRUNC_ (1 << 9)
 #define O_APPEND_ (1 << 10)
@@ -128,9 +166,14 @@ extern struct list mounts;
 struct fs_ops {
     const char *name;
     int magic;
+    // Set if paths can change without going through these ops, like in
+    // procfs, so path resolution shouldn't cache anything about them
+    bool dynamic;
 
     int (*mount)(struct mount *mount);
     int (*umount)(struct mount *mount);
+    // Writes out anything the filesystem is holding in memory
+    int (*sync)(struct mount *mount);
     int (*statfs)(struct mount *mount, struct statfsbuf *stat);
 
     struct fd *(*open)(struct mount *mount, const char *path, int flags, int mode); // required
@@ -179,10 +222,18 @@ int realfs_flock(struct fd *fd, int operation);
 int realfs_getpath(struct fd *fd, char *buf);
 ssize_t realfs_read(struct fd *fd, void *buf, size_t bufsize);
 ssize_t realfs_write(struct fd *fd, const void *buf, size_t bufsize);
+ssize_t realfs_readv(struct fd *fd, const struct iovec *iov, int iovcnt);
+ssize_t realfs_writev(struct fd *fd, const struct iovec *iov, int iovcnt);
+ssize_t realfs_pread(struct fd *fd, void *buf, size_t bufsize, off_t_ off);
+ssize_t realfs_pwrite(struct fd *fd, const void *buf, size_t bufsize, off_t_ off);
+ssize_t realfs_preadv(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off);
+ssize_t realfs_pwritev(struct fd *fd, const struct iovec *iov, int iovcnt, off_t_ off);
+int realfs_host_fd(struct fd *fd);
 int realfs_poll(struct fd *fd);
 int realfs_getflags(struct fd *fd);
 int realfs_setflags(struct fd *fd, dword_t arg);
 int realfs_close(struct fd *fd);
+int realfs_fsync(struct fd *fd);
 
 // adhoc fs
 struct fd *adhoc_fd_create(const struct fd_ops *ops);
@@ -191,6 +242,32 @@ struct fd *adhoc_fd_create(const struct fd_ops *ops);
 extern const struct fs_ops realfs;
 extern const struct fs_ops procfs;
 extern const struct fs_ops fakefs;
+
+// Read when a fakefs is mounted, see fs/fake.c
+struct fakefs_commit_policy {
+    bool batch;
+    unsigned max_ops;
+    unsigned max_delay_ms;
+};
+extern struct fakefs_commit_policy fakefs_commit_policy;
+
+// With lazy set, a rebuild needed at mount time runs in the background instead
+// of holding up the mount, see fs/fake-rebuild.c
+struct fakefs_rebuild_policy {
+    bool lazy;
+    unsigned threads;
+};
+extern struct fakefs_rebuild_policy fakefs_rebuild_policy;
+
+struct fakefs_cache_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+};
+// For /proc/fs/fakefs, one line per fakefs mount
+size_t fakefs_show_stats(char *buf, size_t size);
 extern const struct fs_ops devptsfs;
+extern const struct fs_ops tmpfs;
 
 #endif
@@ -5,17 +5,31 @@
 #include "kernel/calls.h"
 #include "fs/fd.h"
 #include "fs/tty.h"
+#include "util/timer.h"
+
+struct timespec boot_time;
 
 int mount_root(const struct fs_ops *fs, const char *source) {
+    boot_time = timespec_now();
     char source_realpath[MAX_PATH + 1];
     if (realpath(source, source_realpath) == NULL)
         return errno_map();
-    int err = do_mount(fs, source_realpath, "");
+    int err = do_mount(fs, source_realpath, "", NULL);
     if (err < 0)
         return err;
+    struct timespec elapsed = timespec_subtract(timespec_now(), boot_time);
+    printk("mounted root in %ld ms\n", (long) (elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000));
     return 0;
 }
 
+void boot_ready() {
+    static atomic_bool reported;
+    if (atomic_exchange(&reported, true))
+        return;
+    struct timespec elapsed = timespec_subtract(timespec_now(), boot_time);
+    printk("startup took %ld ms\n", (long) (elapsed.tv_sec * 1000 + elapsed.tv_nsec / 1000000));
+}
+
 static struct tgroup *init_tgroup() {
     struct tgroup *group = malloc(sizeof(struct tgroup));
     if (group == NULL)
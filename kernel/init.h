@@ -7,4 +7,10 @@ int mount_root(const struct fs_ops *fs, const char *source);
 void create_first_process(void);
 int create_stdio(struct tty_driver *driver);
 
+// Set by mount_root. boot_ready is called whenever something's about to wait
+// for terminal input, and the first time reports how long it's been, which is
+// roughly how long it took for the shell prompt to show up.
+extern struct timespec boot_time;
+void boot_ready(void);
+
 #endif
@@ -0,0 +1,1476 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include "kernel/calls.h"
+#include "kernel/ipc.h"
+#include "kernel/resource.h"
+#include "fs/poll.h"
+#include "fs/sock.h"
+#include "util/timer.h"
+
+extern const struct fd_ops socket_fdops;
+
+// io_uring, emulated with a pool of worker threads per ring. The rings live
+// in a host shared memory object that's mapped both here and into the guest,
+// so completions show up without the guest making a syscall.
+//
+// Workers don't have a current task, so everything that needs one (looking up
+// fds, resolving guest buffers, reading sockaddrs) is done at submit time.
+//
+// Requests that would spend most of their time waiting for an fd (poll, accept,
+// recv, reads and writes on pipes and sockets) don't get a worker until the fd
+// is ready. Until then they sit in a struct poll that one poller thread per
+// ring waits on, so a server with lots of idle connections doesn't need a
+// thread for each one.
+
+#define IORING_SETUP_CQSIZE_ (1 << 3)
+#define IORING_SETUP_CLAMP_ (1 << 4)
+
+#define IORING_FEAT_SINGLE_MMAP_ (1 << 0)
+#define IORING_FEAT_SUBMIT_STABLE_ (1 << 2)
+#define IORING_FEAT_RW_CUR_POS_ (1 << 3)
+
+#define IORING_ENTER_GETEVENTS_ (1 << 0)
+
+#define IORING_OFF_SQ_RING_ 0
+#define IORING_OFF_CQ_RING_ 0x8000000
+#define IORING_OFF_SQES_ 0x10000000
+
+#define IOSQE_FIXED_FILE_ (1 << 0)
+#define IOSQE_IO_DRAIN_ (1 << 1)
+#define IOSQE_IO_LINK_ (1 << 2)
+#define IOSQE_IO_HARDLINK_ (1 << 3)
+#define IOSQE_ASYNC_ (1 << 4)
+
+#define IORING_TIMEOUT_ABS_ (1 << 0)
+
+#define IORING_REGISTER_BUFFERS_ 0
+#define IORING_UNREGISTER_BUFFERS_ 1
+#define IORING_REGISTER_FILES_ 2
+#define IORING_UNREGISTER_FILES_ 3
+#define IORING_REGISTER_PROBE_ 8
+#define IO_URING_OP_SUPPORTED_ (1 << 0)
+
+#define IORING_MAX_ENTRIES_ 32768
+#define IORING_MAX_FILES_ 1024
+// Requests that wait for an fd don't take up a worker while waiting, so this
+// only has to cover ones that are actually doing something.
+#define IORING_MAX_WORKERS 64
+
+enum {
+    IORING_OP_NOP_,
+    IORING_OP_READV_,
+    IORING_OP_WRITEV_,
+    IORING_OP_FSYNC_,
+    IORING_OP_READ_FIXED_,
+    IORING_OP_WRITE_FIXED_,
+    IORING_OP_POLL_ADD_,
+    IORING_OP_POLL_REMOVE_,
+    IORING_OP_SYNC_FILE_RANGE_,
+    IORING_OP_SENDMSG_,
+    IORING_OP_RECVMSG_,
+    IORING_OP_TIMEOUT_,
+    IORING_OP_TIMEOUT_REMOVE_,
+    IORING_OP_ACCEPT_,
+    IORING_OP_ASYNC_CANCEL_,
+    IORING_OP_LINK_TIMEOUT_,
+    IORING_OP_CONNECT_,
+    IORING_OP_FALLOCATE_,
+    IORING_OP_OPENAT_,
+    IORING_OP_CLOSE_,
+    IORING_OP_FILES_UPDATE_,
+    IORING_OP_STATX_,
+    IORING_OP_READ_,
+    IORING_OP_WRITE_,
+    IORING_OP_FADVISE_,
+    IORING_OP_MADVISE_,
+    IORING_OP_SEND_,
+    IORING_OP_RECV_,
+    IORING_OP_LAST_,
+};
+
+static bool op_supported(unsigned op) {
+    switch (op) {
+        case IORING_OP_NOP_:
+        case IORING_OP_READV_:
+        case IORING_OP_WRITEV_:
+        case IORING_OP_FSYNC_:
+        case IORING_OP_READ_FIXED_:
+        case IORING_OP_WRITE_FIXED_:
+        case IORING_OP_POLL_ADD_:
+        case IORING_OP_TIMEOUT_:
+        case IORING_OP_ACCEPT_:
+        case IORING_OP_CONNECT_:
+        case IORING_OP_READ_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_SEND_:
+        case IORING_OP_RECV_:
+            return true;
+    }
+    return false;
+}
+
+struct io_sqring_offsets_ {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t flags;
+    uint32_t dropped;
+    uint32_t array;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct io_cqring_offsets_ {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t ring_mask;
+    uint32_t ring_entries;
+    uint32_t overflow;
+    uint32_t cqes;
+    uint32_t flags;
+    uint32_t resv1;
+    uint64_t resv2;
+};
+
+struct io_uring_params_ {
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    uint32_t flags;
+    uint32_t sq_thread_cpu;
+    uint32_t sq_thread_idle;
+    uint32_t features;
+    uint32_t wq_fd;
+    uint32_t resv[3];
+    struct io_sqring_offsets_ sq_off;
+    struct io_cqring_offsets_ cq_off;
+};
+
+struct io_uring_sqe_ {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t ioprio;
+    int32_t fd;
+    uint64_t off; // or addr2
+    uint64_t addr;
+    uint32_t len;
+    uint32_t op_flags; // rw_flags, poll_events, msg_flags, etc.
+    uint64_t user_data;
+    uint16_t buf_index;
+    uint16_t personality;
+    int32_t splice_fd_in;
+    uint64_t pad[2];
+};
+
+struct io_uring_cqe_ {
+    uint64_t user_data;
+    int32_t res;
+    uint32_t flags;
+};
+
+struct io_uring_probe_op_ {
+    uint8_t op;
+    uint8_t resv;
+    uint16_t flags;
+    uint32_t resv2;
+};
+
+struct io_uring_probe_ {
+    uint8_t last_op;
+    uint8_t ops_len;
+    uint16_t resv;
+    uint32_t resv2[3];
+};
+
+struct kernel_timespec_ {
+    int64_t sec;
+    int64_t nsec;
+};
+
+// The layout of the shared ring memory. The sq array comes after the cqes.
+struct io_rings_ {
+    struct {
+        uint32_t head;
+        uint32_t tail;
+    } sq, cq;
+    uint32_t sq_ring_mask;
+    uint32_t cq_ring_mask;
+    uint32_t sq_ring_entries;
+    uint32_t cq_ring_entries;
+    uint32_t sq_dropped;
+    uint32_t sq_flags;
+    uint32_t cq_flags;
+    uint32_t cq_overflow;
+    uint32_t pad[4];
+    struct io_uring_cqe_ cqes[];
+};
+
+struct io_ring {
+    atomic_uint refcount;
+    int memfd;
+    char *memory;
+    size_t rings_size;
+    size_t sqes_size;
+    struct io_rings_ *rings;
+    uint32_t *sq_array;
+    struct io_uring_sqe_ *sqes;
+    unsigned sq_entries;
+    unsigned cq_entries;
+
+    // protects the submission side and the registered files and buffers
+    lock_t submit_lock;
+    struct fd **files;
+    unsigned nr_files;
+    struct iovec_ *bufs;
+    unsigned nr_bufs;
+
+    // protects everything below, and posting completions
+    lock_t lock;
+    struct fd *fd; // for poll_wakeup, NULL once closed
+    bool dead;
+    uint64_t completions;
+    cond_t cq_cond;
+    struct list queue;
+    cond_t work_cond;
+    unsigned workers;
+    unsigned idle_workers;
+    // requests waiting for their fd, see io_ring_poller
+    struct poll *poll;
+    struct list poll_fds;
+    bool poller_running;
+};
+
+// the requests waiting on one fd, since a struct poll only has one entry per fd
+struct io_poll_fd {
+    struct fd *fd;
+    int types;
+    struct list reqs;
+    struct list ring_fds;
+};
+
+struct io_req {
+    struct io_ring *ring;
+    // in the ring's queue, or in an io_poll_fd while waiting for the fd
+    struct list queue;
+    struct io_req *link;
+    bool hardlink;
+
+    uint8_t opcode;
+    uint64_t user_data;
+    struct fd *fd;
+    uint64_t off;
+    uint32_t len;
+    uint32_t op_flags;
+
+    // guest buffers, resolved at submit time
+    struct user_iov uiov;
+    union {
+        struct {
+            char sockaddr[128];
+            socklen_t sockaddr_len;
+        } connect;
+        struct {
+            size_t sockaddr_len; // the guest's addrlen goes after this in uiov
+            struct fdtable *files;
+            unsigned nofile_limit;
+        } accept;
+        struct {
+            struct timespec deadline;
+            uint64_t target;
+        } timeout;
+        struct {
+            int events;
+        } poll;
+    };
+};
+
+static const struct fd_ops io_ring_fdops;
+
+static void io_ring_release(struct io_ring *ring) {
+    if (--ring->refcount != 0)
+        return;
+    for (unsigned i = 0; i < ring->nr_files; i++)
+        if (ring->files[i] != NULL)
+            fd_close(ring->files[i]);
+    free(ring->files);
+    free(ring->bufs);
+    munmap(ring->memory, ring->rings_size + ring->sqes_size);
+    close(ring->memfd);
+    cond_destroy(&ring->cq_cond);
+    cond_destroy(&ring->work_cond);
+    free(ring);
+}
+
+static void io_req_free(struct io_req *req) {
+    user_iov_put(&req->uiov);
+    if (req->fd != NULL)
+        fd_close(req->fd);
+    if (req->opcode == IORING_OP_ACCEPT_ && req->accept.files != NULL)
+        fdtable_release(req->accept.files);
+    io_ring_release(req->ring);
+    free(req);
+}
+
+static void io_ring_post(struct io_ring *ring, uint64_t user_data, int32_t res) {
+    lock(&ring->lock);
+    struct io_rings_ *rings = ring->rings;
+    uint32_t tail = rings->cq.tail;
+    uint32_t head = __atomic_load_n(&rings->cq.head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ring->cq_entries) {
+        __atomic_fetch_add(&rings->cq_overflow, 1, __ATOMIC_RELAXED);
+    } else {
+        struct io_uring_cqe_ *cqe = &rings->cqes[tail & rings->cq_ring_mask];
+        cqe->user_data = user_data;
+        cqe->res = res;
+        cqe->flags = 0;
+        __atomic_store_n(&rings->cq.tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    ring->completions++;
+    notify(&ring->cq_cond);
+    if (ring->fd != NULL)
+        poll_wakeup(ring->fd);
+    unlock(&ring->lock);
+}
+
+// operations
+
+static int io_req_poll_callback(void *context, int types, union poll_fd_info UNUSED(info)) {
+    *(int *) context = types;
+    return 1;
+}
+
+// Waits for the fd to be ready. Wakes up every so often to check if the ring
+// was closed, since there's no way to interrupt poll_wait.
+static int io_req_wait(struct io_req *req, int types) {
+    struct fd *fd = req->fd;
+    if (fd->ops->poll == NULL)
+        return types;
+    struct poll *poll = poll_create();
+    if (poll == NULL)
+        return _ENOMEM;
+    int events = poll_add_fd(poll, fd, types | POLL_ERR | POLL_HUP, (union poll_fd_info) {});
+    while (events == 0) {
+        struct timespec tick = {.tv_sec = 1};
+        int res = poll_wait(poll, io_req_poll_callback, &events, &tick);
+        if (res < 0) {
+            events = res;
+            break;
+        }
+        lock(&req->ring->lock);
+        bool dead = req->ring->dead;
+        unlock(&req->ring->lock);
+        if (events == 0 && dead)
+            events = _ECANCELED;
+    }
+    poll_del_fd(poll, fd);
+    poll_destroy(poll);
+    return events;
+}
+
+// off is -1 for the current file position
+static ssize_t io_req_rw(struct io_req *req, bool write) {
+    struct fd *fd = req->fd;
+    struct iovec *iov = req->uiov.iov;
+    int iovcnt = req->uiov.count;
+    if (!write && (fd->ops->read == NULL || S_ISDIR(fd->type)))
+        return S_ISDIR(fd->type) ? _EISDIR : _EBADF;
+    if (write && fd->ops->write == NULL)
+        return _EBADF;
+
+    if (!S_ISREG(fd->type)) {
+        int events = io_req_wait(req, write ? POLL_WRITE : POLL_READ);
+        if (events < 0)
+            return events;
+    }
+
+    if (req->off == (uint64_t) -1) {
+        if (write && fd->ops->writev)
+            return fd->ops->writev(fd, iov, iovcnt);
+        if (!write && fd->ops->readv)
+            return fd->ops->readv(fd, iov, iovcnt);
+    }
+
+    bool seek = req->off != (uint64_t) -1 && (write ? fd->ops->pwrite == NULL : fd->ops->pread == NULL);
+    if (seek) {
+        if (fd->ops->lseek == NULL)
+            return _ESPIPE;
+        lock(&fd->lock);
+        ssize_t err = fd->ops->lseek(fd, req->off, LSEEK_SET);
+        if (err < 0) {
+            unlock(&fd->lock);
+            return err;
+        }
+    }
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        ssize_t res;
+        if (req->off != (uint64_t) -1 && !seek) {
+            if (write)
+                res = fd->ops->pwrite(fd, iov[i].iov_base, iov[i].iov_len, req->off + total);
+            else
+                res = fd->ops->pread(fd, iov[i].iov_base, iov[i].iov_len, req->off + total);
+        } else {
+            if (write)
+                res = fd->ops->write(fd, iov[i].iov_base, iov[i].iov_len);
+            else
+                res = fd->ops->read(fd, iov[i].iov_base, iov[i].iov_len);
+        }
+        if (res < 0) {
+            if (total == 0)
+                total = res;
+            break;
+        }
+        total += res;
+        if ((size_t) res < iov[i].iov_len)
+            break;
+    }
+    if (seek)
+        unlock(&fd->lock);
+    return total;
+}
+
+static ssize_t io_req_sendrecv(struct io_req *req, bool send) {
+    struct fd *sock = req->fd;
+    int flags = sock_flags_to_real(req->op_flags);
+    if (!send && !(req->op_flags & MSG_DONTWAIT_)) {
+        int events = io_req_wait(req, POLL_READ);
+        if (events < 0)
+            return events;
+    }
+    struct msghdr msg = {.msg_iov = req->uiov.iov, .msg_iovlen = req->uiov.count};
+    ssize_t res = send ? sendmsg(sock->real_fd, &msg, flags) : recvmsg(sock->real_fd, &msg, flags);
+    if (res < 0)
+        return errno_map();
+    return res;
+}
+
+// copies into the guest buffers starting at off bytes in
+static void io_req_copy_out(struct io_req *req, size_t off, const void *data, size_t size) {
+    for (int i = 0; i < req->uiov.count && size > 0; i++) {
+        struct iovec *iov = &req->uiov.iov[i];
+        if (off >= iov->iov_len) {
+            off -= iov->iov_len;
+            continue;
+        }
+        size_t chunk = iov->iov_len - off;
+        if (chunk > size)
+            chunk = size;
+        memcpy((char *) iov->iov_base + off, data, chunk);
+        data = (const char *) data + chunk;
+        size -= chunk;
+        off = 0;
+    }
+}
+
+static int io_req_accept(struct io_req *req) {
+    struct fd *sock = req->fd;
+    char sockaddr[128];
+    socklen_t sockaddr_len = sizeof(sockaddr);
+    int client;
+    while (true) {
+        int events = io_req_wait(req, POLL_READ);
+        if (events < 0)
+            return events;
+        client = accept(sock->real_fd, (void *) sockaddr, &sockaddr_len);
+        if (client >= 0)
+            break;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return errno_map();
+    }
+    if (req->op_flags & O_NONBLOCK_)
+        fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+    if (req->uiov.count > 0) {
+        struct sockaddr *real_addr = (void *) sockaddr;
+        struct sockaddr_ *fake_addr = (void *) sockaddr;
+        fake_addr->family = sock_family_from_real(real_addr->sa_family);
+        dword_t len = sockaddr_len;
+        size_t copy = req->accept.sockaddr_len < len ? req->accept.sockaddr_len : len;
+        io_req_copy_out(req, 0, sockaddr, copy);
+        io_req_copy_out(req, req->accept.sockaddr_len, &len, sizeof(len));
+    }
+
+    struct fd *fd = sock_fd_new(client);
+    if (fd == NULL) {
+        close(client);
+        return _ENOMEM;
+    }
+    return fdtable_install(req->accept.files, fd, req->op_flags & (O_CLOEXEC_|O_NONBLOCK_), req->accept.nofile_limit);
+}
+
+static int io_req_connect(struct io_req *req) {
+    int err = connect(req->fd->real_fd, (void *) req->connect.sockaddr, req->connect.sockaddr_len);
+    if (err < 0)
+        return errno_map();
+    return 0;
+}
+
+static int io_req_timeout(struct io_req *req) {
+    struct io_ring *ring = req->ring;
+    lock(&ring->lock);
+    int res = 0;
+    while (true) {
+        if (ring->dead) {
+            res = _ECANCELED;
+            break;
+        }
+        if (req->timeout.target != 0 && ring->completions >= req->timeout.target)
+            break;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        struct timespec remaining = timespec_subtract(req->timeout.deadline, now);
+        if (!timespec_positive(remaining)) {
+            res = _ETIME;
+            break;
+        }
+        wait_for_ignore_signals(&ring->cq_cond, &ring->lock, &remaining);
+    }
+    unlock(&ring->lock);
+    return res;
+}
+
+static int io_req_poll(struct io_req *req) {
+    int events = io_req_wait(req, req->op_flags & 0xffff);
+    return events;
+}
+
+static ssize_t io_req_run(struct io_req *req) {
+    switch (req->opcode) {
+        case IORING_OP_NOP_:
+            return 0;
+        case IORING_OP_READV_:
+        case IORING_OP_READ_:
+        case IORING_OP_READ_FIXED_:
+            return io_req_rw(req, false);
+        case IORING_OP_WRITEV_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_WRITE_FIXED_:
+            return io_req_rw(req, true);
+        case IORING_OP_FSYNC_:
+            if (req->fd->ops->fsync == NULL)
+                return 0;
+            return req->fd->ops->fsync(req->fd);
+        case IORING_OP_POLL_ADD_:
+            return io_req_poll(req);
+        case IORING_OP_TIMEOUT_:
+            return io_req_timeout(req);
+        case IORING_OP_ACCEPT_:
+            return io_req_accept(req);
+        case IORING_OP_CONNECT_:
+            return io_req_connect(req);
+        case IORING_OP_SEND_:
+            return io_req_sendrecv(req, true);
+        case IORING_OP_RECV_:
+            return io_req_sendrecv(req, false);
+    }
+    return _EINVAL;
+}
+
+static bool io_req_failed(struct io_req *req, ssize_t res) {
+    if (res < 0)
+        return true;
+    switch (req->opcode) {
+        case IORING_OP_READV_:
+        case IORING_OP_READ_:
+        case IORING_OP_READ_FIXED_:
+        case IORING_OP_WRITEV_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_WRITE_FIXED_:
+        case IORING_OP_SEND_:
+        case IORING_OP_RECV_:
+            return (size_t) res < req->uiov.size;
+    }
+    return false;
+}
+
+// runs a chain of linked requests in order
+static void io_req_run_chain(struct io_req *req) {
+    bool cancel = false;
+    while (req != NULL) {
+        struct io_req *next = req->link;
+        ssize_t res = cancel ? _ECANCELED : io_req_run(req);
+        io_ring_post(req->ring, req->user_data, res);
+        if (!req->hardlink && io_req_failed(req, res))
+            cancel = true;
+        io_req_free(req);
+        req = next;
+    }
+}
+
+static void io_req_free_chain(struct io_req *req) {
+    while (req != NULL) {
+        struct io_req *next = req->link;
+        io_req_free(req);
+        req = next;
+    }
+}
+
+static void *io_ring_worker(void *data) {
+    struct io_ring *ring = data;
+    lock(&ring->lock);
+    while (true) {
+        while (list_empty(&ring->queue) && !ring->dead) {
+            ring->idle_workers++;
+            struct timespec idle_timeout = {.tv_sec = 10};
+            int err = wait_for_ignore_signals(&ring->work_cond, &ring->lock, &idle_timeout);
+            ring->idle_workers--;
+            if (err == _ETIMEDOUT && list_empty(&ring->queue))
+                goto out;
+        }
+        if (ring->dead)
+            break;
+        struct io_req *req = list_first_entry(&ring->queue, struct io_req, queue);
+        list_remove(&req->queue);
+        unlock(&ring->lock);
+        io_req_run_chain(req);
+        lock(&ring->lock);
+    }
+out:
+    ring->workers--;
+    unlock(&ring->lock);
+    io_ring_release(ring);
+    return NULL;
+}
+
+static void io_ring_queue_work(struct io_ring *ring, struct io_req *req) {
+    lock(&ring->lock);
+    if (ring->dead) {
+        unlock(&ring->lock);
+        io_req_free_chain(req);
+        return;
+    }
+    list_add_tail(&ring->queue, &req->queue);
+    if (ring->idle_workers == 0 && ring->workers < IORING_MAX_WORKERS) {
+        pthread_t thread;
+        ring->refcount++;
+        if (pthread_create(&thread, NULL, io_ring_worker, ring) == 0) {
+            pthread_detach(thread);
+            ring->workers++;
+        } else {
+            ring->refcount--;
+        }
+    }
+    notify_once(&ring->work_cond);
+    unlock(&ring->lock);
+}
+
+// What to wait for before giving the request to a worker, or 0 if it should
+// go straight to one. Linked requests have to run in order, so they don't
+// wait here.
+static int io_req_poll_types(struct io_req *req) {
+    if (req->link != NULL || req->fd == NULL || req->fd->ops->poll == NULL)
+        return 0;
+    int types = 0;
+    switch (req->opcode) {
+        case IORING_OP_POLL_ADD_:
+            types = req->op_flags & 0xffff;
+            break;
+        case IORING_OP_ACCEPT_:
+            types = POLL_READ;
+            break;
+        case IORING_OP_RECV_:
+            if (!(req->op_flags & MSG_DONTWAIT_))
+                types = POLL_READ;
+            break;
+        case IORING_OP_READV_:
+        case IORING_OP_READ_:
+        case IORING_OP_READ_FIXED_:
+            if (!S_ISREG(req->fd->type))
+                types = POLL_READ;
+            break;
+        case IORING_OP_WRITEV_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_WRITE_FIXED_:
+            if (!S_ISREG(req->fd->type))
+                types = POLL_WRITE;
+            break;
+        default:
+            return 0;
+    }
+    return types | POLL_ERR | POLL_HUP;
+}
+
+struct io_poll_batch {
+    struct {
+        struct io_poll_fd *poll_fd;
+        int types;
+    } events[16];
+    int count;
+};
+
+static int io_poll_batch_add(void *context, int types, union poll_fd_info info) {
+    struct io_poll_batch *batch = context;
+    if (batch->count >= (int) (sizeof(batch->events)/sizeof(batch->events[0])))
+        return 0;
+    batch->events[batch->count].poll_fd = info.ptr;
+    batch->events[batch->count].types = types;
+    batch->count++;
+    return 1;
+}
+
+// Takes the requests that the events are enough for off the fd, and waits
+// for the rest again. Needs the ring locked.
+static void io_poll_fd_ready(struct io_ring *ring, struct io_poll_fd *poll_fd, int types, struct list *ready) {
+    int remaining = 0;
+    struct io_req *req, *tmp;
+    list_for_each_entry_safe(&poll_fd->reqs, req, tmp, queue) {
+        int wanted = io_req_poll_types(req);
+        if (wanted & types) {
+            req->poll.events = wanted & types;
+            list_remove(&req->queue);
+            list_add_tail(ready, &req->queue);
+        } else {
+            remaining |= wanted;
+        }
+    }
+    poll_fd->types = remaining;
+    union poll_fd_info info = {.ptr = poll_fd};
+    if (remaining != 0 && poll_mod_fd(ring->poll, poll_fd->fd, remaining | POLL_ONESHOT, info) == 0)
+        return;
+    // nothing left, or it can't be waited for anymore
+    list_for_each_entry_safe(&poll_fd->reqs, req, tmp, queue) {
+        req->poll.events = POLL_ERR;
+        list_remove(&req->queue);
+        list_add_tail(ready, &req->queue);
+    }
+    poll_del_fd(ring->poll, poll_fd->fd);
+    list_remove(&poll_fd->ring_fds);
+    fd_close(poll_fd->fd);
+    free(poll_fd);
+}
+
+// Stops the poller. The requests still waiting are completed with err, or
+// just dropped if err is 0 because the ring is gone.
+static void io_ring_poller_stop(struct io_ring *ring, int err) {
+    struct list reqs;
+    list_init(&reqs);
+    lock(&ring->lock);
+    struct io_poll_fd *poll_fd, *tmp_fd;
+    list_for_each_entry_safe(&ring->poll_fds, poll_fd, tmp_fd, ring_fds) {
+        struct io_req *req, *tmp;
+        list_for_each_entry_safe(&poll_fd->reqs, req, tmp, queue) {
+            list_remove(&req->queue);
+            list_add_tail(&reqs, &req->queue);
+        }
+        poll_del_fd(ring->poll, poll_fd->fd);
+        list_remove(&poll_fd->ring_fds);
+        fd_close(poll_fd->fd);
+        free(poll_fd);
+    }
+    struct poll *poll = ring->poll;
+    ring->poll = NULL;
+    ring->poller_running = false;
+    unlock(&ring->lock);
+    poll_destroy(poll);
+
+    struct io_req *req, *tmp;
+    list_for_each_entry_safe(&reqs, req, tmp, queue) {
+        list_remove(&req->queue);
+        if (err < 0)
+            io_ring_post(ring, req->user_data, err);
+        io_req_free(req);
+    }
+}
+
+// Waits for the fds requests are waiting on. Wakes up every so often to check
+// if the ring was closed, like io_req_wait.
+static void *io_ring_poller(void *data) {
+    struct io_ring *ring = data;
+    int err = 0;
+    while (true) {
+        lock(&ring->lock);
+        bool dead = ring->dead;
+        unlock(&ring->lock);
+        if (dead)
+            break;
+
+        struct io_poll_batch batch = {.count = 0};
+        struct timespec tick = {.tv_sec = 1};
+        int res = poll_wait(ring->poll, io_poll_batch_add, &batch, &tick);
+        if (res < 0) {
+            err = res;
+            break;
+        }
+
+        struct list ready;
+        list_init(&ready);
+        lock(&ring->lock);
+        for (int i = 0; i < batch.count; i++)
+            io_poll_fd_ready(ring, batch.events[i].poll_fd, batch.events[i].types, &ready);
+        unlock(&ring->lock);
+
+        struct io_req *req, *tmp;
+        list_for_each_entry_safe(&ready, req, tmp, queue) {
+            list_remove(&req->queue);
+            if (req->opcode == IORING_OP_POLL_ADD_) {
+                io_ring_post(ring, req->user_data, req->poll.events);
+                io_req_free(req);
+            } else {
+                // it should be quick now
+                io_ring_queue_work(ring, req);
+            }
+        }
+    }
+    io_ring_poller_stop(ring, err);
+    io_ring_release(ring);
+    return NULL;
+}
+
+static int io_ring_poll_add(struct io_ring *ring, struct io_req *req, int types) {
+    int err;
+    lock(&ring->lock);
+    err = _ECANCELED;
+    if (ring->dead)
+        goto out;
+    err = _ENOMEM;
+    if (ring->poll == NULL && (ring->poll = poll_create()) == NULL)
+        goto out;
+    if (!ring->poller_running) {
+        pthread_t thread;
+        ring->refcount++;
+        if (pthread_create(&thread, NULL, io_ring_poller, ring) != 0) {
+            ring->refcount--;
+            goto out;
+        }
+        pthread_detach(thread);
+        ring->poller_running = true;
+    }
+
+    struct io_poll_fd *poll_fd;
+    bool found = false;
+    list_for_each_entry(&ring->poll_fds, poll_fd, ring_fds) {
+        if (poll_fd->fd == req->fd) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        poll_fd = malloc(sizeof(struct io_poll_fd));
+        if (poll_fd == NULL)
+            goto out;
+        poll_fd->fd = fd_retain(req->fd);
+        poll_fd->types = 0;
+        list_init(&poll_fd->reqs);
+    }
+    union poll_fd_info info = {.ptr = poll_fd};
+    if (found)
+        err = poll_mod_fd(ring->poll, poll_fd->fd, poll_fd->types | types | POLL_ONESHOT, info);
+    else
+        err = poll_add_fd(ring->poll, poll_fd->fd, types | POLL_ONESHOT, info);
+    if (err < 0) {
+        if (!found) {
+            fd_close(poll_fd->fd);
+            free(poll_fd);
+        }
+        goto out;
+    }
+    if (!found)
+        list_add(&ring->poll_fds, &poll_fd->ring_fds);
+    poll_fd->types |= types;
+    list_add_tail(&poll_fd->reqs, &req->queue);
+out:
+    unlock(&ring->lock);
+    return err;
+}
+
+static void io_ring_queue(struct io_ring *ring, struct io_req *req) {
+    int types = io_req_poll_types(req);
+    if (types != 0 && io_ring_poll_add(ring, req, types) == 0)
+        return;
+    io_ring_queue_work(ring, req);
+}
+
+// submission
+
+static struct fd *io_ring_get_fd(struct io_ring *ring, struct io_uring_sqe_ *sqe) {
+    if (sqe->flags & IOSQE_FIXED_FILE_) {
+        if ((unsigned) sqe->fd >= ring->nr_files || ring->files[sqe->fd] == NULL)
+            return NULL;
+        return fd_retain(ring->files[sqe->fd]);
+    }
+    struct fd *fd = f_get(sqe->fd);
+    if (fd == NULL)
+        return NULL;
+    return fd_retain(fd);
+}
+
+// Guest buffers have to fit in the request's user_iov. Ones too fragmented
+// for that fail, instead of quietly doing part of the IO, which for a send
+// would mean a truncated datagram.
+static int io_req_add_buffer(struct io_req *req, addr_t addr, size_t len, int type) {
+    size_t before = req->uiov.size;
+    int err = user_iov_add(&req->uiov, addr, len, type);
+    if (err < 0)
+        return err;
+    if (req->uiov.size - before != len)
+        return _EINVAL;
+    return 0;
+}
+
+static int io_req_prep_buffers(struct io_req *req, struct io_uring_sqe_ *sqe, int type) {
+    int err;
+    if (req->opcode == IORING_OP_READV_ || req->opcode == IORING_OP_WRITEV_) {
+        if (sqe->len > UIO_MAXIOV_)
+            return _EINVAL;
+        struct iovec_ iovecs[sqe->len];
+        if (user_read(sqe->addr, iovecs, sizeof(iovecs)))
+            return _EFAULT;
+        for (unsigned i = 0; i < sqe->len; i++) {
+            if ((err = io_req_add_buffer(req, iovecs[i].base, iovecs[i].len, type)) < 0)
+                return err;
+        }
+        return 0;
+    }
+
+    if (req->opcode == IORING_OP_READ_FIXED_ || req->opcode == IORING_OP_WRITE_FIXED_) {
+        if (sqe->buf_index >= req->ring->nr_bufs)
+            return _EFAULT;
+        struct iovec_ *buf = &req->ring->bufs[sqe->buf_index];
+        if (sqe->addr < buf->base || sqe->addr + sqe->len > (uint64_t) buf->base + buf->len)
+            return _EFAULT;
+    }
+    return io_req_add_buffer(req, sqe->addr, sqe->len, type);
+}
+
+static int io_req_prep(struct io_req *req, struct io_uring_sqe_ *sqe) {
+    int err;
+    if (!op_supported(sqe->opcode))
+        return _EINVAL;
+    if (sqe->flags & IOSQE_IO_DRAIN_)
+        TRACE("io_uring: IOSQE_IO_DRAIN ignored\n");
+    if (sqe->opcode != IORING_OP_NOP_ && sqe->opcode != IORING_OP_TIMEOUT_) {
+        req->fd = io_ring_get_fd(req->ring, sqe);
+        if (req->fd == NULL)
+            return _EBADF;
+    }
+
+    switch (sqe->opcode) {
+        case IORING_OP_READV_:
+        case IORING_OP_READ_:
+        case IORING_OP_READ_FIXED_:
+            return io_req_prep_buffers(req, sqe, MEM_WRITE);
+        case IORING_OP_WRITEV_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_WRITE_FIXED_:
+            return io_req_prep_buffers(req, sqe, MEM_READ);
+
+        case IORING_OP_SEND_:
+        case IORING_OP_RECV_:
+            if (req->fd->ops != &socket_fdops)
+                return _ENOTSOCK;
+            if ((err = io_req_add_buffer(req, sqe->addr, sqe->len,
+                            sqe->opcode == IORING_OP_RECV_ ? MEM_WRITE : MEM_READ)) < 0)
+                return err;
+            return 0;
+
+        case IORING_OP_CONNECT_:
+            if (req->fd->ops != &socket_fdops)
+                return _ENOTSOCK;
+            if (sqe->off > sizeof(req->connect.sockaddr))
+                return _EINVAL;
+            req->connect.sockaddr_len = sqe->off;
+            return sockaddr_read(sqe->addr, req->connect.sockaddr, req->connect.sockaddr_len);
+
+        case IORING_OP_ACCEPT_:
+            if (req->fd->ops != &socket_fdops)
+                return _ENOTSOCK;
+            if (sqe->op_flags & ~(O_CLOEXEC_|O_NONBLOCK_))
+                return _EINVAL;
+            if (sqe->addr != 0) {
+                dword_t sockaddr_len;
+                if (user_get(sqe->off, sockaddr_len))
+                    return _EFAULT;
+                req->accept.sockaddr_len = sockaddr_len;
+                if ((err = user_iov_add(&req->uiov, sqe->addr, sockaddr_len, MEM_WRITE)) < 0)
+                    return err;
+                if ((err = user_iov_add(&req->uiov, sqe->off, sizeof(dword_t), MEM_WRITE)) < 0)
+                    return err;
+                if (req->uiov.size != sockaddr_len + sizeof(dword_t))
+                    return _ENOMEM;
+            }
+            req->accept.files = current->files;
+            current->files->refcount++;
+            req->accept.nofile_limit = rlimit(RLIMIT_NOFILE_);
+            return 0;
+
+        case IORING_OP_TIMEOUT_: {
+            if (sqe->len != 1)
+                return _EINVAL;
+            struct kernel_timespec_ ts;
+            if (user_get(sqe->addr, ts))
+                return _EFAULT;
+            struct timespec timeout = {.tv_sec = ts.sec, .tv_nsec = ts.nsec};
+            if (sqe->op_flags & IORING_TIMEOUT_ABS_) {
+                req->timeout.deadline = timeout;
+            } else {
+                clock_gettime(CLOCK_MONOTONIC, &req->timeout.deadline);
+                req->timeout.deadline = timespec_add(req->timeout.deadline, timeout);
+            }
+            req->timeout.target = 0;
+            if (sqe->off != 0) {
+                lock(&req->ring->lock);
+                req->timeout.target = req->ring->completions + sqe->off;
+                unlock(&req->ring->lock);
+            }
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Requests that can't block are done right away instead of bothering a worker
+static bool io_req_inline(struct io_req *req) {
+    switch (req->opcode) {
+        case IORING_OP_NOP_:
+            return true;
+        case IORING_OP_READV_:
+        case IORING_OP_READ_:
+        case IORING_OP_READ_FIXED_:
+        case IORING_OP_WRITEV_:
+        case IORING_OP_WRITE_:
+        case IORING_OP_WRITE_FIXED_:
+        case IORING_OP_FSYNC_:
+            return S_ISREG(req->fd->type);
+    }
+    return false;
+}
+
+static int io_ring_submit(struct io_ring *ring, unsigned to_submit) {
+    struct io_rings_ *rings = ring->rings;
+    uint32_t head = rings->sq.head;
+    uint32_t tail = __atomic_load_n(&rings->sq.tail, __ATOMIC_ACQUIRE);
+    unsigned submitted = 0;
+    struct io_req *chain = NULL;
+    struct io_req **chain_end = &chain;
+    bool chain_inline = true;
+
+    while (submitted < to_submit && head != tail) {
+        uint32_t index = __atomic_load_n(&ring->sq_array[head & rings->sq_ring_mask], __ATOMIC_RELAXED);
+        head++;
+        if (index >= ring->sq_entries) {
+            __atomic_fetch_add(&rings->sq_dropped, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        struct io_uring_sqe_ sqe;
+        memcpy(&sqe, &ring->sqes[index], sizeof(sqe));
+        submitted++;
+
+        struct io_req *req = malloc(sizeof(struct io_req));
+        if (req == NULL) {
+            io_ring_post(ring, sqe.user_data, _ENOMEM);
+            continue;
+        }
+        memset(req, 0, offsetof(struct io_req, uiov));
+        user_iov_init(&req->uiov);
+        req->ring = ring;
+        ring->refcount++;
+        req->opcode = sqe.opcode;
+        req->user_data = sqe.user_data;
+        req->off = sqe.off;
+        req->len = sqe.len;
+        req->op_flags = sqe.op_flags;
+        req->hardlink = sqe.flags & IOSQE_IO_HARDLINK_;
+        if (sqe.opcode == IORING_OP_ACCEPT_)
+            req->accept.files = NULL;
+
+        int err = io_req_prep(req, &sqe);
+        if (err < 0) {
+            io_ring_post(ring, sqe.user_data, err);
+            io_req_free(req);
+            // a bad request breaks the chain it's in
+            for (struct io_req *r = chain, *next; r != NULL; r = next) {
+                next = r->link;
+                io_ring_post(ring, r->user_data, _ECANCELED);
+                io_req_free(r);
+            }
+            chain = NULL;
+            chain_end = &chain;
+            chain_inline = true;
+            continue;
+        }
+
+        *chain_end = req;
+        chain_end = &req->link;
+        chain_inline = chain_inline && io_req_inline(req);
+        if (sqe.flags & (IOSQE_IO_LINK_|IOSQE_IO_HARDLINK_))
+            continue;
+        if (chain_inline && !(sqe.flags & IOSQE_ASYNC_))
+            io_req_run_chain(chain);
+        else
+            io_ring_queue(ring, chain);
+        chain = NULL;
+        chain_end = &chain;
+        chain_inline = true;
+    }
+    // a chain can't continue past the end of a submission
+    if (chain != NULL) {
+        if (chain_inline)
+            io_req_run_chain(chain);
+        else
+            io_ring_queue(ring, chain);
+    }
+    __atomic_store_n(&rings->sq.head, head, __ATOMIC_RELEASE);
+    return submitted;
+}
+
+// The fd is retained so the ring can't be closed out from under the caller.
+// Release it with fd_close.
+static struct fd *io_ring_fd_get(fd_t f) {
+    struct fd *fd = f_get(f);
+    if (fd == NULL || fd->ops != &io_ring_fdops)
+        return NULL;
+    return fd_retain(fd);
+}
+
+dword_t sys_io_uring_enter(fd_t f, uint_t to_submit, uint_t min_complete, uint_t flags, addr_t sig_addr) {
+    STRACE("io_uring_enter(%d, %u, %u, %#x, %#x)", f, to_submit, min_complete, flags, sig_addr);
+    struct fd *fd = io_ring_fd_get(f);
+    if (fd == NULL)
+        return _EBADF;
+    struct io_ring *ring = fd->io_ring;
+    if (sig_addr != 0)
+        FIXME("io_uring_enter with a signal mask");
+
+    int submitted = 0;
+    if (to_submit > 0) {
+        lock(&ring->submit_lock);
+        submitted = io_ring_submit(ring, to_submit);
+        unlock(&ring->submit_lock);
+    }
+
+    int res = submitted;
+    if (flags & IORING_ENTER_GETEVENTS_) {
+        struct io_rings_ *rings = ring->rings;
+        lock(&ring->lock);
+        while (rings->cq.tail - __atomic_load_n(&rings->cq.head, __ATOMIC_ACQUIRE) < min_complete) {
+            int err = 0;
+            if (ring->dead)
+                err = _EBADF;
+            else
+                err = wait_for(&ring->cq_cond, &ring->lock, NULL);
+            if (err == _EINTR || err == _EBADF) {
+                if (submitted == 0)
+                    res = err;
+                break;
+            }
+        }
+        unlock(&ring->lock);
+    }
+    fd_close(fd);
+    return res;
+}
+
+// setup
+
+static unsigned round_up_pow2(unsigned n) {
+    unsigned pow = 1;
+    while (pow < n)
+        pow <<= 1;
+    return pow;
+}
+
+dword_t sys_io_uring_setup(uint_t entries, addr_t params_addr) {
+    STRACE("io_uring_setup(%u, %#x)", entries, params_addr);
+    struct io_uring_params_ params;
+    if (user_get(params_addr, params))
+        return _EFAULT;
+    if (params.flags & ~(IORING_SETUP_CQSIZE_|IORING_SETUP_CLAMP_))
+        return _EINVAL;
+
+    if (entries == 0)
+        return _EINVAL;
+    if (entries > IORING_MAX_ENTRIES_) {
+        if (!(params.flags & IORING_SETUP_CLAMP_))
+            return _EINVAL;
+        entries = IORING_MAX_ENTRIES_;
+    }
+    unsigned sq_entries = round_up_pow2(entries);
+    unsigned cq_entries = sq_entries * 2;
+    if (params.flags & IORING_SETUP_CQSIZE_) {
+        if (params.cq_entries == 0)
+            return _EINVAL;
+        if (params.cq_entries > IORING_MAX_ENTRIES_ * 2) {
+            if (!(params.flags & IORING_SETUP_CLAMP_))
+                return _EINVAL;
+            params.cq_entries = IORING_MAX_ENTRIES_ * 2;
+        }
+        cq_entries = round_up_pow2(params.cq_entries);
+        if (cq_entries < sq_entries)
+            return _EINVAL;
+    }
+
+    struct io_ring *ring = calloc(1, sizeof(struct io_ring));
+    if (ring == NULL)
+        return _ENOMEM;
+    size_t cqes_off = offsetof(struct io_rings_, cqes);
+    size_t sq_array_off = cqes_off + cq_entries * sizeof(struct io_uring_cqe_);
+    ring->rings_size = BYTES_ROUND_UP(sq_array_off + sq_entries * sizeof(uint32_t));
+    ring->sqes_size = BYTES_ROUND_UP(sq_entries * sizeof(struct io_uring_sqe_));
+    int err = ring->memfd = host_shm_create(ring->rings_size + ring->sqes_size);
+    if (err < 0)
+        goto out_free_ring;
+    ring->memory = mmap(NULL, ring->rings_size + ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+    err = _ENOMEM;
+    if (ring->memory == MAP_FAILED)
+        goto out_close_memfd;
+
+    ring->refcount = 1;
+    ring->rings = (struct io_rings_ *) ring->memory;
+    ring->sq_array = (uint32_t *) (ring->memory + sq_array_off);
+    ring->sqes = (struct io_uring_sqe_ *) (ring->memory + ring->rings_size);
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+    ring->rings->sq_ring_mask = sq_entries - 1;
+    ring->rings->cq_ring_mask = cq_entries - 1;
+    ring->rings->sq_ring_entries = sq_entries;
+    ring->rings->cq_ring_entries = cq_entries;
+    lock_init(&ring->submit_lock);
+    lock_init(&ring->lock);
+    cond_init(&ring->cq_cond);
+    cond_init(&ring->work_cond);
+    list_init(&ring->queue);
+    list_init(&ring->poll_fds);
+
+    params.sq_entries = sq_entries;
+    params.cq_entries = cq_entries;
+    params.features = IORING_FEAT_SINGLE_MMAP_ | IORING_FEAT_SUBMIT_STABLE_ | IORING_FEAT_RW_CUR_POS_;
+    params.sq_off = (struct io_sqring_offsets_) {
+        .head = offsetof(struct io_rings_, sq.head),
+        .tail = offsetof(struct io_rings_, sq.tail),
+        .ring_mask = offsetof(struct io_rings_, sq_ring_mask),
+        .ring_entries = offsetof(struct io_rings_, sq_ring_entries),
+        .flags = offsetof(struct io_rings_, sq_flags),
+        .dropped = offsetof(struct io_rings_, sq_dropped),
+        .array = sq_array_off,
+    };
+    params.cq_off = (struct io_cqring_offsets_) {
+        .head = offsetof(struct io_rings_, cq.head),
+        .tail = offsetof(struct io_rings_, cq.tail),
+        .ring_mask = offsetof(struct io_rings_, cq_ring_mask),
+        .ring_entries = offsetof(struct io_rings_, cq_ring_entries),
+        .overflow = offsetof(struct io_rings_, cq_overflow),
+        .cqes = cqes_off,
+        .flags = offsetof(struct io_rings_, cq_flags),
+    };
+    err = _EFAULT;
+    if (user_put(params_addr, params))
+        goto out_release;
+
+    err = _ENOMEM;
+    struct fd *fd = adhoc_fd_create(&io_ring_fdops);
+    if (fd == NULL)
+        goto out_release;
+    fd->io_ring = ring;
+    ring->fd = fd;
+    return f_install(fd, O_CLOEXEC_);
+
+out_release:
+    io_ring_release(ring);
+    return err;
+out_close_memfd:
+    close(ring->memfd);
+out_free_ring:
+    free(ring);
+    return err;
+}
+
+// registration
+
+static int io_ring_register_files(struct io_ring *ring, addr_t arg, uint_t nr_args) {
+    if (ring->files != NULL)
+        return _EBUSY;
+    if (nr_args == 0 || nr_args > IORING_MAX_FILES_)
+        return _EINVAL;
+    int32_t fds[nr_args];
+    if (user_read(arg, fds, sizeof(fds)))
+        return _EFAULT;
+    struct fd **files = calloc(nr_args, sizeof(struct fd *));
+    if (files == NULL)
+        return _ENOMEM;
+    for (unsigned i = 0; i < nr_args; i++) {
+        if (fds[i] == -1)
+            continue;
+        struct fd *fd = f_get(fds[i]);
+        if (fd == NULL || fd->ops == &io_ring_fdops) {
+            for (unsigned j = 0; j < i; j++)
+                if (files[j] != NULL)
+                    fd_close(files[j]);
+            free(files);
+            return _EBADF;
+        }
+        files[i] = fd_retain(fd);
+    }
+    ring->files = files;
+    ring->nr_files = nr_args;
+    return 0;
+}
+
+static int io_ring_unregister_files(struct io_ring *ring) {
+    if (ring->files == NULL)
+        return _ENXIO;
+    for (unsigned i = 0; i < ring->nr_files; i++)
+        if (ring->files[i] != NULL)
+            fd_close(ring->files[i]);
+    free(ring->files);
+    ring->files = NULL;
+    ring->nr_files = 0;
+    return 0;
+}
+
+// Buffers are only remembered so fixed reads and writes can be checked
+// against them, they aren't pinned.
+static int io_ring_register_buffers(struct io_ring *ring, addr_t arg, uint_t nr_args) {
+    if (ring->bufs != NULL)
+        return _EBUSY;
+    if (nr_args == 0 || nr_args > UIO_MAXIOV_)
+        return _EINVAL;
+    struct iovec_ *bufs = malloc(nr_args * sizeof(struct iovec_));
+    if (bufs == NULL)
+        return _ENOMEM;
+    if (user_read(arg, bufs, nr_args * sizeof(struct iovec_))) {
+        free(bufs);
+        return _EFAULT;
+    }
+    ring->bufs = bufs;
+    ring->nr_bufs = nr_args;
+    return 0;
+}
+
+static int io_ring_unregister_buffers(struct io_ring *ring) {
+    if (ring->bufs == NULL)
+        return _ENXIO;
+    free(ring->bufs);
+    ring->bufs = NULL;
+    ring->nr_bufs = 0;
+    return 0;
+}
+
+static int io_ring_probe(addr_t arg, uint_t nr_args) {
+    if (nr_args > 256)
+        nr_args = 256;
+    struct io_uring_probe_ probe = {};
+    probe.last_op = IORING_OP_LAST_ - 1;
+    probe.ops_len = nr_args < IORING_OP_LAST_ ? nr_args : IORING_OP_LAST_;
+    if (user_put(arg, probe))
+        return _EFAULT;
+    for (unsigned i = 0; i < probe.ops_len; i++) {
+        struct io_uring_probe_op_ op = {.op = i};
+        if (op_supported(i))
+            op.flags = IO_URING_OP_SUPPORTED_;
+        if (user_put(arg + sizeof(probe) + i * sizeof(op), op))
+            return _EFAULT;
+    }
+    return 0;
+}
+
+dword_t sys_io_uring_register(fd_t f, uint_t opcode, addr_t arg, uint_t nr_args) {
+    STRACE("io_uring_register(%d, %u, %#x, %u)", f, opcode, arg, nr_args);
+    struct fd *fd = io_ring_fd_get(f);
+    if (fd == NULL)
+        return _EBADF;
+    struct io_ring *ring = fd->io_ring;
+
+    lock(&ring->submit_lock);
+    int err;
+    switch (opcode) {
+        case IORING_REGISTER_BUFFERS_:
+            err = io_ring_register_buffers(ring, arg, nr_args);
+            break;
+        case IORING_UNREGISTER_BUFFERS_:
+            err = io_ring_unregister_buffers(ring);
+            break;
+        case IORING_REGISTER_FILES_:
+            err = io_ring_register_files(ring, arg, nr_args);
+            break;
+        case IORING_UNREGISTER_FILES_:
+            err = io_ring_unregister_files(ring);
+            break;
+        case IORING_REGISTER_PROBE_:
+            err = io_ring_probe(arg, nr_args);
+            break;
+        default:
+            TRACE("io_uring_register %d\n", opcode);
+            err = _EINVAL;
+    }
+    unlock(&ring->submit_lock);
+    fd_close(fd);
+    return err;
+}
+
+// the ring fd
+
+static int io_ring_mmap(struct fd *fd, struct mem *mem, page_t start, pages_t pages, off_t offset, int prot, int flags) {
+    struct io_ring *ring = fd->io_ring;
+    if (!(flags & MMAP_SHARED))
+        return _EINVAL;
+    off_t region;
+    size_t size;
+    switch (offset) {
+        case IORING_OFF_SQ_RING_:
+        case IORING_OFF_CQ_RING_:
+            region = 0;
+            size = ring->rings_size;
+            break;
+        case IORING_OFF_SQES_:
+            region = ring->rings_size;
+            size = ring->sqes_size;
+            break;
+        default:
+            return _EINVAL;
+    }
+    if (pages * PAGE_SIZE > size)
+        return _EINVAL;
+    void *memory = mmap(NULL, pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, region);
+    if (memory == MAP_FAILED)
+        return errno_map();
+    return pt_map(mem, start, pages, memory, prot | P_SHARED);
+}
+
+static int io_ring_poll(struct fd *fd) {
+    struct io_rings_ *rings = fd->io_ring->rings;
+    int types = POLL_WRITE;
+    if (__atomic_load_n(&rings->cq.tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&rings->cq.head, __ATOMIC_ACQUIRE))
+        types |= POLL_READ;
+    return types;
+}
+
+static int io_ring_close(struct fd *fd) {
+    struct io_ring *ring = fd->io_ring;
+    lock(&ring->lock);
+    ring->dead = true;
+    ring->fd = NULL;
+    struct list queue;
+    list_init(&queue);
+    // steal the queue so the requests can be freed without the lock
+    if (!list_empty(&ring->queue)) {
+        list_add_tail(&ring->queue, &queue);
+        list_remove(&ring->queue);
+        list_init(&ring->queue);
+    }
+    notify(&ring->work_cond);
+    notify(&ring->cq_cond);
+    unlock(&ring->lock);
+
+    while (!list_empty(&queue)) {
+        struct io_req *req = list_first_entry(&queue, struct io_req, queue);
+        list_remove(&req->queue);
+        io_req_free_chain(req);
+    }
+
+    lock(&ring->submit_lock);
+    io_ring_unregister_files(ring);
+    unlock(&ring->submit_lock);
+    io_ring_release(ring);
+    return 0;
+}
+
+static const struct fd_ops io_ring_fdops = {
+    .mmap = io_ring_mmap,
+    .poll = io_ring_poll,
+    .close = io_ring_close,
+};
@@ -0,0 +1,1172 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "kernel/calls.h"
+#include "kernel/ipc.h"
+#include "emu/memory.h"
+
+#define IPC_PRIVATE_ 0
+#define IPC_CREAT_ 01000
+#define IPC_EXCL_ 02000
+#define IPC_NOWAIT_ 04000
+
+#define IPC_RMID_ 0
+#define IPC_SET_ 1
+#define IPC_STAT_ 2
+#define IPC_INFO_ 3
+#define IPC_64_ 0x100
+
+#define SHM_RDONLY_ 010000
+#define SHM_RND_ 020000
+#define SHM_REMAP_ 040000
+#define SHM_LOCK_ 11
+#define SHM_UNLOCK_ 12
+#define SHM_STAT_ 13
+#define SHM_INFO_ 14
+
+#define GETPID_ 11
+#define GETVAL_ 12
+#define GETALL_ 13
+#define GETNCNT_ 14
+#define GETZCNT_ 15
+#define SETVAL_ 16
+#define SETALL_ 17
+#define SEM_STAT_ 18
+#define SEM_INFO_ 19
+#define SEM_UNDO_ 0x1000
+
+// the kernel's defaults
+#define IPCMNI 32768
+#define SHMMNI 4096
+#define SHMMIN 1
+#define SHMMAX 0xfffff000
+#define SHMALL (MEM_PAGES / 4)
+#define SEMMNI 32000
+#define SEMMSL 32000
+#define SEMMNS (SEMMNI * SEMMSL)
+#define SEMOPM 500
+#define SEMVMX 32767
+#define SEMAEM SEMVMX
+
+struct ipc64_perm_ {
+    int_t key;
+    uid_t_ uid;
+    uid_t_ gid;
+    uid_t_ cuid;
+    uid_t_ cgid;
+    word_t mode;
+    word_t pad1;
+    word_t seq;
+    word_t pad2;
+    dword_t unused1;
+    dword_t unused2;
+};
+
+struct shmid64_ds_ {
+    struct ipc64_perm_ perm;
+    uint_t segsz;
+    dword_t atime;
+    dword_t atime_high;
+    dword_t dtime;
+    dword_t dtime_high;
+    dword_t ctime;
+    dword_t ctime_high;
+    pid_t_ cpid;
+    pid_t_ lpid;
+    dword_t nattch;
+    dword_t unused4;
+    dword_t unused5;
+};
+
+struct shminfo64_ {
+    dword_t shmmax;
+    dword_t shmmin;
+    dword_t shmmni;
+    dword_t shmseg;
+    dword_t shmall;
+    dword_t unused[4];
+};
+
+struct shm_info_ {
+    int_t used_ids;
+    dword_t shm_tot;
+    dword_t shm_rss;
+    dword_t shm_swp;
+    dword_t swap_attempts;
+    dword_t swap_successes;
+};
+
+struct semid64_ds_ {
+    struct ipc64_perm_ perm;
+    dword_t otime;
+    dword_t otime_high;
+    dword_t ctime;
+    dword_t ctime_high;
+    dword_t nsems;
+    dword_t unused3;
+    dword_t unused4;
+};
+
+struct seminfo_ {
+    int_t semmap;
+    int_t semmni;
+    int_t semmns;
+    int_t semmnu;
+    int_t semmsl;
+    int_t semopm;
+    int_t semume;
+    int_t semusz;
+    int_t semvmx;
+    int_t semaem;
+};
+
+struct sembuf_ {
+    word_t num;
+    int16_t op;
+    int16_t flg;
+};
+
+struct kern_ipc_perm {
+    int_t key;
+    int id;
+    uid_t_ uid, gid;
+    uid_t_ cuid, cgid;
+    mode_t_ mode;
+    word_t seq;
+    bool deleted;
+};
+
+struct ipc_ids {
+    struct kern_ipc_perm **entries;
+    unsigned size;
+    unsigned in_use;
+    word_t seq;
+};
+
+struct shm_segment {
+    struct kern_ipc_perm perm; // must be first
+    size_t size;
+    int fd; // host shared memory object
+    unsigned nattch;
+    time_t atime, dtime, ctime;
+    pid_t_ cpid, lpid;
+};
+
+struct shm_attach {
+    struct list ns;
+    struct mem *mem;
+    // what the pages were mapped from, which is how shmdt finds the attach
+    // even if mremap has moved it. Retained so it can't be reused.
+    struct data *data;
+    pages_t pages;
+    struct shm_segment *seg;
+};
+
+struct sem {
+    int val;
+    pid_t_ pid;
+    unsigned ncnt, zcnt;
+};
+
+struct sem_set {
+    struct kern_ipc_perm perm; // must be first
+    unsigned refcount; // the id plus any tasks sleeping in semop
+    time_t otime, ctime;
+    cond_t cond;
+    struct list undos;
+    unsigned nsems;
+    struct sem sems[];
+};
+
+struct sem_undo {
+    struct list set;
+    struct task *task;
+    short adj[];
+};
+
+static struct ipc_namespace {
+    struct ipc_ids shm;
+    struct ipc_ids sem;
+    struct list shm_attaches;
+    pages_t shm_tot;
+    lock_t lock;
+} ipc_ns = {
+    .shm_attaches = LIST_INITIALIZER(ipc_ns.shm_attaches),
+    .lock = LOCK_INITIALIZER,
+};
+
+// ids
+
+static int ipc_id_add(struct ipc_ids *ids, struct kern_ipc_perm *perm, unsigned max) {
+    unsigned index;
+    for (index = 0; index < ids->size; index++)
+        if (ids->entries[index] == NULL)
+            break;
+    if (index >= max)
+        return _ENOSPC;
+    if (index >= ids->size) {
+        unsigned new_size = ids->size ? ids->size * 2 : 16;
+        if (new_size > max)
+            new_size = max;
+        struct kern_ipc_perm **new_entries = realloc(ids->entries, new_size * sizeof(*new_entries));
+        if (new_entries == NULL)
+            return _ENOMEM;
+        memset(new_entries + ids->size, 0, (new_size - ids->size) * sizeof(*new_entries));
+        ids->entries = new_entries;
+        ids->size = new_size;
+    }
+    ids->entries[index] = perm;
+    ids->in_use++;
+    perm->seq = ids->seq++;
+    perm->id = perm->seq * IPCMNI + index;
+    return perm->id;
+}
+
+static void ipc_id_remove(struct ipc_ids *ids, struct kern_ipc_perm *perm) {
+    ids->entries[perm->id % IPCMNI] = NULL;
+    ids->in_use--;
+    perm->deleted = true;
+    perm->key = IPC_PRIVATE_;
+}
+
+static struct kern_ipc_perm *ipc_id_lookup(struct ipc_ids *ids, int_t id) {
+    if (id < 0)
+        return NULL;
+    unsigned index = id % IPCMNI;
+    if (index >= ids->size || ids->entries[index] == NULL)
+        return NULL;
+    if (ids->entries[index]->id != id)
+        return NULL;
+    return ids->entries[index];
+}
+
+static struct kern_ipc_perm *ipc_key_lookup(struct ipc_ids *ids, int_t key) {
+    for (unsigned i = 0; i < ids->size; i++)
+        if (ids->entries[i] != NULL && ids->entries[i]->key == key)
+            return ids->entries[i];
+    return NULL;
+}
+
+static int ipc_max_index(struct ipc_ids *ids) {
+    int max = -1;
+    for (unsigned i = 0; i < ids->size; i++)
+        if (ids->entries[i] != NULL)
+            max = i;
+    return max;
+}
+
+static void ipc_perm_init(struct kern_ipc_perm *perm, int_t key, int_t flags) {
+    perm->key = key;
+    perm->uid = perm->cuid = current->euid;
+    perm->gid = perm->cgid = current->egid;
+    perm->mode = flags & 0777;
+    perm->deleted = false;
+}
+
+#define IPC_READ 4
+#define IPC_WRITE 2
+static bool ipc_permitted(struct kern_ipc_perm *perm, int want) {
+    if (superuser())
+        return true;
+    mode_t_ mode = perm->mode;
+    if (current->euid == perm->uid || current->euid == perm->cuid)
+        mode >>= 6;
+    else if (current->egid == perm->gid || current->egid == perm->cgid)
+        mode >>= 3;
+    return (mode & want) == want;
+}
+
+static bool ipc_owner(struct kern_ipc_perm *perm) {
+    return superuser() || current->euid == perm->uid || current->euid == perm->cuid;
+}
+
+static void ipc_perm_to_user(struct kern_ipc_perm *perm, struct ipc64_perm_ *out) {
+    memset(out, 0, sizeof(*out));
+    out->key = perm->key;
+    out->uid = perm->uid;
+    out->gid = perm->gid;
+    out->cuid = perm->cuid;
+    out->cgid = perm->cgid;
+    out->mode = perm->mode;
+    out->seq = perm->seq;
+}
+
+static void ipc_perm_set(struct kern_ipc_perm *perm, struct ipc64_perm_ *in) {
+    perm->uid = in->uid;
+    perm->gid = in->gid;
+    perm->mode = (perm->mode & ~0777) | (in->mode & 0777);
+}
+
+// look up the key or create a new object, shared by shmget and semget
+static struct kern_ipc_perm *ipc_get(struct ipc_ids *ids, int_t key, int_t flags) {
+    if (key == IPC_PRIVATE_)
+        return NULL;
+    struct kern_ipc_perm *perm = ipc_key_lookup(ids, key);
+    if (perm == NULL) {
+        if (!(flags & IPC_CREAT_))
+            return ERR_PTR(_ENOENT);
+        return NULL;
+    }
+    if ((flags & IPC_CREAT_) && (flags & IPC_EXCL_))
+        return ERR_PTR(_EEXIST);
+    if (!ipc_permitted(perm, (flags >> 6) & 7))
+        return ERR_PTR(_EACCES);
+    return perm;
+}
+
+// shared memory
+
+int host_shm_create(size_t size) {
+#if __linux__
+    int fd = syscall(SYS_memfd_create, "ish-shm", 0);
+#else
+    static atomic_uint counter;
+    char name[32];
+    sprintf(name, "/ish-shm-%d-%u", getpid(), counter++);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd >= 0)
+        shm_unlink(name);
+#endif
+    if (fd < 0)
+        return errno_map();
+    if (ftruncate(fd, size) < 0) {
+        int err = errno_map();
+        close(fd);
+        return err;
+    }
+    return fd;
+}
+
+static void shm_destroy(struct shm_segment *seg) {
+    ipc_ns.shm_tot -= PAGE_ROUND_UP(seg->size);
+    close(seg->fd);
+    free(seg);
+}
+
+int_t sys_shmget(int_t key, uint_t size, int_t flags) {
+    STRACE("shmget(%d, %u, %#x)", key, size, flags);
+    lock(&ipc_ns.lock);
+    struct shm_segment *seg = (struct shm_segment *) ipc_get(&ipc_ns.shm, key, flags);
+    int err = 0;
+    if (IS_ERR(seg)) {
+        err = PTR_ERR(seg);
+        goto out;
+    }
+    if (seg != NULL) {
+        err = _EINVAL;
+        if (size > seg->size)
+            goto out;
+        err = seg->perm.id;
+        goto out;
+    }
+
+    err = _EINVAL;
+    if (size < SHMMIN || size > SHMMAX)
+        goto out;
+    err = _ENOSPC;
+    if (ipc_ns.shm_tot + PAGE_ROUND_UP(size) > SHMALL)
+        goto out;
+    err = _ENOMEM;
+    seg = malloc(sizeof(struct shm_segment));
+    if (seg == NULL)
+        goto out;
+    seg->fd = host_shm_create(BYTES_ROUND_UP(size));
+    if (seg->fd < 0) {
+        err = seg->fd;
+        free(seg);
+        goto out;
+    }
+    ipc_perm_init(&seg->perm, key, flags);
+    seg->size = size;
+    seg->nattch = 0;
+    seg->atime = seg->dtime = 0;
+    seg->ctime = time(NULL);
+    seg->cpid = current->pid;
+    seg->lpid = 0;
+    err = ipc_id_add(&ipc_ns.shm, &seg->perm, SHMMNI);
+    if (err < 0) {
+        close(seg->fd);
+        free(seg);
+        goto out;
+    }
+    ipc_ns.shm_tot += PAGE_ROUND_UP(size);
+out:
+    unlock(&ipc_ns.lock);
+    return err;
+}
+
+static int do_shmat(int_t id, addr_t addr, int_t flags, addr_t *addr_out) {
+    STRACE("shmat(%d, %#x, %#x)", id, addr, flags);
+    if (flags & SHM_RND_)
+        addr = BYTES_ROUND_DOWN(addr);
+    if (PGOFFSET(addr) != 0)
+        return _EINVAL;
+    if (addr == 0 && (flags & SHM_REMAP_))
+        return _EINVAL;
+
+    lock(&ipc_ns.lock);
+    int err = _EINVAL;
+    struct shm_segment *seg = (struct shm_segment *) ipc_id_lookup(&ipc_ns.shm, id);
+    if (seg == NULL)
+        goto out_unlock;
+    err = _EACCES;
+    unsigned prot_flags = P_READ;
+    if (!(flags & SHM_RDONLY_))
+        prot_flags |= P_WRITE;
+    if (!ipc_permitted(&seg->perm, flags & SHM_RDONLY_ ? IPC_READ : IPC_READ | IPC_WRITE))
+        goto out_unlock;
+    err = _ENOMEM;
+    struct shm_attach *attach = malloc(sizeof(struct shm_attach));
+    if (attach == NULL)
+        goto out_unlock;
+
+    pages_t pages = PAGE_ROUND_UP(seg->size);
+    struct mem *mem = current->mem;
+    write_wrlock(&mem->lock);
+    page_t page;
+    if (addr == 0) {
+        err = _ENOMEM;
+        page = pt_find_hole(mem, pages);
+        if (page == BAD_PAGE)
+            goto out_free;
+    } else {
+        err = _EINVAL;
+        page = PAGE(addr);
+        if (!(flags & SHM_REMAP_) && !pt_is_hole(mem, page, pages))
+            goto out_free;
+    }
+    void *memory = mmap(NULL, pages * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if ((err = pt_map(mem, page, pages, memory, prot_flags | P_SHARED)) < 0) {
+        if (memory != MAP_FAILED)
+            munmap(memory, pages * PAGE_SIZE);
+        goto out_free;
+    }
+    write_wrunlock(&mem->lock);
+
+    attach->mem = mem;
+    attach->data = mem_pt(mem, page)->data;
+    data_retain(attach->data);
+    attach->pages = pages;
+    attach->seg = seg;
+    list_add(&ipc_ns.shm_attaches, &attach->ns);
+    seg->nattch++;
+    seg->atime = time(NULL);
+    seg->lpid = current->pid;
+    unlock(&ipc_ns.lock);
+    *addr_out = page << PAGE_BITS;
+    return 0;
+
+out_free:
+    write_wrunlock(&mem->lock);
+    free(attach);
+out_unlock:
+    unlock(&ipc_ns.lock);
+    return err;
+}
+
+addr_t sys_shmat(int_t id, addr_t addr, int_t flags) {
+    addr_t result;
+    int err = do_shmat(id, addr, flags, &result);
+    if (err < 0)
+        return err;
+    return result;
+}
+
+// called with ipc_ns.lock held
+static void shm_detach(struct shm_attach *attach) {
+    struct shm_segment *seg = attach->seg;
+    list_remove(&attach->ns);
+    data_release(attach->data);
+    free(attach);
+    seg->nattch--;
+    seg->dtime = time(NULL);
+    seg->lpid = current ? current->pid : 0;
+    if (seg->perm.deleted && seg->nattch == 0)
+        shm_destroy(seg);
+}
+
+int_t sys_shmdt(addr_t addr) {
+    STRACE("shmdt(%#x)", addr);
+    if (PGOFFSET(addr) != 0)
+        return _EINVAL;
+    struct mem *mem = current->mem;
+    page_t start = PAGE(addr);
+    lock(&ipc_ns.lock);
+    write_wrlock(&mem->lock);
+    struct pt_entry *start_entry = mem_pt(mem, start);
+    struct shm_attach *attach;
+    list_for_each_entry(&ipc_ns.shm_attaches, attach, ns) {
+        if (attach->mem == mem && start_entry != NULL &&
+                start_entry->data == attach->data && start_entry->offset == 0) {
+            // it might have been munmapped since, don't unmap whatever replaced it
+            for (page_t page = start; page < start + attach->pages; page++) {
+                struct pt_entry *entry = mem_pt(mem, page);
+                if (entry != NULL && entry->data == attach->data)
+                    pt_unmap(mem, page, 1, PT_FORCE);
+            }
+            write_wrunlock(&mem->lock);
+            shm_detach(attach);
+            unlock(&ipc_ns.lock);
+            return 0;
+        }
+    }
+    write_wrunlock(&mem->lock);
+    unlock(&ipc_ns.lock);
+    return _EINVAL;
+}
+
+void shm_mm_copy(struct mem *src, struct mem *dst) {
+    lock(&ipc_ns.lock);
+    struct shm_attach *attach;
+    list_for_each_entry(&ipc_ns.shm_attaches, attach, ns) {
+        if (attach->mem != src)
+            continue;
+        struct shm_attach *copy = malloc(sizeof(struct shm_attach));
+        if (copy == NULL)
+            continue;
+        *copy = *attach;
+        copy->mem = dst;
+        data_retain(copy->data);
+        list_add(&ipc_ns.shm_attaches, &copy->ns);
+        attach->seg->nattch++;
+    }
+    unlock(&ipc_ns.lock);
+}
+
+void shm_mm_release(struct mem *mem) {
+    lock(&ipc_ns.lock);
+    struct shm_attach *attach, *tmp;
+    list_for_each_entry_safe(&ipc_ns.shm_attaches, attach, tmp, ns) {
+        if (attach->mem == mem)
+            shm_detach(attach);
+    }
+    unlock(&ipc_ns.lock);
+}
+
+int_t sys_shmctl(int_t id, int_t cmd, addr_t buf_addr) {
+    STRACE("shmctl(%d, %d, %#x)", id, cmd, buf_addr);
+    bool ipc64 = cmd & IPC_64_;
+    cmd &= ~IPC_64_;
+    if (!ipc64 && (cmd == IPC_STAT_ || cmd == IPC_SET_ || cmd == SHM_STAT_ || cmd == IPC_INFO_)) {
+        FIXME("old style shmctl %d", cmd);
+        return _EINVAL;
+    }
+
+    if (cmd == IPC_INFO_) {
+        struct shminfo64_ info = {
+            .shmmax = SHMMAX, .shmmin = SHMMIN, .shmmni = SHMMNI,
+            .shmseg = SHMMNI, .shmall = SHMALL,
+        };
+        if (user_put(buf_addr, info))
+            return _EFAULT;
+        lock(&ipc_ns.lock);
+        int max = ipc_max_index(&ipc_ns.shm);
+        unlock(&ipc_ns.lock);
+        return max < 0 ? 0 : max;
+    }
+    if (cmd == SHM_INFO_) {
+        lock(&ipc_ns.lock);
+        struct shm_info_ info = {
+            .used_ids = ipc_ns.shm.in_use,
+            .shm_tot = ipc_ns.shm_tot,
+            .shm_rss = ipc_ns.shm_tot,
+        };
+        int max = ipc_max_index(&ipc_ns.shm);
+        unlock(&ipc_ns.lock);
+        if (user_put(buf_addr, info))
+            return _EFAULT;
+        return max < 0 ? 0 : max;
+    }
+
+    struct shmid64_ds_ ds;
+    if (cmd == IPC_SET_)
+        if (user_get(buf_addr, ds))
+            return _EFAULT;
+
+    lock(&ipc_ns.lock);
+    struct shm_segment *seg;
+    if (cmd == SHM_STAT_) {
+        seg = NULL;
+        if (id >= 0 && (unsigned) id < ipc_ns.shm.size)
+            seg = (struct shm_segment *) ipc_ns.shm.entries[id];
+    } else {
+        seg = (struct shm_segment *) ipc_id_lookup(&ipc_ns.shm, id);
+    }
+    int err = _EINVAL;
+    if (seg == NULL)
+        goto out;
+
+    switch (cmd) {
+        case IPC_STAT_:
+        case SHM_STAT_:
+            err = _EACCES;
+            if (!ipc_permitted(&seg->perm, IPC_READ))
+                break;
+            memset(&ds, 0, sizeof(ds));
+            ipc_perm_to_user(&seg->perm, &ds.perm);
+            ds.segsz = seg->size;
+            ds.atime = seg->atime;
+            ds.dtime = seg->dtime;
+            ds.ctime = seg->ctime;
+            ds.cpid = seg->cpid;
+            ds.lpid = seg->lpid;
+            ds.nattch = seg->nattch;
+            err = cmd == SHM_STAT_ ? seg->perm.id : 0;
+            break;
+
+        case IPC_SET_:
+            err = _EPERM;
+            if (!ipc_owner(&seg->perm))
+                break;
+            ipc_perm_set(&seg->perm, &ds.perm);
+            seg->ctime = time(NULL);
+            err = 0;
+            break;
+
+        case IPC_RMID_:
+            err = _EPERM;
+            if (!ipc_owner(&seg->perm))
+                break;
+            ipc_id_remove(&ipc_ns.shm, &seg->perm);
+            if (seg->nattch == 0)
+                shm_destroy(seg);
+            err = 0;
+            break;
+
+        case SHM_LOCK_:
+        case SHM_UNLOCK_:
+            err = 0;
+            break;
+
+        default:
+            FIXME("shmctl %d", cmd);
+            err = _EINVAL;
+            break;
+    }
+
+out:
+    unlock(&ipc_ns.lock);
+    if (err >= 0 && (cmd == IPC_STAT_ || cmd == SHM_STAT_))
+        if (user_put(buf_addr, ds))
+            return _EFAULT;
+    return err;
+}
+
+// semaphores
+
+static void sem_set_release(struct sem_set *set) {
+    if (--set->refcount != 0)
+        return;
+    struct sem_undo *undo, *tmp;
+    list_for_each_entry_safe(&set->undos, undo, tmp, set) {
+        list_remove(&undo->set);
+        free(undo);
+    }
+    cond_destroy(&set->cond);
+    free(set);
+}
+
+int_t sys_semget(int_t key, int_t nsems, int_t flags) {
+    STRACE("semget(%d, %d, %#x)", key, nsems, flags);
+    if (nsems < 0 || nsems > SEMMSL)
+        return _EINVAL;
+    lock(&ipc_ns.lock);
+    struct sem_set *set = (struct sem_set *) ipc_get(&ipc_ns.sem, key, flags);
+    int err = 0;
+    if (IS_ERR(set)) {
+        err = PTR_ERR(set);
+        goto out;
+    }
+    if (set != NULL) {
+        err = _EINVAL;
+        if ((unsigned) nsems > set->nsems)
+            goto out;
+        err = set->perm.id;
+        goto out;
+    }
+
+    err = _EINVAL;
+    if (nsems == 0)
+        goto out;
+    err = _ENOMEM;
+    set = calloc(1, sizeof(struct sem_set) + nsems * sizeof(struct sem));
+    if (set == NULL)
+        goto out;
+    ipc_perm_init(&set->perm, key, flags);
+    set->refcount = 1;
+    set->nsems = nsems;
+    set->otime = 0;
+    set->ctime = time(NULL);
+    cond_init(&set->cond);
+    list_init(&set->undos);
+    err = ipc_id_add(&ipc_ns.sem, &set->perm, SEMMNI);
+    if (err < 0) {
+        cond_destroy(&set->cond);
+        free(set);
+    }
+out:
+    unlock(&ipc_ns.lock);
+    return err;
+}
+
+static struct sem_undo *sem_undo_get(struct sem_set *set, struct task *task, bool create) {
+    struct sem_undo *undo;
+    list_for_each_entry(&set->undos, undo, set) {
+        if (undo->task == task)
+            return undo;
+    }
+    if (!create)
+        return NULL;
+    undo = calloc(1, sizeof(struct sem_undo) + set->nsems * sizeof(short));
+    if (undo == NULL)
+        return NULL;
+    undo->task = task;
+    list_add(&set->undos, &undo->set);
+    return undo;
+}
+
+static void sem_undo_clear(struct sem_set *set, int num) {
+    struct sem_undo *undo;
+    list_for_each_entry(&set->undos, undo, set) {
+        if (num < 0)
+            memset(undo->adj, 0, set->nsems * sizeof(short));
+        else
+            undo->adj[num] = 0;
+    }
+}
+
+// returns the index of the operation that has to wait, or -1 if they can all
+// be done right now
+static int sem_try(struct sem_set *set, struct sembuf_ *sops, unsigned nsops, int *err) {
+    *err = 0;
+    int vals[nsops];
+    for (unsigned i = 0; i < nsops; i++) {
+        int val = set->sems[sops[i].num].val;
+        // earlier operations on the same semaphore count
+        for (unsigned j = 0; j < i; j++)
+            if (sops[j].num == sops[i].num)
+                val = vals[j];
+        if (sops[i].op == 0 && val != 0)
+            return i;
+        if (val + sops[i].op < 0)
+            return i;
+        if (val + sops[i].op > SEMVMX) {
+            *err = _ERANGE;
+            return i;
+        }
+        vals[i] = val + sops[i].op;
+    }
+    return -1;
+}
+
+int_t sys_semtimedop(int_t id, addr_t sops_addr, uint_t nsops, addr_t timeout_addr) {
+    STRACE("semtimedop(%d, %#x, %u, %#x)", id, sops_addr, nsops, timeout_addr);
+    if (nsops == 0)
+        return _EINVAL;
+    if (nsops > SEMOPM)
+        return _E2BIG;
+    struct sembuf_ sops[nsops];
+    if (user_read(sops_addr, sops, sizeof(sops)))
+        return _EFAULT;
+    struct timespec timeout;
+    if (timeout_addr != 0) {
+        struct timespec_ timeout_;
+        if (user_get(timeout_addr, timeout_))
+            return _EFAULT;
+        if (timeout_.nsec >= 1000000000)
+            return _EINVAL;
+        timeout.tv_sec = timeout_.sec;
+        timeout.tv_nsec = timeout_.nsec;
+    }
+
+    bool alter = false;
+    bool undo_needed = false;
+    unsigned max_num = 0;
+    for (unsigned i = 0; i < nsops; i++) {
+        if (sops[i].num > max_num)
+            max_num = sops[i].num;
+        if (sops[i].op != 0)
+            alter = true;
+        if (sops[i].flg & SEM_UNDO_)
+            undo_needed = true;
+    }
+
+    lock(&ipc_ns.lock);
+    int err = _EINVAL;
+    struct sem_set *set = (struct sem_set *) ipc_id_lookup(&ipc_ns.sem, id);
+    if (set == NULL)
+        goto out;
+    err = _EFBIG;
+    if (max_num >= set->nsems)
+        goto out;
+    err = _EACCES;
+    if (!ipc_permitted(&set->perm, alter ? IPC_WRITE : IPC_READ))
+        goto out;
+    struct sem_undo *undo = NULL;
+    if (undo_needed) {
+        err = _ENOMEM;
+        undo = sem_undo_get(set, current, true);
+        if (undo == NULL)
+            goto out;
+    }
+
+    int blocked;
+    while ((blocked = sem_try(set, sops, nsops, &err)) >= 0) {
+        if (err < 0)
+            goto out;
+        struct sembuf_ *sop = &sops[blocked];
+        err = _EAGAIN;
+        if (sop->flg & IPC_NOWAIT_)
+            goto out;
+        struct sem *sem = &set->sems[sop->num];
+        if (sop->op == 0)
+            sem->zcnt++;
+        else
+            sem->ncnt++;
+        set->refcount++;
+        err = wait_for(&set->cond, &ipc_ns.lock, timeout_addr ? &timeout : NULL);
+        if (sop->op == 0)
+            sem->zcnt--;
+        else
+            sem->ncnt--;
+        if (set->perm.deleted) {
+            sem_set_release(set);
+            err = _EIDRM;
+            goto out;
+        }
+        set->refcount--;
+        if (err == _ETIMEDOUT)
+            err = _EAGAIN;
+        if (err < 0)
+            goto out;
+    }
+
+    for (unsigned i = 0; i < nsops; i++) {
+        struct sem *sem = &set->sems[sops[i].num];
+        sem->val += sops[i].op;
+        sem->pid = current->pid;
+        if (sops[i].flg & SEM_UNDO_)
+            undo->adj[sops[i].num] -= sops[i].op;
+    }
+    set->otime = time(NULL);
+    if (alter)
+        notify(&set->cond);
+    err = 0;
+out:
+    unlock(&ipc_ns.lock);
+    return err;
+}
+
+int_t sys_semop(int_t id, addr_t sops_addr, uint_t nsops) {
+    return sys_semtimedop(id, sops_addr, nsops, 0);
+}
+
+int_t sys_semctl(int_t id, int_t num, int_t cmd, dword_t arg) {
+    STRACE("semctl(%d, %d, %d, %#x)", id, num, cmd, arg);
+    bool ipc64 = cmd & IPC_64_;
+    cmd &= ~IPC_64_;
+    if (!ipc64 && (cmd == IPC_STAT_ || cmd == IPC_SET_ || cmd == SEM_STAT_)) {
+        FIXME("old style semctl %d", cmd);
+        return _EINVAL;
+    }
+
+    if (cmd == IPC_INFO_ || cmd == SEM_INFO_) {
+        struct seminfo_ info = {
+            .semmap = SEMMNS, .semmni = SEMMNI, .semmns = SEMMNS,
+            .semmnu = SEMMNS, .semmsl = SEMMSL, .semopm = SEMOPM,
+            .semume = SEMOPM, .semusz = sizeof(struct sem_undo),
+            .semvmx = SEMVMX, .semaem = SEMAEM,
+        };
+        lock(&ipc_ns.lock);
+        if (cmd == SEM_INFO_) {
+            info.semusz = ipc_ns.sem.in_use;
+            info.semaem = 0;
+            for (unsigned i = 0; i < ipc_ns.sem.size; i++)
+                if (ipc_ns.sem.entries[i] != NULL)
+                    info.semaem += ((struct sem_set *) ipc_ns.sem.entries[i])->nsems;
+        }
+        int max = ipc_max_index(&ipc_ns.sem);
+        unlock(&ipc_ns.lock);
+        if (user_put(arg, info))
+            return _EFAULT;
+        return max < 0 ? 0 : max;
+    }
+
+    struct semid64_ds_ ds;
+    if (cmd == IPC_SET_)
+        if (user_get(arg, ds))
+            return _EFAULT;
+
+    word_t *vals = NULL;
+    lock(&ipc_ns.lock);
+    struct sem_set *set;
+    if (cmd == SEM_STAT_) {
+        set = NULL;
+        if (id >= 0 && (unsigned) id < ipc_ns.sem.size)
+            set = (struct sem_set *) ipc_ns.sem.entries[id];
+    } else {
+        set = (struct sem_set *) ipc_id_lookup(&ipc_ns.sem, id);
+    }
+    int err = _EINVAL;
+    if (set == NULL)
+        goto out;
+
+    switch (cmd) {
+        case GETPID_:
+        case GETVAL_:
+        case GETNCNT_:
+        case GETZCNT_:
+        case SETVAL_:
+            err = _EINVAL;
+            if (num < 0 || (unsigned) num >= set->nsems)
+                goto out;
+    }
+
+    switch (cmd) {
+        case IPC_STAT_:
+        case SEM_STAT_:
+            err = _EACCES;
+            if (!ipc_permitted(&set->perm, IPC_READ))
+                break;
+            memset(&ds, 0, sizeof(ds));
+            ipc_perm_to_user(&set->perm, &ds.perm);
+            ds.otime = set->otime;
+            ds.ctime = set->ctime;
+            ds.nsems = set->nsems;
+            err = cmd == SEM_STAT_ ? set->perm.id : 0;
+            break;
+
+        case IPC_SET_:
+            err = _EPERM;
+            if (!ipc_owner(&set->perm))
+                break;
+            ipc_perm_set(&set->perm, &ds.perm);
+            set->ctime = time(NULL);
+            err = 0;
+            break;
+
+        case IPC_RMID_:
+            err = _EPERM;
+            if (!ipc_owner(&set->perm))
+                break;
+            ipc_id_remove(&ipc_ns.sem, &set->perm);
+            notify(&set->cond);
+            sem_set_release(set);
+            err = 0;
+            break;
+
+        case GETPID_:
+        case GETVAL_:
+        case GETNCNT_:
+        case GETZCNT_: {
+            err = _EACCES;
+            if (!ipc_permitted(&set->perm, IPC_READ))
+                break;
+            struct sem *sem = &set->sems[num];
+            err = cmd == GETPID_ ? sem->pid :
+                cmd == GETVAL_ ? sem->val :
+                cmd == GETNCNT_ ? (int) sem->ncnt : (int) sem->zcnt;
+            break;
+        }
+
+        case SETVAL_:
+            err = _EACCES;
+            if (!ipc_permitted(&set->perm, IPC_WRITE))
+                break;
+            err = _ERANGE;
+            if ((int_t) arg < 0 || (int_t) arg > SEMVMX)
+                break;
+            set->sems[num].val = arg;
+            set->sems[num].pid = current->pid;
+            sem_undo_clear(set, num);
+            set->ctime = time(NULL);
+            notify(&set->cond);
+            err = 0;
+            break;
+
+        case GETALL_:
+        case SETALL_: {
+            err = _EACCES;
+            if (!ipc_permitted(&set->perm, cmd == GETALL_ ? IPC_READ : IPC_WRITE))
+                break;
+            err = _ENOMEM;
+            vals = malloc(set->nsems * sizeof(word_t));
+            if (vals == NULL)
+                break;
+            size_t vals_size = set->nsems * sizeof(word_t);
+            if (cmd == GETALL_) {
+                for (unsigned i = 0; i < set->nsems; i++)
+                    vals[i] = set->sems[i].val;
+                err = 0;
+                if (user_write(arg, vals, vals_size))
+                    err = _EFAULT;
+                break;
+            }
+            err = _EFAULT;
+            if (user_read(arg, vals, vals_size))
+                break;
+            err = _ERANGE;
+            for (unsigned i = 0; i < set->nsems; i++)
+                if (vals[i] > SEMVMX)
+                    goto out;
+            for (unsigned i = 0; i < set->nsems; i++) {
+                set->sems[i].val = vals[i];
+                set->sems[i].pid = current->pid;
+            }
+            sem_undo_clear(set, -1);
+            set->ctime = time(NULL);
+            notify(&set->cond);
+            err = 0;
+            break;
+        }
+
+        default:
+            FIXME("semctl %d", cmd);
+            err = _EINVAL;
+            break;
+    }
+
+out:
+    unlock(&ipc_ns.lock);
+    free(vals);
+    if (err >= 0 && (cmd == IPC_STAT_ || cmd == SEM_STAT_))
+        if (user_put(arg, ds))
+            return _EFAULT;
+    return err;
+}
+
+void exit_sem(struct task *task) {
+    lock(&ipc_ns.lock);
+    for (unsigned i = 0; i < ipc_ns.sem.size; i++) {
+        struct sem_set *set = (struct sem_set *) ipc_ns.sem.entries[i];
+        if (set == NULL)
+            continue;
+        struct sem_undo *undo = sem_undo_get(set, task, false);
+        if (undo == NULL)
+            continue;
+        for (unsigned num = 0; num < set->nsems; num++) {
+            struct sem *sem = &set->sems[num];
+            if (undo->adj[num] == 0)
+                continue;
+            sem->val += undo->adj[num];
+            if (sem->val < 0)
+                sem->val = 0;
+            if (sem->val > SEMVMX)
+                sem->val = SEMVMX;
+            sem->pid = task->pid;
+        }
+        list_remove(&undo->set);
+        free(undo);
+        notify(&set->cond);
+    }
+    unlock(&ipc_ns.lock);
+}
+
+// the old multiplexer
+
+#define SEMOP 1
+#define SEMGET 2
+#define SEMCTL 3
+#define SEMTIMEDOP 4
+#define MSGSND 11
+#define MSGRCV 12
+#define MSGGET 13
+#define MSGCTL 14
+#define SHMAT 21
+#define SHMDT 22
+#define SHMGET 23
+#define SHMCTL 24
+
+int_t sys_ipc(uint_t call, int_t first, int_t second, int_t third, addr_t ptr, int_t fifth) {
+    int version = call >> 16;
+    switch (call & 0xffff) {
+        case SEMOP:
+            return sys_semtimedop(first, ptr, second, 0);
+        case SEMTIMEDOP:
+            return sys_semtimedop(first, ptr, second, fifth);
+        case SEMGET:
+            return sys_semget(first, second, third);
+        case SEMCTL: {
+            dword_t arg;
+            if (ptr == 0)
+                return _EINVAL;
+            if (user_get(ptr, arg))
+                return _EFAULT;
+            return sys_semctl(first, second, third, arg);
+        }
+
+        case SHMAT: {
+            if (version == 1)
+                return _EINVAL;
+            addr_t addr;
+            int err = do_shmat(first, ptr, second, &addr);
+            if (err < 0)
+                return err;
+            if (user_put(third, addr))
+                return _EFAULT;
+            return 0;
+        }
+        case SHMDT:
+            return sys_shmdt(ptr);
+        case SHMGET:
+            return sys_shmget(first, second, third);
+        case SHMCTL:
+            return sys_shmctl(first, second, ptr);
+
+        case MSGSND:
+        case MSGRCV:
+        case MSGGET:
+        case MSGCTL:
+            STRACE("ipc(%d)", call);
+            FIXME("message queues");
+            return _ENOSYS;
+    }
+    STRACE("ipc(%d)", call);
+    return _ENOSYS;
+}
+
+// /proc/sysvipc
+
+size_t ipc_show_shm(char *buf, size_t size) {
+    size_t n = 0;
+    n += sprintf(buf + n, "       key      shmid perms                  size  cpid  lpid nattch   uid   gid  cuid  cgid      atime      dtime      ctime                   rss                  swap\n");
+    lock(&ipc_ns.lock);
+    for (unsigned i = 0; i < ipc_ns.shm.size; i++) {
+        struct shm_segment *seg = (struct shm_segment *) ipc_ns.shm.entries[i];
+        if (seg == NULL)
+            continue;
+        if (n + 256 > size)
+            break;
+        n += sprintf(buf + n, "%10d %10d  %4o %21zu %5d %5d  %5u %5u %5u %5u %5u %10lld %10lld %10lld %21zu %21d\n",
+                seg->perm.key, seg->perm.id, seg->perm.mode, seg->size,
+                seg->cpid, seg->lpid, seg->nattch,
+                seg->perm.uid, seg->perm.gid, seg->perm.cuid, seg->perm.cgid,
+                (long long) seg->atime, (long long) seg->dtime, (long long) seg->ctime,
+                BYTES_ROUND_UP(seg->size), 0);
+    }
+    unlock(&ipc_ns.lock);
+    return n;
+}
+
+size_t ipc_show_sem(char *buf, size_t size) {
+    size_t n = 0;
+    n += sprintf(buf + n, "       key      semid perms      nsems   uid   gid  cuid  cgid      otime      ctime\n");
+    lock(&ipc_ns.lock);
+    for (unsigned i = 0; i < ipc_ns.sem.size; i++) {
+        struct sem_set *set = (struct sem_set *) ipc_ns.sem.entries[i];
+        if (set == NULL)
+            continue;
+        if (n + 256 > size)
+            break;
+        n += sprintf(buf + n, "%10d %10d  %4o %10u %5u %5u %5u %5u %10lld %10lld\n",
+                set->perm.key, set->perm.id, set->perm.mode, set->nsems,
+                set->perm.uid, set->perm.gid, set->perm.cuid, set->perm.cgid,
+                (long long) set->otime, (long long) set->ctime);
+    }
+    unlock(&ipc_ns.lock);
+    return n;
+}
@@ -0,0 +1,26 @@
+#ifndef KERNEL_IPC_H
+#define KERNEL_IPC_H
+
+#include "misc.h"
+struct task;
+struct mem;
+
+// System V shared memory and semaphores. There's only one IPC namespace.
+
+// Keep track of shm attachments across fork and address space teardown.
+// Called without the mem lock held.
+void shm_mm_copy(struct mem *src, struct mem *dst);
+void shm_mm_release(struct mem *mem);
+
+// Apply and free the task's semaphore undo records
+void exit_sem(struct task *task);
+
+// Returns a host fd for a shared memory object of the given size, which is
+// also used for io_uring's rings
+int host_shm_create(size_t size);
+
+// For /proc/sysvipc
+size_t ipc_show_shm(char *buf, size_t size);
+size_t ipc_show_sem(char *buf, size_t size);
+
+#endif
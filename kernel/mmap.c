@@ -5,6 +5,7 @@
 #include "fs/fd.h"
 #include "emu/memory.h"
 #include "kernel/mm.h"
+#include "kernel/ipc.h"
 
 struct mm *mm_new() {
     struct mm *mm = malloc(sizeof(struct mm));
@@ -27,6 +28,7 @@ struct mm *mm_copy(struct mm *mm) {
     read_wrlock(&mm->mem.lock);
     pt_copy_on_write(&mm->mem, &new_mm->mem, 0, MEM_PAGES);
     read_wrunlock(&mm->mem.lock);
+    shm_mm_copy(&mm->mem, &new_mm->mem);
     return new_mm;
 }
 
@@ -38,6 +40,7 @@ void mm_release(struct mm *mm) {
     if (--mm->refcount == 0) {
         if (mm->exefile != NULL)
             fd_close(mm->exefile);
+        shm_mm_release(&mm->mem);
         mem_destroy(&mm->mem);
         free(mm);
     }
@@ -114,48 +117,90 @@ int_t sys_munmap(addr_t addr, uint_t len) {
 #define MREMAP_MAYMOVE_ 1
 #define MREMAP_FIXED_ 2
 
-int_t sys_mremap(addr_t addr, dword_t old_len, dword_t new_len, dword_t flags) {
-    STRACE("mremap(%#x, %#x, %#x, %d)", addr, old_len, new_len, flags);
-    if (PGOFFSET(addr) != 0)
-        return _EINVAL;
-    if (flags & ~(MREMAP_MAYMOVE_ | MREMAP_FIXED_))
-        return _EINVAL;
+static addr_t do_mremap(addr_t addr, dword_t old_len, dword_t new_len, dword_t flags, addr_t new_addr) {
+    struct mem *mem = current->mem;
+    page_t page = PAGE(addr);
+    pages_t old_pages = PAGE_ROUND_UP(old_len);
+    pages_t new_pages = PAGE_ROUND_UP(new_len);
+
+    struct pt_entry *entry = mem_pt(mem, page);
+    if (entry == NULL)
+        return _EFAULT;
+    // pages can stop being cow independently, that doesn't split the mapping
+    dword_t pt_flags = entry->flags & ~(P_COW | P_COMPILED);
+    for (page_t p = page; p < page + old_pages; p++) {
+        entry = mem_pt(mem, p);
+        if (entry == NULL || (entry->flags & ~(P_COW | P_COMPILED)) != pt_flags)
+            return _EFAULT;
+    }
+    // The page table doesn't remember which file or shm segment a mapping
+    // came from, so there's nothing to map the new pages from. Fail the way
+    // Linux does when it can't grow a mapping, so callers like realloc fall
+    // back to mapping a new one and copying.
+    if (new_pages > old_pages && !(pt_flags & P_ANON))
+        return _ENOMEM;
+
     if (flags & MREMAP_FIXED_) {
-        FIXME("missing MREMAP_FIXED");
-        return _EINVAL;
+        if (PGOFFSET(new_addr) != 0)
+            return _EINVAL;
+        page_t new_page = PAGE(new_addr);
+        if (new_page < page + old_pages && page < new_page + new_pages)
+            return _EINVAL;
+        if (new_pages < old_pages) {
+            pt_unmap(mem, page + new_pages, old_pages - new_pages, PT_FORCE);
+            old_pages = new_pages;
+        }
+        pt_unmap(mem, new_page, new_pages, PT_FORCE);
+        pt_move(mem, page, old_pages, new_page);
+        if (new_pages > old_pages) {
+            int err = pt_grow(mem, new_page, old_pages, new_pages);
+            if (err < 0)
+                return err;
+        }
+        return new_addr;
     }
-    pages_t old_pages = PAGE(old_len);
-    pages_t new_pages = PAGE(new_len);
 
     // shrinking always works
     if (new_pages <= old_pages) {
-        int err = pt_unmap(current->mem, PAGE(addr) + new_pages, old_pages - new_pages, 0);
-        if (err < 0)
-            return _EFAULT;
+        if (new_pages < old_pages)
+            pt_unmap(mem, page + new_pages, old_pages - new_pages, PT_FORCE);
         return addr;
     }
 
-    struct pt_entry *entry = mem_pt(current->mem, PAGE(addr));
-    if (entry == NULL)
-        return _EFAULT;
-    dword_t pt_flags = entry->flags;
-    for (page_t page = PAGE(addr); page < PAGE(addr) + old_pages; page++) {
-        entry = mem_pt(current->mem, page);
-        if (entry == NULL && entry->flags != pt_flags)
-            return _EFAULT;
-    }
-    if (!(pt_flags & P_ANON)) {
-        FIXME("mremap grow on file mappings");
-        return _EFAULT;
+    if (!pt_is_hole(mem, page + old_pages, new_pages - old_pages)) {
+        if (!(flags & MREMAP_MAYMOVE_))
+            return _ENOMEM;
+        page_t new_page = pt_find_hole(mem, new_pages);
+        if (new_page == BAD_PAGE)
+            return _ENOMEM;
+        pt_move(mem, page, old_pages, new_page);
+        page = new_page;
     }
-    page_t extra_start = PAGE(addr) + old_pages;
-    pages_t extra_pages = new_pages - old_pages;
-    if (!pt_is_hole(current->mem, extra_start, extra_pages))
-        return _ENOMEM;
-    int err = pt_map_nothing(current->mem, extra_start, extra_pages, pt_flags);
+    int err = pt_grow(mem, page, old_pages, new_pages);
     if (err < 0)
         return err;
-    return addr;
+    return page << PAGE_BITS;
+}
+
+int_t sys_mremap(addr_t addr, dword_t old_len, dword_t new_len, dword_t flags, addr_t new_addr) {
+    STRACE("mremap(%#x, %#x, %#x, %d, %#x)", addr, old_len, new_len, flags, new_addr);
+    if (PGOFFSET(addr) != 0)
+        return _EINVAL;
+    if (flags & ~(MREMAP_MAYMOVE_ | MREMAP_FIXED_))
+        return _EINVAL;
+    if ((flags & MREMAP_FIXED_) && !(flags & MREMAP_MAYMOVE_))
+        return _EINVAL;
+    if (new_len == 0)
+        return _EINVAL;
+    if (old_len == 0) {
+        FIXME("mremap duplicating a shared mapping");
+        return _EINVAL;
+    }
+
+    write_wrlock(&current->mem->lock);
+    addr_t res = do_mremap(addr, old_len, new_len, flags, new_addr);
+    write_wrunlock(&current->mem->lock);
+    return res;
 }
 
 int_t sys_mprotect(addr_t addr, uint_t len, int_t prot) {
@@ -13,6 +13,25 @@ static int user_read_or_zero(addr_t addr, void *data, size_t size) {
     return 0;
 }
 
+// Checks an fd once without registering it anywhere
+static int poll_fd_now(struct fd *fd) {
+    if (fd->ops->poll == NULL)
+        return 0;
+    return fd->ops->poll(fd);
+}
+
+// The poll for when select or poll has to block. It belongs to the task, so
+// it's reused instead of setting up a new one every time.
+static struct poll *task_poll() {
+    if (current->poll == NULL)
+        current->poll = poll_create();
+    return current->poll;
+}
+
+static bool timeout_is_zero(struct timespec *timeout) {
+    return timeout != NULL && timeout->tv_sec == 0 && timeout->tv_nsec == 0;
+}
+
 #define SELECT_READ (POLL_READ | POLL_HUP | POLL_ERR)
 #define SELECT_WRITE (POLL_WRITE | POLL_ERR)
 #define SELECT_EX (POLL_PRI)
@@ -33,6 +52,16 @@ static int select_event_callback(void *context, int types, union poll_fd_info in
         return 0;
     return 1;
 }
+static int select_events(fd_t fd, char *readfds, char *writefds, char *exceptfds) {
+    int events = 0;
+    if (bit_test(fd, readfds))
+        events |= SELECT_READ;
+    if (bit_test(fd, writefds))
+        events |= SELECT_WRITE;
+    if (bit_test(fd, exceptfds))
+        events |= SELECT_EX;
+    return events;
+}
 dword_t sys_select(fd_t nfds, addr_t readfds_addr, addr_t writefds_addr, addr_t exceptfds_addr, addr_t timeout_addr) {
     STRACE("select(%d, 0x%x, 0x%x, 0x%x, 0x%x)", nfds, readfds_addr, writefds_addr, exceptfds_addr, timeout_addr);
     size_t fdset_size = BITS_SIZE(nfds);
@@ -55,42 +84,55 @@ dword_t sys_select(fd_t nfds, addr_t readfds_addr, addr_t writefds_addr, addr_t
         timeout_ts.tv_nsec = timeout_timeval.usec * 1000;
     }
 
-    struct poll *poll = poll_create();
-    if (poll == NULL)
-        return _ENOMEM;
-
+    // Check each fd once inline. If anything's ready, or there's no timeout,
+    // that's the whole answer and there's no need to set up a poll.
+    char readfds_out[fdset_size];
+    char writefds_out[fdset_size];
+    char exceptfds_out[fdset_size];
+    memset(readfds_out, 0, fdset_size);
+    memset(writefds_out, 0, fdset_size);
+    memset(exceptfds_out, 0, fdset_size);
+    struct select_context context = {readfds_out, writefds_out, exceptfds_out};
+    int err = 0;
     for (fd_t i = 0; i < nfds; i++) {
-        int events = 0;
-        if (bit_test(i, readfds))
-            events |= SELECT_READ;
-        if (bit_test(i, writefds))
-            events |= SELECT_WRITE;
-        if (bit_test(i, exceptfds))
-            events |= SELECT_EX;
-        if (events != 0) {
+        int events = select_events(i, readfds, writefds, exceptfds);
+        if (events == 0)
+            continue;
+        struct fd *fd = f_get(i);
+        if (fd == NULL)
+            return _EBADF;
+        int types = poll_fd_now(fd) & events;
+        if (types && select_event_callback(&context, types, (union poll_fd_info) i) == 1)
+            err++;
+    }
+
+    struct timespec *timeout = timeout_addr == 0 ? NULL : &timeout_ts;
+    if (err == 0 && !timeout_is_zero(timeout)) {
+        struct poll *poll = task_poll();
+        if (poll == NULL)
+            return _ENOMEM;
+        for (fd_t i = 0; i < nfds; i++) {
+            int events = select_events(i, readfds, writefds, exceptfds);
+            if (events == 0)
+                continue;
             struct fd *fd = f_get(i);
             if (fd == NULL) {
-                poll_destroy(poll);
+                poll_clear(poll);
                 return _EBADF;
             }
             poll_add_fd(poll, fd, events, (union poll_fd_info) i);
         }
+        err = poll_wait(poll, select_event_callback, &context, timeout);
+        poll_clear(poll);
+        if (err < 0)
+            return err;
     }
 
-    memset(readfds, 0, fdset_size);
-    memset(writefds, 0, fdset_size);
-    memset(exceptfds, 0, fdset_size);
-    struct select_context context = {readfds, writefds, exceptfds};
-    int err = poll_wait(poll, select_event_callback, &context, timeout_addr == 0 ? NULL : &timeout_ts);
-    poll_destroy(poll);
-    if (err < 0)
-        return err;
-
-    if (readfds_addr && user_write(readfds_addr, readfds, fdset_size))
+    if (readfds_addr && user_write(readfds_addr, readfds_out, fdset_size))
         return _EFAULT;
-    if (writefds_addr && user_write(writefds_addr, writefds, fdset_size))
+    if (writefds_addr && user_write(writefds_addr, writefds_out, fdset_size))
         return _EFAULT;
-    if (exceptfds_addr && user_write(exceptfds_addr, exceptfds, fdset_size))
+    if (exceptfds_addr && user_write(exceptfds_addr, exceptfds_out, fdset_size))
         return _EFAULT;
     return err;
 }
@@ -120,56 +162,71 @@ dword_t sys_poll(addr_t fds, dword_t nfds, int_t timeout) {
     if (fds != 0 || nfds != 0)
         if (user_read(fds, polls, sizeof(struct pollfd_) * nfds))
             return _EFAULT;
-    struct poll *poll = poll_create();
-    if (poll == NULL)
-        return _ENOMEM;
-
     struct fd *files[nfds];
     for (unsigned i = 0; i < nfds; i++) {
         files[i] = f_get(polls[i].fd);
         if (files[i] != NULL)
             // FIXME it might have been closed by now by another thread
             fd_retain(files[i]);
-        // clear revents, which is reused to mark whether a pollfd has been added or not
-        polls[i].revents = 0;
     }
 
-    // convert polls array into poll_add_fd calls
-    // FIXME this is quadratic
+    // Check each fd once inline. If anything's ready, or there's no timeout,
+    // that's the whole answer and there's no need to set up a poll.
+    int res = 0;
     for (unsigned i = 0; i < nfds; i++) {
-        if (polls[i].fd < 0 || polls[i].revents)
+        polls[i].revents = 0;
+        if (polls[i].fd < 0)
             continue;
-
-        // if the same fd is listed more than once, merge the events bits together
-        int events = polls[i].events;
-        polls[i].revents = 1;
         if (files[i] == NULL)
-            continue;
-        for (unsigned j = 0; j < nfds; j++) {
-            if (polls[j].revents)
+            polls[i].revents = POLL_NVAL;
+        else
+            polls[i].revents = poll_fd_now(files[i]) & (polls[i].events | POLL_ALWAYS_LISTENING);
+        if (polls[i].revents)
+            res++;
+    }
+
+    if (res == 0 && timeout != 0) {
+        struct poll *poll = task_poll();
+        if (poll == NULL) {
+            res = _ENOMEM;
+            goto out;
+        }
+
+        // convert polls array into poll_add_fd calls, revents marks whether
+        // a pollfd has been added or not
+        // FIXME this is quadratic
+        for (unsigned i = 0; i < nfds; i++) {
+            if (polls[i].fd < 0 || polls[i].revents)
                 continue;
-            if (files[i] == files[j]) {
-                events |= polls[j].events;
-                polls[j].revents = 1;
+
+            // if the same fd is listed more than once, merge the events bits together
+            int events = polls[i].events;
+            polls[i].revents = 1;
+            for (unsigned j = 0; j < nfds; j++) {
+                if (polls[j].revents)
+                    continue;
+                if (files[i] == files[j]) {
+                    events |= polls[j].events;
+                    polls[j].revents = 1;
+                }
             }
+
+            poll_add_fd(poll, files[i], events | POLL_ALWAYS_LISTENING, (union poll_fd_info) (void *) files[i]);
         }
 
-        poll_add_fd(poll, files[i], events | POLL_ALWAYS_LISTENING, (union poll_fd_info) (void *) files[i]);
+        for (unsigned i = 0; i < nfds; i++)
+            polls[i].revents = 0;
+        struct poll_context context = {polls, files, nfds};
+        struct timespec timeout_ts;
+        if (timeout != -1) {
+            timeout_ts.tv_sec = timeout / 1000;
+            timeout_ts.tv_nsec = (timeout % 1000) * 1000000;
+        }
+        res = poll_wait(poll, poll_event_callback, &context, timeout == -1 ? NULL : &timeout_ts);
+        poll_clear(poll);
     }
 
-    for (unsigned i = 0; i < nfds; i++) {
-        polls[i].revents = 0;
-        if (f_get(polls[i].fd) == NULL)
-            polls[i].revents = POLL_NVAL;
-    }
-    struct poll_context context = {polls, files, nfds};
-    struct timespec timeout_ts;
-    if (timeout != -1) {
-        timeout_ts.tv_sec = timeout / 1000;
-        timeout_ts.tv_nsec = (timeout % 1000) * 1000000;
-    }
-    int res = poll_wait(poll, poll_event_callback, &context, timeout == -1 ? NULL : &timeout_ts);
-    poll_destroy(poll);
+out:
     for (unsigned i = 0; i < nfds; i++) {
         if (files[i] != NULL)
             fd_close(files[i]);
@@ -1,5 +1,8 @@
 #include <fcntl.h>
+#include <string.h>
+#include <time.h>
 #include "kernel/calls.h"
+#include "kernel/random.h"
 
 #ifdef __APPLE__
 #include <CommonCrypto/CommonCrypto.h>
@@ -10,7 +13,18 @@
 #include <linux/random.h>
 #endif
 
-int get_random(char *buf, size_t len) {
+// Random numbers come from a ChaCha20 generator per host thread, seeded from
+// the host and reseeded every so often. Each refill replaces the key with
+// fresh output, so earlier output can't be recovered from the state.
+
+#define RNG_RESEED_BYTES (1 << 20)
+#define RNG_RESEED_SECONDS 300
+#define RNG_BUF_BLOCKS 8
+
+struct random_stats random_stats;
+
+static int get_random_host(void *buf, size_t len) {
+    random_stats.host_calls++;
 #ifdef __APPLE__
     return CCRandomGenerateBytes(buf, len) != kCCSuccess;
 #else
@@ -18,13 +32,155 @@ int get_random(char *buf, size_t len) {
 #endif
 }
 
-dword_t sys_getrandom(addr_t buf_addr, dword_t len, dword_t UNUSED(flags)) {
-    if (len > 256)
-        return _EIO;
-    char buf[256];
-    if (get_random(buf, len) != 0)
-        return _EIO;
-    if (user_write(buf_addr, buf, len))
-        return _EFAULT;
-    return len;
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL(d, 16); \
+    c += d; b ^= c; b = ROTL(b, 12); \
+    a += b; d ^= a; d = ROTL(d, 8); \
+    c += d; b ^= c; b = ROTL(b, 7)
+
+static void chacha20_block(const uint32_t key[8], uint64_t counter, uint32_t out[16]) {
+    uint32_t state[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574, // "expand 32-byte k"
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        (uint32_t) counter, (uint32_t) (counter >> 32), 0, 0,
+    };
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+        out[i] = x[i] + state[i];
+}
+
+static __thread struct rng {
+    bool seeded;
+    uint32_t key[8];
+    uint64_t counter;
+    uint32_t buf[RNG_BUF_BLOCKS * 16];
+    size_t buf_left; // unused bytes at the end of buf
+    size_t since_reseed;
+    time_t reseed_time;
+} rng;
+
+static void rng_reseed(void) {
+    uint32_t seed[8];
+    if (get_random_host(seed, sizeof(seed)) != 0) {
+        // keep going with the old key rather than fail, unless there isn't one
+        if (rng.seeded)
+            return;
+        die("can't get random numbers from the host");
+    }
+    for (int i = 0; i < 8; i++)
+        rng.key[i] ^= seed[i];
+    memset(seed, 0, sizeof(seed));
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rng.reseed_time = now.tv_sec;
+    rng.since_reseed = 0;
+    rng.seeded = true;
+    random_stats.reseeds++;
+}
+
+static void rng_check_reseed(void) {
+    if (!rng.seeded || rng.since_reseed >= RNG_RESEED_BYTES) {
+        rng_reseed();
+        return;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - rng.reseed_time >= RNG_RESEED_SECONDS)
+        rng_reseed();
+}
+
+// the first block of each refill becomes the next key
+static void rng_refill(void) {
+    rng_check_reseed();
+    uint32_t block[16];
+    chacha20_block(rng.key, rng.counter++, block);
+    memcpy(rng.key, block, sizeof(rng.key));
+    for (int i = 0; i < RNG_BUF_BLOCKS; i++)
+        chacha20_block(rng.key, rng.counter++, &rng.buf[i * 16]);
+    memset(block, 0, sizeof(block));
+    rng.buf_left = sizeof(rng.buf);
+}
+
+static void rng_take(char *out, size_t len) {
+    char *buf = (char *) rng.buf + sizeof(rng.buf) - rng.buf_left;
+    memcpy(out, buf, len);
+    memset(buf, 0, len);
+    rng.buf_left -= len;
+}
+
+int get_random(char *buf, size_t len) {
+    random_stats.requests++;
+    random_stats.bytes += len;
+    size_t chunk = len < rng.buf_left ? len : rng.buf_left;
+    rng_take(buf, chunk);
+    buf += chunk;
+    len -= chunk;
+
+    // big requests get whole blocks generated right into place
+    if (len >= sizeof(rng.buf)) {
+        rng_check_reseed();
+        while (len >= 64) {
+            uint32_t block[16];
+            chacha20_block(rng.key, rng.counter++, block);
+            memcpy(buf, block, sizeof(block));
+            buf += 64;
+            len -= 64;
+            rng.since_reseed += 64;
+        }
+        // don't leave behind the key that made that
+        rng_refill();
+    }
+
+    while (len > 0) {
+        if (rng.buf_left == 0)
+            rng_refill();
+        chunk = len < rng.buf_left ? len : rng.buf_left;
+        rng_take(buf, chunk);
+        rng.since_reseed += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+#define GRND_NONBLOCK_ 0x1
+#define GRND_RANDOM_ 0x2
+#define GRND_INSECURE_ 0x4
+
+dword_t sys_getrandom(addr_t buf_addr, dword_t len, dword_t flags) {
+    STRACE("getrandom(%#x, %u, %#x)", buf_addr, len, flags);
+    if (flags & ~(GRND_NONBLOCK_|GRND_RANDOM_|GRND_INSECURE_))
+        return _EINVAL;
+    if ((flags & GRND_RANDOM_) && (flags & GRND_INSECURE_))
+        return _EINVAL;
+    if (len > INT32_MAX)
+        len = INT32_MAX;
+
+    // generate straight into guest memory
+    dword_t done = 0;
+    while (done < len) {
+        struct user_iov uiov;
+        if (user_iov_get(&uiov, buf_addr + done, len - done, MEM_WRITE) < 0)
+            return done > 0 ? done : _EFAULT;
+        for (int i = 0; i < uiov.count; i++)
+            get_random(uiov.iov[i].iov_base, uiov.iov[i].iov_len);
+        done += uiov.size;
+        user_iov_put(&uiov);
+        // like linux, big reads can be interrupted
+        if (done < len && current->pending)
+            break;
+    }
+    return done;
 }
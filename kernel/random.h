@@ -2,7 +2,18 @@
 #define KERNEL_RANDOM_H
 
 #include <stdlib.h>
+#include "misc.h"
 
+// Never fails, the return value is just for compatibility
 int get_random(char *buf, size_t len);
 
+// Only approximate, since they're updated without synchronization
+struct random_stats {
+    uint64_t bytes;
+    uint64_t requests;
+    uint64_t reseeds;
+    uint64_t host_calls;
+};
+extern struct random_stats random_stats;
+
 #endif
@@ -3,6 +3,7 @@
 #include <string.h>
 #include "kernel/calls.h"
 #include "kernel/task.h"
+#include "fs/poll.h"
 #include "emu/memory.h"
 
 __thread struct task *current;
@@ -68,6 +69,7 @@ struct task *task_create_(struct task *parent) {
     unlock(&pids_lock);
 
     task->did_exec = false;
+    task->poll = NULL;
     task->sockrestart = (struct task_sockrestart) {};
     list_init(&task->sockrestart.listen);
 
@@ -81,6 +83,8 @@ struct task *task_create_(struct task *parent) {
 void task_destroy(struct task *task) {
     list_remove(&task->siblings);
     pid_get(task->pid)->task = NULL;
+    if (task->poll != NULL)
+        poll_destroy(task->poll);
     free(task);
 }
 
@@ -67,6 +67,9 @@ struct task {
 
     struct task_sockrestart sockrestart;
 
+    // reused by select and poll when they have to block, created on first use
+    struct poll *poll;
+
     // current condition/lock, so it can be notified in case of a signal
     cond_t *waiting_cond;
     lock_t *waiting_lock;
@@ -1,61 +1,130 @@
+#include <string.h>
 #include "kernel/calls.h"
 
-int user_read_task(struct task *task, addr_t addr, void *buf, size_t count) {
+// Copies go a page at a time, so each page is only looked up once (and on
+// write, only has its COW broken and compiled code thrown out once).
+static int user_copy_task(struct task *task, addr_t addr, void *buf, size_t count, int type) {
     char *cbuf = (char *) buf;
-    size_t i = 0;
-    while (i < count) {
-        char *ptr = mem_ptr(task->mem, addr + i, MEM_READ);
+    while (count > 0) {
+        size_t chunk = PAGE_SIZE - PGOFFSET(addr);
+        if (chunk > count)
+            chunk = count;
+        char *ptr = mem_ptr(task->mem, addr, type);
         if (ptr == NULL)
             return 1;
-        cbuf[i++] = *ptr;
+        if (type == MEM_WRITE)
+            memcpy(ptr, cbuf, chunk);
+        else
+            memcpy(cbuf, ptr, chunk);
+        addr += chunk;
+        cbuf += chunk;
+        count -= chunk;
     }
     return 0;
 }
 
+int user_read_task(struct task *task, addr_t addr, void *buf, size_t count) {
+    return user_copy_task(task, addr, buf, count, MEM_READ);
+}
+
 int user_read(addr_t addr, void *buf, size_t count) {
     return user_read_task(current, addr, buf, count);
 }
 
 int user_write_task(struct task *task, addr_t addr, const void *buf, size_t count) {
-    const char *cbuf = (const char *) buf;
-    size_t i = 0;
-    while (i < count) {
-        char *ptr = mem_ptr(task->mem, addr + i, MEM_WRITE);
-        if (ptr == NULL)
-            return 1;
-        *ptr = cbuf[i++];
-    }
-    return 0;
+    return user_copy_task(task, addr, (void *) buf, count, MEM_WRITE);
 }
 
 int user_write(addr_t addr, const void *buf, size_t count) {
     return user_write_task(current, addr, buf, count);
 }
 
-int user_read_string(addr_t addr, char *buf, size_t max) {
+ssize_t user_copy_string(addr_t addr, char *buf, size_t max) {
     if (addr == 0)
-        return 1;
+        return _EFAULT;
     size_t i = 0;
     while (i < max) {
-        if (user_read(addr + i, &buf[i], sizeof(buf[i])))
-            return 1;
-        if (buf[i] == '\0')
-            break;
-        i++;
+        size_t chunk = PAGE_SIZE - PGOFFSET(addr + i);
+        if (chunk > max - i)
+            chunk = max - i;
+        const char *ptr = mem_ptr(current->mem, addr + i, MEM_READ);
+        if (ptr == NULL)
+            return _EFAULT;
+        const char *nul = memchr(ptr, '\0', chunk);
+        if (nul != NULL) {
+            memcpy(buf + i, ptr, nul - ptr + 1);
+            return i + (nul - ptr);
+        }
+        memcpy(buf + i, ptr, chunk);
+        i += chunk;
     }
+    return _ENAMETOOLONG;
+}
+
+int user_read_string(addr_t addr, char *buf, size_t max) {
+    ssize_t len = user_copy_string(addr, buf, max);
+    if (len == _EFAULT)
+        return 1;
     return 0;
 }
 
 int user_write_string(addr_t addr, const char *buf) {
     if (addr == 0)
         return 1;
-    size_t i = 0;
-    while (buf[i] != '\0') {
-        if (user_write(addr + i, &buf[i], sizeof(buf[i])))
-            return 1;
-        i++;
+    return user_write(addr, buf, strlen(buf) + 1);
+}
+
+void user_iov_init(struct user_iov *uiov) {
+    uiov->count = 0;
+    uiov->size = 0;
+}
+
+int user_iov_add(struct user_iov *uiov, addr_t addr, size_t size, int type) {
+    struct mem *mem = current->mem;
+    read_wrlock(&mem->lock);
+    size_t done = 0;
+    while (done < size) {
+        addr_t chunk_addr = addr + done;
+        size_t chunk = PAGE_SIZE - PGOFFSET(chunk_addr);
+        if (chunk > size - done)
+            chunk = size - done;
+        char *ptr = mem_ptr(mem, chunk_addr, type);
+        if (ptr == NULL) {
+            read_wrunlock(&mem->lock);
+            return _EFAULT;
+        }
+        struct data *data = mem_pt(mem, PAGE(chunk_addr))->data;
+
+        struct iovec *last = uiov->count > 0 ? &uiov->iov[uiov->count - 1] : NULL;
+        if (last != NULL && uiov->data[uiov->count - 1] == data &&
+                (char *) last->iov_base + last->iov_len == ptr) {
+            last->iov_len += chunk;
+        } else {
+            if (uiov->count == USER_IOV_MAX)
+                break;
+            data_retain(data);
+            uiov->data[uiov->count] = data;
+            uiov->iov[uiov->count].iov_base = ptr;
+            uiov->iov[uiov->count].iov_len = chunk;
+            uiov->count++;
+        }
+        done += chunk;
     }
-    if (user_write(addr + i, &buf[i], sizeof(buf[i])))
-        return 1;
+    read_wrunlock(&mem->lock);
+    uiov->size += done;
     return 0;
 }
+
+int user_iov_get(struct user_iov *uiov, addr_t addr, size_t size, int type) {
+    user_iov_init(uiov);
+    int err = user_iov_add(uiov, addr, size, type);
+    if (err < 0)
+        user_iov_put(uiov);
+    return err;
+}
+
+void user_iov_put(struct user_iov *uiov) {
+    for (int i = 0; i < uiov->count; i++)
+        data_release(uiov->data[i]);
+    uiov->count = 0;
+}
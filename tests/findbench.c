@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures walking a directory tree the way find does it.
+//   findbench make dir [width] [depth] [files]  create a tree of width^depth directories with files in each
+//   findbench walk dir                          walk the tree, stat only entries whose type isn't known
+//   findbench stat dir                          walk the tree, stat every entry, and check
+//                                               that d_type agrees with lstat where it's known
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long entries, stats, mismatches;
+
+static void make(const char *dir, int width, int depth, int files) {
+    if (mkdir(dir, 0755) < 0) {
+        perror(dir);
+        exit(1);
+    }
+    char path[4096];
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/file%d", dir, i);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            perror(path);
+            exit(1);
+        }
+        close(fd);
+    }
+    if (depth == 0)
+        return;
+    for (int i = 0; i < width; i++) {
+        snprintf(path, sizeof(path), "%s/dir%d", dir, i);
+        make(path, width, depth - 1, files);
+    }
+}
+
+static void walk(const char *dir, int always_stat) {
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        perror(dir);
+        exit(1);
+    }
+    struct dirent *ent;
+    char path[4096];
+    while ((ent = readdir(d)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        entries++;
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+        int is_dir = ent->d_type == DT_DIR;
+        if (always_stat || ent->d_type == DT_UNKNOWN) {
+            struct stat statbuf;
+            stats++;
+            if (lstat(path, &statbuf) < 0) {
+                perror(path);
+                exit(1);
+            }
+            is_dir = S_ISDIR(statbuf.st_mode);
+            if (ent->d_type != DT_UNKNOWN && ent->d_type != IFTODT(statbuf.st_mode)) {
+                fprintf(stderr, "%s: d_type %d but lstat says %d\n", path, ent->d_type, IFTODT(statbuf.st_mode));
+                mismatches++;
+            }
+        }
+        if (is_dir)
+            walk(path, always_stat);
+    }
+    closedir(d);
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: %s make dir [width] [depth] [files] | walk dir | stat dir\n", argv[0]);
+        return 1;
+    }
+    double start = now();
+    if (strcmp(argv[1], "make") == 0) {
+        int width = argc > 3 ? atoi(argv[3]) : 10;
+        int depth = argc > 4 ? atoi(argv[4]) : 3;
+        int files = argc > 5 ? atoi(argv[5]) : 10;
+        make(argv[2], width, depth, files);
+        printf("make: %.3f s\n", now() - start);
+    } else if (strcmp(argv[1], "walk") == 0 || strcmp(argv[1], "stat") == 0) {
+        walk(argv[2], strcmp(argv[1], "stat") == 0);
+        printf("%s: %ld entries, %ld stats in %.3f s\n", argv[1], entries, stats, now() - start);
+        if (mismatches > 0) {
+            printf("%ld entries with the wrong d_type\n", mismatches);
+            return 1;
+        }
+    } else {
+        fprintf(stderr, "unknown command %s\n", argv[1]);
+        return 1;
+    }
+}
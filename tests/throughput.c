@@ -0,0 +1,79 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Measures read/write throughput the way cat and dd use them.
+//   throughput cat [file]              copy file (default stdin) to /dev/null with 64k reads
+//   throughput dd [bs] [count] [file]  copy count blocks of bs bytes from file (default /dev/zero) to /dev/null
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long copy(int in, int out, char *buf, size_t bs, long long count) {
+    long long total = 0;
+    for (long long i = 0; count < 0 || i < count; i++) {
+        ssize_t n = read(in, buf, bs);
+        if (n < 0) {
+            perror("read");
+            exit(1);
+        }
+        if (n == 0)
+            break;
+        if (write(out, buf, n) != n) {
+            perror("write");
+            exit(1);
+        }
+        total += n;
+    }
+    return total;
+}
+
+static void report(const char *name, long long bytes, double seconds) {
+    printf("%s: %lld bytes in %.3f s, %.1f MB/s\n", name, bytes, seconds, bytes / seconds / 1e6);
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2 || (strcmp(argv[1], "cat") != 0 && strcmp(argv[1], "dd") != 0)) {
+        fprintf(stderr, "usage: %s cat [file] | dd [bs] [count] [file]\n", argv[0]);
+        return 1;
+    }
+    int null = open("/dev/null", O_WRONLY);
+    if (null < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    if (strcmp(argv[1], "cat") == 0) {
+        int in = STDIN_FILENO;
+        if (argc > 2)
+            in = open(argv[2], O_RDONLY);
+        if (in < 0) {
+            perror(argv[2]);
+            return 1;
+        }
+        size_t bs = 65536;
+        char *buf = malloc(bs);
+        double start = now();
+        long long total = copy(in, null, buf, bs, -1);
+        report("cat", total, now() - start);
+    } else {
+        size_t bs = argc > 2 ? strtoul(argv[2], NULL, 0) : 4096;
+        long long count = argc > 3 ? strtoll(argv[3], NULL, 0) : 65536;
+        const char *file = argc > 4 ? argv[4] : "/dev/zero";
+        int in = open(file, O_RDONLY);
+        if (in < 0) {
+            perror(file);
+            return 1;
+        }
+        char *buf = malloc(bs);
+        double start = now();
+        long long total = copy(in, null, buf, bs, count);
+        report("dd", total, now() - start);
+    }
+}
@@ -0,0 +1,14 @@
+#ifndef UTIL_HASH_H
+#define UTIL_HASH_H
+
+// FNV-1a. Start from HASH_INIT, or from another hash to mix it in.
+#define HASH_INIT 2166136261u
+static inline unsigned hash_str(unsigned hash, const char *str) {
+    for (const char *c = str; *c; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+#endif
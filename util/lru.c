@@ -0,0 +1,35 @@
+#include "util/lru.h"
+
+void lru_init(struct lru *lru, struct list *buckets, unsigned buckets_count, unsigned max) {
+    lru->buckets = buckets;
+    lru->buckets_count = buckets_count;
+    for (unsigned i = 0; i < buckets_count; i++)
+        list_init(&buckets[i]);
+    list_init(&lru->lru);
+    lru->count = 0;
+    lru->max = max;
+}
+
+void lru_insert(struct lru *lru, struct lru_entry *entry, unsigned hash) {
+    entry->hash = hash;
+    list_add(&lru->buckets[hash % lru->buckets_count], &entry->chain);
+    list_add(&lru->lru, &entry->lru);
+    lru->count++;
+}
+
+void lru_remove(struct lru *lru, struct lru_entry *entry) {
+    list_remove(&entry->chain);
+    list_remove(&entry->lru);
+    lru->count--;
+}
+
+void lru_touch(struct lru *lru, struct lru_entry *entry) {
+    list_remove(&entry->lru);
+    list_add(&lru->lru, &entry->lru);
+}
+
+struct lru_entry *lru_victim(struct lru *lru) {
+    if (lru->count < lru->max || list_empty(&lru->lru))
+        return NULL;
+    return list_entry(lru->lru.prev, struct lru_entry, lru);
+}
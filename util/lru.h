@@ -0,0 +1,39 @@
+#ifndef UTIL_LRU_H
+#define UTIL_LRU_H
+#include "util/list.h"
+
+// A hash table of a bounded number of entries that remembers which ones were
+// used least recently. Entries are embedded in the caller's structs, and the
+// caller owns the keys: find things by walking the bucket for a hash with
+// lru_for_each_hashed and comparing. No locking, that's the caller's job.
+
+struct lru_entry {
+    unsigned hash;
+    struct list chain;
+    struct list lru;
+};
+
+struct lru {
+    struct list *buckets;
+    unsigned buckets_count;
+    struct list lru; // most recently used first
+    unsigned count;
+    unsigned max;
+};
+
+// buckets is an array of buckets_count lists, owned by the caller
+void lru_init(struct lru *lru, struct list *buckets, unsigned buckets_count, unsigned max);
+void lru_insert(struct lru *lru, struct lru_entry *entry, unsigned hash);
+void lru_remove(struct lru *lru, struct lru_entry *entry);
+// Marks the entry as just used
+void lru_touch(struct lru *lru, struct lru_entry *entry);
+// If the table is full, returns the entry that should be removed to make
+// room, otherwise NULL
+struct lru_entry *lru_victim(struct lru *lru);
+
+#define lru_for_each_hashed(lru_, hash_, item, member) \
+    list_for_each_entry(&(lru_)->buckets[(hash_) % (lru_)->buckets_count], item, member.chain)
+#define lru_for_each_safe(lru_, item, tmp, member) \
+    list_for_each_entry_safe(&(lru_)->lru, item, tmp, member.lru)
+
+#endif
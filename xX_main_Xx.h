@@ -20,7 +20,7 @@ static inline int xX_main_Xx(int argc, char *const argv[], const char *envp) {
     const char *root = "";
     bool has_root = false;
     const struct fs_ops *fs = &realfs;
-    while ((opt = getopt(argc, argv, "+r:f:")) != -1) {
+    while ((opt = getopt(argc, argv, "+r:f:bl")) != -1) {
         switch (opt) {
             case 'r':
             case 'f':
@@ -29,6 +29,14 @@ static inline int xX_main_Xx(int argc, char *const argv[], const char *envp) {
                 if (opt == 'f')
                     fs = &fakefs;
                 break;
+            case 'b':
+                // group fakefs metadata commits, see fs/fake.c
+                fakefs_commit_policy.batch = true;
+                break;
+            case 'l':
+                // rebuild fakefs metadata in the background, see fs/fake-rebuild.c
+                fakefs_rebuild_policy.lazy = true;
+                break;
         }
     }
 